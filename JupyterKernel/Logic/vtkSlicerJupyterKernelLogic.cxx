@@ -19,7 +19,19 @@
 #include "vtkSlicerJupyterKernelLogic.h"
 
 // MRML includes
+#include <vtkMRMLAbstractViewNode.h>
+#include <vtkMRMLCameraNode.h>
+#include <vtkMRMLColorNode.h>
+#include <vtkMRMLDisplayableNode.h>
+#include <vtkMRMLDisplayNode.h>
+#include <vtkMRMLModelNode.h>
 #include <vtkMRMLScene.h>
+#include <vtkMRMLSliceCompositeNode.h>
+#include <vtkMRMLTransformNode.h>
+#include <vtkMRMLVolumeNode.h>
+
+// MRMLLogic includes
+#include <vtkMRMLSliceLogic.h>
 
 // VTK includes
 #include <vtkIntArray.h>
@@ -27,8 +39,11 @@
 #include <vtkObjectFactory.h>
 
 // STD includes
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <fstream>
+#include <vector>
 
 //----------------------------------------------------------------------------
 vtkStandardNewMacro(vtkSlicerJupyterKernelLogic);
@@ -47,6 +62,12 @@ vtkSlicerJupyterKernelLogic::~vtkSlicerJupyterKernelLogic()
 void vtkSlicerJupyterKernelLogic::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os, indent);
+  os << indent << "ChangeCounter: " << this->ChangeCounter << "\n";
+  os << indent << "AllViewsChangeCounter: " << this->AllViewsChangeCounter << "\n";
+  for (const auto& viewChangeCounter : this->ViewChangeCounters)
+  {
+    os << indent << "ViewChangeCounter " << viewChangeCounter.first << ": " << viewChangeCounter.second << "\n";
+  }
 }
 
 //---------------------------------------------------------------------------
@@ -69,16 +90,227 @@ void vtkSlicerJupyterKernelLogic::RegisterNodes()
 void vtkSlicerJupyterKernelLogic::UpdateFromMRMLScene()
 {
   assert(this->GetMRMLScene() != 0);
+  std::vector<vtkMRMLNode*> nodes;
+  this->GetMRMLScene()->GetNodesByClass("vtkMRMLNode", nodes);
+  for (vtkMRMLNode* node : nodes)
+  {
+    this->ObserveNode(node);
+  }
+  this->SetAllViewsModified();
 }
 
 //---------------------------------------------------------------------------
 void vtkSlicerJupyterKernelLogic
-::OnMRMLSceneNodeAdded(vtkMRMLNode* vtkNotUsed(node))
+::OnMRMLSceneNodeAdded(vtkMRMLNode* node)
 {
+  this->ObserveNode(node);
+  this->SetNodeViewsModified(node);
 }
 
 //---------------------------------------------------------------------------
 void vtkSlicerJupyterKernelLogic
-::OnMRMLSceneNodeRemoved(vtkMRMLNode* vtkNotUsed(node))
+::OnMRMLSceneNodeRemoved(vtkMRMLNode* node)
+{
+  if (!node)
+  {
+    return;
+  }
+  this->GetMRMLNodesObserverManager()->RemoveObjectEvents(node);
+  this->SetNodeViewsModified(node);
+  if (vtkMRMLAbstractViewNode::SafeDownCast(node) && node->GetID())
+  {
+    this->ViewChangeCounters.erase(node->GetID());
+    this->ViewContentChangeCounters.erase(node->GetID());
+  }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerJupyterKernelLogic::OnMRMLSceneEndBatchProcess()
+{
+  // Nodes are not tracked individually during batch processing (scene loading, closing, etc.)
+  this->SetAllViewsModified();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerJupyterKernelLogic::ProcessMRMLNodesEvents(vtkObject* caller, unsigned long event, void* callData)
+{
+  vtkMRMLNode* node = vtkMRMLNode::SafeDownCast(caller);
+  if (!node)
+  {
+    this->Superclass::ProcessMRMLNodesEvents(caller, event, callData);
+    return;
+  }
+  this->SetNodeViewsModified(node);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerJupyterKernelLogic::ObserveNode(vtkMRMLNode* node)
+{
+  if (!node)
+  {
+    return;
+  }
+  // Only observe nodes that may be shown in views, as there may be many other
+  // frequently modified nodes (subject hierarchy, storage nodes, parameter nodes, ...)
+  if (!vtkMRMLAbstractViewNode::SafeDownCast(node)
+    && !vtkMRMLCameraNode::SafeDownCast(node)
+    && !vtkMRMLSliceCompositeNode::SafeDownCast(node)
+    && !vtkMRMLDisplayNode::SafeDownCast(node)
+    && !vtkMRMLDisplayableNode::SafeDownCast(node)
+    && !vtkMRMLColorNode::SafeDownCast(node))
+  {
+    return;
+  }
+  vtkNew<vtkIntArray> events;
+  events->InsertNextValue(vtkCommand::ModifiedEvent);
+  events->InsertNextValue(vtkMRMLTransformableNode::TransformModifiedEvent);
+  events->InsertNextValue(vtkMRMLVolumeNode::ImageDataModifiedEvent);
+  events->InsertNextValue(vtkMRMLModelNode::MeshModifiedEvent);
+  this->GetMRMLNodesObserverManager()->AddObjectEvents(node, events.GetPointer());
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerJupyterKernelLogic::SetNodeViewsModified(vtkMRMLNode* node)
+{
+  if (!node)
+  {
+    return;
+  }
+  if (this->GetMRMLScene() && this->GetMRMLScene()->IsBatchProcessing())
+  {
+    // all views will be marked as modified at the end of batch processing
+    return;
+  }
+  if (vtkMRMLTransformNode::SafeDownCast(node) || vtkMRMLColorNode::SafeDownCast(node))
+  {
+    // Transforms and color tables may be used by any displayed node
+    this->SetAllViewsModified();
+  }
+  else if (vtkMRMLAbstractViewNode::SafeDownCast(node))
+  {
+    this->SetViewModified(node->GetID(), true);
+  }
+  else if (vtkMRMLCameraNode* cameraNode = vtkMRMLCameraNode::SafeDownCast(node))
+  {
+    this->SetLayoutViewModified(cameraNode->GetLayoutName());
+  }
+  else if (vtkMRMLSliceCompositeNode* sliceCompositeNode = vtkMRMLSliceCompositeNode::SafeDownCast(node))
+  {
+    this->SetLayoutViewModified(sliceCompositeNode->GetLayoutName());
+  }
+  else if (vtkMRMLSliceLogic::IsSliceModelNode(node)
+    || vtkMRMLSliceLogic::IsSliceModelDisplayNode(vtkMRMLDisplayNode::SafeDownCast(node)))
+  {
+    // Slice models are updated when the slice offset changes. They are only displayed in 3D views,
+    // therefore they must not change the content change counter of slice views.
+    this->SetThreeDViewsModified();
+  }
+  else if (vtkMRMLDisplayNode* displayNode = vtkMRMLDisplayNode::SafeDownCast(node))
+  {
+    std::vector<std::string> viewNodeIDs = displayNode->GetViewNodeIDs();
+    if (viewNodeIDs.empty())
+    {
+      this->SetAllViewsModified();
+      return;
+    }
+    for (const std::string& viewNodeID : viewNodeIDs)
+    {
+      this->SetViewModified(viewNodeID.c_str());
+    }
+  }
+  else if (vtkMRMLDisplayableNode* displayableNode = vtkMRMLDisplayableNode::SafeDownCast(node))
+  {
+    for (int displayNodeIndex = 0; displayNodeIndex < displayableNode->GetNumberOfDisplayNodes(); ++displayNodeIndex)
+    {
+      this->SetNodeViewsModified(displayableNode->GetNthDisplayNode(displayNodeIndex));
+    }
+  }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerJupyterKernelLogic::SetLayoutViewModified(const char* layoutName)
+{
+  if (!layoutName || !this->GetMRMLScene())
+  {
+    this->SetAllViewsModified();
+    return;
+  }
+  std::vector<vtkMRMLNode*> viewNodes;
+  this->GetMRMLScene()->GetNodesByClass("vtkMRMLAbstractViewNode", viewNodes);
+  for (vtkMRMLNode* viewNode : viewNodes)
+  {
+    const char* viewLayoutName = vtkMRMLAbstractViewNode::SafeDownCast(viewNode)->GetLayoutName();
+    if (viewLayoutName && strcmp(viewLayoutName, layoutName) == 0)
+    {
+      this->SetViewModified(viewNode->GetID());
+      return;
+    }
+  }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerJupyterKernelLogic::SetThreeDViewsModified()
+{
+  if (!this->GetMRMLScene())
+  {
+    return;
+  }
+  std::vector<vtkMRMLNode*> viewNodes;
+  this->GetMRMLScene()->GetNodesByClass("vtkMRMLViewNode", viewNodes);
+  for (vtkMRMLNode* viewNode : viewNodes)
+  {
+    this->SetViewModified(viewNode->GetID());
+  }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerJupyterKernelLogic::SetViewModified(const char* viewNodeID, bool viewNodeModified/*=false*/)
+{
+  if (!viewNodeID)
+  {
+    return;
+  }
+  this->ViewChangeCounters[viewNodeID] = ++this->ChangeCounter;
+  if (!viewNodeModified)
+  {
+    this->ViewContentChangeCounters[viewNodeID] = this->ChangeCounter;
+  }
+  this->InvokeEvent(ViewModifiedEvent, const_cast<char*>(viewNodeID));
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerJupyterKernelLogic::SetAllViewsModified()
+{
+  this->AllViewsChangeCounter = ++this->ChangeCounter;
+  this->InvokeEvent(ViewModifiedEvent);
+}
+
+//---------------------------------------------------------------------------
+unsigned long vtkSlicerJupyterKernelLogic::GetViewChangeCounter(const char* viewNodeID)
+{
+  if (!viewNodeID)
+  {
+    return this->ChangeCounter;
+  }
+  auto viewChangeCounterIt = this->ViewChangeCounters.find(viewNodeID);
+  if (viewChangeCounterIt == this->ViewChangeCounters.end())
+  {
+    return this->AllViewsChangeCounter;
+  }
+  return std::max(viewChangeCounterIt->second, this->AllViewsChangeCounter);
+}
+
+//---------------------------------------------------------------------------
+unsigned long vtkSlicerJupyterKernelLogic::GetViewContentChangeCounter(const char* viewNodeID)
 {
+  if (!viewNodeID)
+  {
+    return this->ChangeCounter;
+  }
+  auto viewContentChangeCounterIt = this->ViewContentChangeCounters.find(viewNodeID);
+  if (viewContentChangeCounterIt == this->ViewContentChangeCounters.end())
+  {
+    return this->AllViewsChangeCounter;
+  }
+  return std::max(viewContentChangeCounterIt->second, this->AllViewsChangeCounter);
 }
@@ -29,8 +29,13 @@
 
 // MRML includes
 
+// VTK includes
+#include <vtkCommand.h>
+
 // STD includes
 #include <cstdlib>
+#include <map>
+#include <string>
 
 #include "vtkSlicerJupyterKernelModuleLogicExport.h"
 
@@ -45,6 +50,30 @@ public:
   vtkTypeMacro(vtkSlicerJupyterKernelLogic, vtkSlicerModuleLogic);
   void PrintSelf(ostream& os, vtkIndent indent) override;
 
+  enum Events
+  {
+    /// Invoked when a node is modified that may change the content of one or more views.
+    /// Not invoked during scene batch processing, but once at the end of it.
+    ViewModifiedEvent = vtkCommand::UserEvent + 512
+  };
+
+  /// Get a number that is increased when a node that may change the content of the view is modified.
+  /// Notebook widgets store this value when they capture a view and only capture it again
+  /// when the value is different.
+  /// Nodes are mapped to views as follows: view nodes, cameras and slice composite nodes
+  /// affect their own view; display nodes affect the views listed in their view node IDs
+  /// (all views if the list is empty); displayable nodes affect the views of their display nodes;
+  /// slice models affect 3D views; transforms, color tables, and scene batch processing affect all views.
+  unsigned long GetViewChangeCounter(const char* viewNodeID);
+
+  /// Same as GetViewChangeCounter, but modification of the view node itself (e.g., changing the slice offset
+  /// in a slice node) does not increase the value. Captured images can be cached using this value,
+  /// along with view node properties that affect the view content.
+  unsigned long GetViewContentChangeCounter(const char* viewNodeID);
+
+  /// Indicate that content of all views may have changed.
+  void SetAllViewsModified();
+
 protected:
   vtkSlicerJupyterKernelLogic();
   virtual ~vtkSlicerJupyterKernelLogic();
@@ -55,6 +84,30 @@ protected:
   virtual void UpdateFromMRMLScene() override;
   virtual void OnMRMLSceneNodeAdded(vtkMRMLNode* node) override;
   virtual void OnMRMLSceneNodeRemoved(vtkMRMLNode* node) override;
+  virtual void OnMRMLSceneEndBatchProcess() override;
+  virtual void ProcessMRMLNodesEvents(vtkObject* caller, unsigned long event, void* callData) override;
+
+  /// Start observing events of a node that may indicate change of view content.
+  void ObserveNode(vtkMRMLNode* node);
+
+  /// Update change counters of views that display the node.
+  void SetNodeViewsModified(vtkMRMLNode* node);
+
+  /// Update change counter of the view that has the specified layout name.
+  void SetLayoutViewModified(const char* layoutName);
+
+  /// Update change counters of all 3D views.
+  void SetThreeDViewsModified();
+
+  /// Increase change counter of the view. If viewNodeModified is false then the content change counter is increased, too.
+  void SetViewModified(const char* viewNodeID, bool viewNodeModified = false);
+
+  /// Change counter value is taken from this at each modification, therefore values are unique
+  /// and can be compared between views.
+  unsigned long ChangeCounter{ 0 };
+  unsigned long AllViewsChangeCounter{ 0 };
+  std::map<std::string, unsigned long> ViewChangeCounters;
+  std::map<std::string, unsigned long> ViewContentChangeCounters;
 
 private:
 
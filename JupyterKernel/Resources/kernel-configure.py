@@ -1,3 +1,19 @@
 # Content of this file is executed after the kernel is started.
-# Previously it was used for setting up a custom display hook, but currently
-# no additional intilization steps are needed.
+
+# Index slicer, vtk, qt, and ctk namespaces in the background for fast code completion
+# (see kernel_completion_index.py, which is in the same folder as this file).
+def _startKernelCompletionIndex():
+  import logging
+  import sys
+  import slicer
+  resourceFolder = slicer.modules.jupyterkernel.resourceFolderPath()
+  if resourceFolder not in sys.path:
+    sys.path.append(resourceFolder)
+  try:
+    import kernel_completion_index
+    kernel_completion_index.start()
+  except Exception as e:
+    logging.warning("Code completion index is not available: {0}".format(e))
+
+_startKernelCompletionIndex()
+del _startKernelCompletionIndex
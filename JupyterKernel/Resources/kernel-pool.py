@@ -0,0 +1,367 @@
+# Launch a Slicer kernel from a pool of pre-started Slicer instances.
+#
+# Starting Slicer (application, modules, Python environment) takes a long time.
+# When the kernel specification is generated with a kernel pool size larger than 0
+# (see qSlicerJupyterKernelModule::kernelPoolSize), Jupyter runs this script instead
+# of Slicer. This script:
+#
+# - makes sure that a pool manager process is running, which keeps the requested
+#   number of idle Slicer instances started,
+# - claims an idle Slicer instance and sends it the connection file, working directory, and
+#   environment through a local socket (the instance calls slicer.modules.jupyterkernel.startKernel),
+# - keeps running until the Slicer instance exits, so that Jupyter can manage the kernel
+#   process as usual. If Jupyter terminates this process then Slicer exits as well.
+#
+# If no idle instance is available then Slicer is started directly, the same way
+# as without the pool.
+#
+# Usage (kernel.json argv):
+#   PythonSlicer kernel-pool.py --slicer <SlicerLauncher> [--pool-size N] [--pool-dir DIR] [--linger SEC] <connection_file>
+
+import argparse
+import getpass
+import hashlib
+import json
+import os
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import uuid
+
+HEARTBEAT_INTERVAL_SEC = 1.0
+# Manager is considered stopped if it has not updated the heartbeat file for this long
+HEARTBEAT_TIMEOUT_SEC = 10.0
+# Pool member that has not become ready in this time is stopped and restarted
+MEMBER_STARTUP_TIMEOUT_SEC = 300.0
+CONNECT_TIMEOUT_SEC = 10.0
+
+
+def defaultPoolDirectory(slicerExecutable):
+  """Each user and Slicer installation has a separate pool."""
+  installationHash = hashlib.sha1(os.path.abspath(slicerExecutable).encode("utf-8")).hexdigest()[:10]
+  try:
+    user = getpass.getuser()
+  except Exception:
+    user = "user"
+  return os.path.join(tempfile.gettempdir(), "SlicerKernelPool-{0}-{1}".format(user, installationHash))
+
+
+def slicerKernelCommand(slicerExecutable, pythonCode):
+  return [slicerExecutable, "--no-splash", "--python-code",
+    pythonCode + ";slicer.util.mainWindow().showMinimized()"]
+
+
+class PoolFiles(object):
+  """File names used for communication between launchers, the manager, and pool members.
+
+  A member that is ready for use creates <name>.ready (written atomically).
+  A launcher claims a member by renaming <name>.ready to <name>.claimed.
+  Rename is atomic, therefore each member is handed to exactly one launcher.
+  """
+
+  def __init__(self, poolDirectory):
+    self.poolDirectory = poolDirectory
+
+  def path(self, fileName):
+    return os.path.join(self.poolDirectory, fileName)
+
+  def readyFile(self, name):
+    return self.path(name + ".ready")
+
+  def claimedFile(self, name):
+    return self.path(name + ".claimed")
+
+  @property
+  def heartbeatFile(self):
+    return self.path("manager.heartbeat")
+
+  @property
+  def lockFile(self):
+    return self.path("manager.lock")
+
+  @property
+  def poolSizeFile(self):
+    return self.path("pool-size")
+
+  @property
+  def logFile(self):
+    return self.path("manager.log")
+
+  def readyMemberNames(self):
+    """Names of ready members, oldest first."""
+    try:
+      fileNames = [f for f in os.listdir(self.poolDirectory) if f.endswith(".ready")]
+    except OSError:
+      return []
+    def modifiedTime(fileName):
+      try:
+        return os.path.getmtime(self.path(fileName))
+      except OSError:
+        return 0
+    fileNames.sort(key=modifiedTime)
+    return [f[:-len(".ready")] for f in fileNames]
+
+  def isManagerRunning(self):
+    try:
+      return time.time() - os.path.getmtime(self.heartbeatFile) < HEARTBEAT_TIMEOUT_SEC
+    except OSError:
+      return False
+
+
+def removeFile(filePath):
+  try:
+    os.remove(filePath)
+  except OSError:
+    pass
+
+
+class MemberConnection(object):
+  """Connection to the local server of a pool member (QLocalServer).
+
+  On Windows the server is a named pipe, on other platforms it is a Unix domain socket.
+  """
+
+  def __init__(self, serverName):
+    if os.name == "nt":
+      pipeName = serverName if serverName.startswith("\\\\") else "\\\\.\\pipe\\" + serverName
+      self._pipe = open(pipeName, "r+b", buffering=0)
+      self._socket = None
+    else:
+      self._pipe = None
+      self._socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+      self._socket.settimeout(CONNECT_TIMEOUT_SEC)
+      self._socket.connect(serverName)
+    self._received = b""
+
+  def send(self, data):
+    if self._socket:
+      self._socket.sendall(data)
+    else:
+      self._pipe.write(data)
+      self._pipe.flush()
+
+  def _read(self):
+    if self._socket:
+      return self._socket.recv(4096)
+    return self._pipe.read(1)
+
+  def readLine(self):
+    while b"\n" not in self._received:
+      data = self._read()
+      if not data:
+        return None
+      self._received += data
+    line, self._received = self._received.split(b"\n", 1)
+    return line
+
+  def waitUntilClosed(self):
+    """Block until the member process closes the connection (exits)."""
+    if self._socket:
+      self._socket.settimeout(None)
+    try:
+      while self._read():
+        pass
+    except OSError:
+      pass
+
+  def close(self):
+    if self._socket:
+      self._socket.close()
+    else:
+      self._pipe.close()
+
+
+def startDetached(args, logFilePath):
+  kwargs = {}
+  if os.name == "nt":
+    kwargs["creationflags"] = subprocess.DETACHED_PROCESS | subprocess.CREATE_NEW_PROCESS_GROUP
+  else:
+    kwargs["start_new_session"] = True
+  with open(logFilePath, "ab") as logFile:
+    return subprocess.Popen(args, stdin=subprocess.DEVNULL, stdout=logFile, stderr=subprocess.STDOUT,
+      close_fds=True, **kwargs)
+
+
+def ensureManagerRunning(args, files):
+  # The manager reads the pool size at each iteration, so the size can be changed without restarting it
+  with open(files.poolSizeFile + ".tmp", "w") as f:
+    f.write(str(args.pool_size))
+  os.replace(files.poolSizeFile + ".tmp", files.poolSizeFile)
+  if files.isManagerRunning():
+    return
+  managerArgs = [sys.executable, os.path.abspath(__file__), "--manager",
+    "--slicer", args.slicer, "--pool-dir", files.poolDirectory, "--linger", str(args.linger)]
+  startDetached(managerArgs, files.logFile)
+
+
+def claimMember(files):
+  """Returns (member name, connection) of a claimed member or (None, None) if no idle member is available."""
+  for name in files.readyMemberNames():
+    try:
+      os.rename(files.readyFile(name), files.claimedFile(name))
+    except OSError:
+      # Claimed by another launcher
+      continue
+    try:
+      with open(files.claimedFile(name)) as f:
+        memberInfo = json.load(f)
+      removeFile(files.claimedFile(name))
+      return name, MemberConnection(memberInfo["server"])
+    except (OSError, ValueError, KeyError) as e:
+      removeFile(files.claimedFile(name))
+      # Member exited without removing its ready file
+      sys.stderr.write("Slicer kernel pool: cannot connect to {0}: {1}\n".format(name, e))
+  return None, None
+
+
+def launchKernel(args):
+  files = PoolFiles(args.pool_dir or defaultPoolDirectory(args.slicer))
+  os.makedirs(files.poolDirectory, exist_ok=True)
+  try:
+    ensureManagerRunning(args, files)
+  except OSError as e:
+    sys.stderr.write("Slicer kernel pool: cannot start pool manager: {0}\n".format(e))
+
+  # Interrupts are sent as messages (interrupt_mode=message), a signal must not stop the launcher
+  signal.signal(signal.SIGINT, signal.SIG_IGN)
+
+  connectionFile = os.path.abspath(args.connection_file)
+  name, connection = claimMember(files)
+  if connection:
+    try:
+      # The member was started by the pool manager, send the working directory and environment
+      # that Jupyter set up for this kernel, so that the kernel runs as if Jupyter started it
+      request = {"connection_file": connectionFile, "cwd": os.getcwd(), "env": dict(os.environ)}
+      connection.send((json.dumps(request) + "\n").encode("utf-8"))
+      reply = json.loads((connection.readLine() or b"{}").decode("utf-8"))
+      if reply.get("status") == "ok":
+        connection.waitUntilClosed()
+        return 0
+      sys.stderr.write("Slicer kernel pool: {0} failed to start kernel: {1}\n".format(name, reply.get("message")))
+    except (OSError, ValueError) as e:
+      sys.stderr.write("Slicer kernel pool: {0} failed to start kernel: {1}\n".format(name, e))
+    finally:
+      connection.close()
+
+  # No idle instance is available, start Slicer now
+  pythonCode = ("connection_file=r'{0}';print('JupyterConnectionFile:['+connection_file+']');"
+    "slicer.modules.jupyterkernel.startKernel(connection_file)").format(connectionFile)
+  return subprocess.call(slicerKernelCommand(args.slicer, pythonCode))
+
+
+class PoolManager(object):
+  """Keeps the requested number of idle Slicer instances started."""
+
+  def __init__(self, args):
+    self.slicerExecutable = args.slicer
+    self.files = PoolFiles(args.pool_dir)
+    self.lingerSec = args.linger
+    self.members = {}  # name -> {process, startTime, ready}
+    self.lastClaimTime = time.time()
+
+  def acquireLock(self):
+    """Make sure that only one manager is running for a pool."""
+    for attempt in range(2):
+      try:
+        fd = os.open(self.files.lockFile, os.O_CREAT | os.O_EXCL | os.O_WRONLY)
+        os.write(fd, str(os.getpid()).encode())
+        os.close(fd)
+        return True
+      except FileExistsError:
+        if self.files.isManagerRunning():
+          return False
+        # Previous manager exited without cleanup
+        removeFile(self.files.lockFile)
+    return False
+
+  def poolSize(self):
+    try:
+      with open(self.files.poolSizeFile) as f:
+        return max(0, int(f.read().strip()))
+    except (OSError, ValueError):
+      return 0
+
+  def startMember(self):
+    name = "slicer-kernel-" + uuid.uuid4().hex[:12]
+    pythonCode = "slicer.modules.jupyterkernel.listenForKernelConnection(r'{0}', r'{1}')".format(
+      name, self.files.readyFile(name))
+    process = startDetached(slicerKernelCommand(self.slicerExecutable, pythonCode), self.files.logFile)
+    self.members[name] = {"process": process, "startTime": time.time(), "ready": False}
+
+  def stopMember(self, name):
+    member = self.members.pop(name)
+    # Take the ready file first, so that no launcher can claim the member while it is stopped
+    stoppingFile = self.files.path(name + ".stopping")
+    try:
+      os.rename(self.files.readyFile(name), stoppingFile)
+    except OSError:
+      if member["ready"]:
+        # Claimed by a launcher in the meantime, keep it running
+        return
+    member["process"].terminate()
+    removeFile(stoppingFile)
+
+  def update(self):
+    for name, member in list(self.members.items()):
+      readyFileExists = os.path.exists(self.files.readyFile(name))
+      if readyFileExists:
+        member["ready"] = True
+      if os.path.exists(self.files.claimedFile(name)) or (member["ready"] and not readyFileExists):
+        # Handed over to a launcher, which manages it from now on
+        del self.members[name]
+        self.lastClaimTime = time.time()
+      elif member["process"].poll() is not None:
+        # Exited (crashed or closed by the user)
+        del self.members[name]
+        removeFile(self.files.readyFile(name))
+      elif not member["ready"] and time.time() - member["startTime"] > MEMBER_STARTUP_TIMEOUT_SEC:
+        sys.stderr.write("Slicer kernel pool: {0} did not start in time\n".format(name))
+        self.stopMember(name)
+
+    poolSize = self.poolSize()
+    while len(self.members) < poolSize:
+      self.startMember()
+    # Stop extra members if the pool size was decreased
+    for name in list(self.members.keys())[poolSize:]:
+      self.stopMember(name)
+
+  def run(self):
+    if not self.acquireLock():
+      return 0
+    try:
+      while self.lingerSec <= 0 or time.time() - self.lastClaimTime < self.lingerSec:
+        with open(self.files.heartbeatFile, "w") as f:
+          f.write(str(os.getpid()))
+        self.update()
+        time.sleep(HEARTBEAT_INTERVAL_SEC)
+    finally:
+      # No kernel was requested for a long time, release resources
+      for name in list(self.members.keys()):
+        self.stopMember(name)
+      removeFile(self.files.heartbeatFile)
+      removeFile(self.files.lockFile)
+    return 0
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Launch a Slicer kernel from a pool of pre-started Slicer instances.")
+  parser.add_argument("--slicer", required=True, help="Slicer launcher executable")
+  parser.add_argument("--pool-size", type=int, default=1, help="number of idle Slicer instances to keep started")
+  parser.add_argument("--pool-dir", help="folder for sharing pool state between launchers")
+  parser.add_argument("--linger", type=float, default=3600.0,
+    help="stop the pool if no kernel is requested for this many seconds (0 = never)")
+  parser.add_argument("--manager", action="store_true", help=argparse.SUPPRESS)
+  parser.add_argument("connection_file", nargs="?")
+  args = parser.parse_args()
+  if args.manager:
+    return PoolManager(args).run()
+  if not args.connection_file:
+    parser.error("connection_file is required")
+  return launchKernel(args)
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,313 @@
+# Code completion and inspection index for the Slicer kernel.
+#
+# Completing "slicer.", "vtk.", "qt.", or "ctk." with live introspection requires walking
+# namespaces that contain thousands of dynamically wrapped classes, which blocks the main
+# thread for seconds. This module builds an index of these namespaces after the kernel
+# is started (see kernel-configure.py) and the kernel answers complete_request and
+# inspect_request messages from the index (see xSlicerInterpreter::indexed_reply).
+#
+# - Members of VTK and pure Python objects are collected in a background thread.
+#   PythonQt-wrapped objects (qt, ctk, qSlicer... classes) can only be accessed from the
+#   main thread, therefore they are collected in the main thread, in short time slices.
+# - The index is saved in the kernel resource folder (a separate folder for each
+#   Slicer version) and reused by later kernels. It is rebuilt when the Slicer
+#   revision, loaded modules, or installed extensions change.
+# - Requests are answered from the index only if the expression starts with one of
+#   the indexed modules and the index contains the object. For any other object (e.g.,
+#   variables created by the user) the kernel falls back to live introspection.
+
+import hashlib
+import json
+import logging
+import os
+import queue
+import re
+import sys
+import tempfile
+import threading
+import time
+import types
+
+INDEX_FORMAT_VERSION = 1
+INDEXED_MODULE_NAMES = ["slicer", "vtk", "qt", "ctk"]
+INDEX_FILE_NAME = "completion-index.json"
+# Maximum length of documentation stored for each object
+MAX_DOC_LENGTH = 1000
+# Time spent in the main thread at once with collecting members of PythonQt objects
+MAIN_THREAD_TIME_SLICE_SEC = 0.02
+MAIN_THREAD_INTERVAL_MSEC = 50
+
+# Dotted expression (e.g., "slicer.util.getN") at the end of the code
+_completionExpressionPattern = re.compile(r"([A-Za-z_]\w*(?:\.[A-Za-z_]\w*)*)\.(\w*)$")
+_identifierCharacters = re.compile(r"[\w.]")
+
+
+def _isPythonQtObject(obj):
+  """PythonQt wrappers must not be accessed from background threads."""
+  objectType = type(obj)
+  return "PythonQt" in objectType.__module__ or "PythonQt" in type(objectType).__module__
+
+
+def _objectKind(obj):
+  if isinstance(obj, types.ModuleType):
+    return "module"
+  if isinstance(obj, type) or "ClassWrapper" in type(obj).__name__:
+    return "class"
+  if callable(obj):
+    return "function"
+  return "instance"
+
+
+def _publicMembers(obj):
+  return sorted(name for name in dir(obj) if not name.startswith("__"))
+
+
+def _shortDoc(obj):
+  try:
+    doc = getattr(obj, "__doc__", None)
+  except Exception:
+    return ""
+  if not isinstance(doc, str):
+    return ""
+  doc = doc.strip()
+  if len(doc) > MAX_DOC_LENGTH:
+    doc = doc[:MAX_DOC_LENGTH] + "..."
+  return doc
+
+
+def indexFingerprint():
+  """Identifies Slicer version, loaded modules, and installed extensions.
+  If any of these change then the index is rebuilt."""
+  import slicer
+  items = [
+    str(INDEX_FORMAT_VERSION),
+    slicer.app.applicationVersion,
+    slicer.app.repositoryRevision,
+    ",".join(sorted(slicer.app.moduleManager().modulesNames())),
+    ]
+  extensionsPath = getattr(slicer.app, "extensionsInstallPath", "")
+  if extensionsPath and os.path.isdir(extensionsPath):
+    for entry in sorted(os.listdir(extensionsPath)):
+      entryPath = os.path.join(extensionsPath, entry)
+      items.append("{0}:{1}".format(entry, int(os.path.getmtime(entryPath))))
+  return hashlib.sha1("\n".join(items).encode("utf-8")).hexdigest()
+
+
+def defaultIndexFilePath():
+  """Index is stored next to the kernel specification. If that folder is not writable
+  (e.g., read-only Slicer installation) then the application cache folder is used."""
+  import slicer
+  folder = slicer.modules.jupyterkernel.resourceFolderPath()
+  if not folder or not os.access(folder, os.W_OK):
+    folder = slicer.app.cachePath
+  return os.path.join(folder, INDEX_FILE_NAME)
+
+
+class CompletionIndex(object):
+  """Members and documentation of objects in the indexed modules.
+
+  members: full name (e.g., "vtk", "vtk.vtkImageData") -> sorted list of member names
+  docs: full name -> {"kind": "module|class|function|instance", "doc": "..."}
+  Docs are stored for the indexed modules and their members only (not for members of classes),
+  to keep the index small, as live inspection of a single class member is fast.
+  """
+
+  def __init__(self, filePath, fingerprint):
+    self.filePath = filePath
+    self.fingerprint = fingerprint
+    self.members = {}
+    self.docs = {}
+    self.ready = False
+    self._mainThreadItems = queue.Queue()
+    self._workerThread = None
+    self._workerDone = False
+    self._mainThreadTimer = None
+
+  def load(self):
+    """Returns True if a valid index was found on disk."""
+    try:
+      with open(self.filePath, "r", encoding="utf-8") as indexFile:
+        content = json.load(indexFile)
+    except (OSError, ValueError):
+      return False
+    if content.get("fingerprint") != self.fingerprint:
+      return False
+    self.members = content.get("members", {})
+    self.docs = content.get("docs", {})
+    self.ready = True
+    return True
+
+  def save(self):
+    content = {"fingerprint": self.fingerprint, "members": self.members, "docs": self.docs}
+    # Kernels that are started at the same time may save the index at the same time,
+    # therefore each of them writes a separate temporary file
+    temporaryFilePath = None
+    try:
+      fileHandle, temporaryFilePath = tempfile.mkstemp(
+        dir=os.path.dirname(self.filePath), prefix=INDEX_FILE_NAME + ".", suffix=".tmp")
+      with os.fdopen(fileHandle, "w", encoding="utf-8") as indexFile:
+        json.dump(content, indexFile, separators=(",", ":"))
+      os.replace(temporaryFilePath, self.filePath)
+    except OSError as e:
+      logging.warning("Failed to save code completion index to {0}: {1}".format(self.filePath, e))
+      if temporaryFilePath and os.path.exists(temporaryFilePath):
+        os.remove(temporaryFilePath)
+
+  def build(self):
+    """Start collecting members. Must be called from the main thread."""
+    import qt
+    self._mainThreadTimer = qt.QTimer()
+    self._mainThreadTimer.setInterval(MAIN_THREAD_INTERVAL_MSEC)
+    self._mainThreadTimer.connect("timeout()", self._processMainThreadItems)
+    self._mainThreadTimer.start()
+    self._workerThread = threading.Thread(target=self._collect, name="SlicerKernelCompletionIndex", daemon=True)
+    self._workerThread.start()
+
+  def _addObject(self, fullName, obj, kind):
+    """Store documentation and members of obj. PythonQt objects are queued for processing in the main thread."""
+    if _isPythonQtObject(obj) and threading.current_thread() is not threading.main_thread():
+      self._mainThreadItems.put((fullName, obj, kind))
+      return
+    self.docs[fullName] = {"kind": kind, "doc": "" if kind == "instance" else _shortDoc(obj)}
+    if kind == "function":
+      return
+    try:
+      self.members[fullName] = _publicMembers(obj)
+    except Exception:
+      # Some wrapped objects cannot be introspected, they will be inspected live
+      pass
+
+  def _collect(self):
+    startTime = time.time()
+    for moduleName in INDEXED_MODULE_NAMES:
+      module = sys.modules.get(moduleName)
+      if module is None:
+        continue
+      self.docs[moduleName] = {"kind": "module", "doc": _shortDoc(module)}
+      memberNames = _publicMembers(module)
+      for memberName in memberNames:
+        try:
+          member = getattr(module, memberName)
+        except Exception:
+          continue
+        fullName = moduleName + "." + memberName
+        kind = _objectKind(member)
+        if kind == "module" and not getattr(member, "__name__", "").startswith(moduleName + "."):
+          # Imported module (such as "os" in a module namespace), not part of the indexed module
+          continue
+        self._addObject(fullName, member, kind)
+      # Namespace members are added last, so that requests are answered
+      # from the index only when all the members are available
+      self.members[moduleName] = memberNames
+    logging.debug("Code completion index collected in background in {0:.1f}s".format(time.time() - startTime))
+    self._workerDone = True
+
+  def _processMainThreadItems(self):
+    startTime = time.time()
+    while time.time() - startTime < MAIN_THREAD_TIME_SLICE_SEC:
+      try:
+        fullName, obj, kind = self._mainThreadItems.get_nowait()
+      except queue.Empty:
+        if self._workerDone:
+          self._mainThreadTimer.stop()
+          self.ready = True
+          self.save()
+        return
+      self._addObject(fullName, obj, kind)
+
+  def _resolve(self, expression):
+    """Map an expression to an indexed name. Returns None if the root of the expression
+    is not an indexed module in the user namespace (e.g., a variable named "vtk")."""
+    rootName, _, rest = expression.partition(".")
+    mainNamespace = sys.modules["__main__"].__dict__
+    if rootName not in mainNamespace:
+      return None
+    for moduleName in INDEXED_MODULE_NAMES:
+      if sys.modules.get(moduleName) is mainNamespace[rootName]:
+        return moduleName + ("." + rest if rest else "")
+    return None
+
+  def complete(self, code, cursorPos):
+    match = _completionExpressionPattern.search(code[:cursorPos])
+    if not match:
+      return None
+    indexedName = self._resolve(match.group(1))
+    if indexedName is None or indexedName not in self.members:
+      return None
+    prefix = match.group(2)
+    matches = [name for name in self.members[indexedName] if name.startswith(prefix)]
+    module = sys.modules.get(indexedName)
+    if module is not None and self.docs.get(indexedName, {}).get("kind") == "module":
+      # Attributes may be added to module namespaces at runtime (e.g., by scripted modules
+      # or by the user), therefore current members of the module are included. Listing members
+      # of a module is fast, only collecting details of all the members needs to be done in advance.
+      try:
+        liveMatches = [name for name in dir(module) if name.startswith(prefix) and not name.startswith("__")]
+        matches = sorted(set(matches).union(liveMatches))
+      except Exception:
+        pass
+    if not prefix.startswith("_"):
+      matches = [name for name in matches if not name.startswith("_")]
+    return {
+      "status": "ok",
+      "matches": matches,
+      "cursor_start": cursorPos - len(prefix),
+      "cursor_end": cursorPos,
+      "metadata": {},
+      }
+
+  def inspect(self, code, cursorPos):
+    # Expression is the dotted name at the cursor position
+    start = cursorPos
+    while start > 0 and _identifierCharacters.match(code[start - 1]):
+      start -= 1
+    end = cursorPos
+    while end < len(code) and re.match(r"\w", code[end]):
+      end += 1
+    expression = code[start:end].strip(".")
+    if not expression:
+      return None
+    indexedName = self._resolve(expression)
+    if indexedName is None or indexedName not in self.docs:
+      return None
+    info = self.docs[indexedName]
+    text = "{0}\nType: {1}".format(indexedName, info["kind"])
+    if info["doc"]:
+      text += "\n\n" + info["doc"]
+    return {
+      "status": "ok",
+      "found": True,
+      "data": {"text/plain": text},
+      "metadata": {},
+      }
+
+
+_index = None
+
+
+def start():
+  """Load the index from disk or start building it. Called from kernel-configure.py."""
+  global _index
+  if _index is not None:
+    return
+  _index = CompletionIndex(defaultIndexFilePath(), indexFingerprint())
+  if not _index.load():
+    _index.build()
+
+
+def complete(code, cursorPos, detailLevel=0):
+  """Returns complete_reply content as JSON string, or None if the request cannot be answered from the index.
+  detailLevel is not used, it is only accepted so that complete and inspect can be called the same way.
+  Requests are answered while the index is being built, for objects that are already indexed."""
+  if _index is None:
+    return None
+  reply = _index.complete(code, cursorPos)
+  return json.dumps(reply) if reply is not None else None
+
+
+def inspect(code, cursorPos, detailLevel=0):
+  """Returns inspect_reply content as JSON string, or None if the request cannot be answered from the index."""
+  if _index is None:
+    return None
+  reply = _index.inspect(code, cursorPos)
+  return json.dumps(reply) if reply is not None else None
@@ -0,0 +1,525 @@
+/*==============================================================================
+
+  Protocol benchmark of the Slicer Jupyter kernel.
+
+  The kernel is started in this process (using qSlicerJupyterKernelModule::startKernel)
+  and an in-process fake Jupyter client communicates with it over local ZMQ sockets,
+  the same way as a notebook server would. Measured values:
+
+  - executeLatencyMs: execute_request to execute_reply round-trip time of a trivial cell
+    (mean, p50, p95, max)
+  - commThroughput: number of comm messages per second echoed back by a comm
+  - iopubThroughput: bytes per second of printed output received on IOPub
+  - idleCpuPercent: CPU usage of the process while the kernel is idle
+
+  Results are printed as JSON (and written to the file specified by --output).
+  Results that are worse than their threshold are reported. The test only fails
+  because of them if --enforce-thresholds is ON:
+
+    --max-execute-latency-ms <value>   (p95 latency)
+    --min-comm-throughput <messages/sec>
+    --min-iopub-throughput <bytes/sec>
+    --max-idle-cpu-percent <value>
+    --enforce-thresholds <ON|OFF>
+
+  The module is initialized the same way as in the application, so that the kernel
+  is configured using the kernel resources (kernel-configure.py) in the build tree:
+
+    --module-path <path of the module library>
+    --application-name <Slicer application name, used in the kernel resource folder name>
+
+==============================================================================*/
+
+// JupyterKernel includes
+#include "qSlicerJupyterKernelModule.h"
+
+// Slicer includes
+#include <qSlicerApplication.h>
+#include <qSlicerCorePythonManager.h>
+#include <vtkSlicerApplicationLogic.h>
+
+// Qt includes
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTcpServer>
+#include <QTemporaryDir>
+
+// xeus includes
+#include <xeus/xcomm.hpp>
+#include <xeus/xguid.hpp>
+#include <xeus/xinterpreter.hpp>
+#include <xeus/xmessage.hpp>
+#include <xeus-zmq/xauthentication.hpp>
+#include <xeus-zmq/xzmq_serializer.hpp>
+
+// zmq includes
+#include <zmq.hpp>
+#include <zmq_addon.hpp>
+
+// STL includes
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+
+using benchmark_clock = std::chrono::steady_clock;
+
+const char* benchmark_comm_target_name = "slicer_benchmark_echo";
+const int receive_timeout_ms = 30000;
+
+//----------------------------------------------------------------------------
+double elapsedSec(benchmark_clock::time_point start)
+{
+  return std::chrono::duration<double>(benchmark_clock::now() - start).count();
+}
+
+//----------------------------------------------------------------------------
+double processCpuTimeSec()
+{
+#ifdef _WIN32
+  FILETIME creationTime, exitTime, kernelTime, userTime;
+  if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+  {
+    return 0.0;
+  }
+  auto toSec = [](const FILETIME& time)
+    {
+    return ((static_cast<unsigned long long>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7;
+    };
+  return toSec(kernelTime) + toSec(userTime);
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6
+    + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+#endif
+}
+
+//----------------------------------------------------------------------------
+int findFreePort()
+{
+  QTcpServer server;
+  if (!server.listen(QHostAddress::LocalHost, 0))
+  {
+    return 0;
+  }
+  return server.serverPort();
+}
+
+//----------------------------------------------------------------------------
+double percentile(std::vector<double> values, double fraction)
+{
+  if (values.empty())
+  {
+    return 0.0;
+  }
+  std::sort(values.begin(), values.end());
+  std::size_t index = static_cast<std::size_t>(fraction * (values.size() - 1) + 0.5);
+  return values[std::min(index, values.size() - 1)];
+}
+
+//----------------------------------------------------------------------------
+/// Minimal Jupyter client: sends requests on shell and control channels
+/// and receives replies and IOPub messages.
+class FakeJupyterClient
+{
+public:
+  FakeJupyterClient(const QJsonObject& connection)
+    : Authentication(xeus::make_xauthentication(
+        connection["signature_scheme"].toString().toStdString(), connection["key"].toString().toStdString()))
+    , Shell(Context, zmq::socket_type::dealer)
+    , Control(Context, zmq::socket_type::dealer)
+    , IOPub(Context, zmq::socket_type::sub)
+    , Session(xeus::new_xguid())
+  {
+    std::string address = "tcp://" + connection["ip"].toString().toStdString() + ":";
+    for (zmq::socket_t* socket : { &this->Shell, &this->Control, &this->IOPub })
+    {
+      socket->set(zmq::sockopt::linger, 0);
+      socket->set(zmq::sockopt::rcvtimeo, receive_timeout_ms);
+    }
+    this->Shell.connect(address + std::to_string(connection["shell_port"].toInt()));
+    this->Control.connect(address + std::to_string(connection["control_port"].toInt()));
+    this->IOPub.set(zmq::sockopt::subscribe, "");
+    this->IOPub.connect(address + std::to_string(connection["iopub_port"].toInt()));
+  }
+
+  /// Send a request and return its message ID.
+  std::string send(zmq::socket_t& socket, const std::string& msgType, nl::json content)
+  {
+    nl::json header = xeus::make_header(msgType, "benchmark", this->Session);
+    std::string msgId = header["msg_id"];
+    xeus::xmessage message(xeus::xmessage::guid_list(), std::move(header), nl::json::object(),
+      nl::json::object(), std::move(content), xeus::buffer_sequence());
+    xeus::xzmq_serializer::serialize(std::move(message), *this->Authentication, nl::json::error_handler_t::replace).send(socket);
+    return msgId;
+  }
+
+  /// Receive the reply of a request. Returns false on timeout.
+  bool receiveReply(zmq::socket_t& socket, const std::string& requestMsgId, nl::json* content = nullptr)
+  {
+    while (true)
+    {
+      zmq::multipart_t wireMessage;
+      if (!wireMessage.recv(socket))
+      {
+        return false;
+      }
+      xeus::xmessage message = xeus::xzmq_serializer::deserialize(wireMessage, *this->Authentication);
+      if (message.parent_header().value("msg_id", "") == requestMsgId)
+      {
+        if (content)
+        {
+          *content = message.content();
+        }
+        return true;
+      }
+    }
+  }
+
+  /// Receive the next IOPub message. Returns false on timeout.
+  bool receiveIOPub(std::string& msgType, std::string& parentMsgId, nl::json& content)
+  {
+    zmq::multipart_t wireMessage;
+    if (!wireMessage.recv(this->IOPub))
+    {
+      return false;
+    }
+    xeus::xpub_message message = xeus::xzmq_serializer::deserialize_iopub(wireMessage, *this->Authentication);
+    msgType = message.header().value("msg_type", "");
+    parentMsgId = message.parent_header().value("msg_id", "");
+    content = message.content();
+    return true;
+  }
+
+  /// Receive IOPub messages until the kernel reports idle state for the specified request.
+  bool waitForIdle(const std::string& requestMsgId)
+  {
+    std::string msgType, parentMsgId;
+    nl::json content;
+    while (receiveIOPub(msgType, parentMsgId, content))
+    {
+      if (msgType == "status" && parentMsgId == requestMsgId && content.value("execution_state", "") == "idle")
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  zmq::context_t Context;
+  std::unique_ptr<xeus::xauthentication> Authentication;
+  zmq::socket_t Shell;
+  zmq::socket_t Control;
+  zmq::socket_t IOPub;
+  std::string Session;
+};
+
+//----------------------------------------------------------------------------
+/// Run all measurements. Returns false if the kernel did not respond.
+bool runBenchmark(FakeJupyterClient& client, QJsonObject& results, std::string& error)
+{
+  // Kernel info (also waits for the IOPub subscription to be established,
+  // as messages published before that are lost)
+  bool connected = false;
+  for (int attempt = 0; attempt < 20 && !connected; ++attempt)
+  {
+    std::string msgId = client.send(client.Shell, "kernel_info_request", nl::json::object());
+    if (!client.receiveReply(client.Shell, msgId))
+    {
+      error = "no kernel_info_reply";
+      return false;
+    }
+    client.IOPub.set(zmq::sockopt::rcvtimeo, 1000);
+    connected = client.waitForIdle(msgId);
+    client.IOPub.set(zmq::sockopt::rcvtimeo, receive_timeout_ms);
+  }
+  if (!connected)
+  {
+    error = "no IOPub messages received";
+    return false;
+  }
+
+  // Execute round-trip latency
+  const int executeCount = 100;
+  std::vector<double> latenciesMs;
+  for (int executeIndex = 0; executeIndex < executeCount; ++executeIndex)
+  {
+    nl::json content = { { "code", "pass" }, { "silent", false }, { "store_history", false },
+      { "user_expressions", nl::json::object() }, { "allow_stdin", false }, { "stop_on_error", true } };
+    auto startTime = benchmark_clock::now();
+    std::string msgId = client.send(client.Shell, "execute_request", content);
+    if (!client.receiveReply(client.Shell, msgId))
+    {
+      error = "no execute_reply";
+      return false;
+    }
+    latenciesMs.push_back(elapsedSec(startTime) * 1000.0);
+    client.waitForIdle(msgId);
+  }
+  QJsonObject latency;
+  latency["count"] = executeCount;
+  latency["mean"] = std::accumulate(latenciesMs.begin(), latenciesMs.end(), 0.0) / latenciesMs.size();
+  latency["p50"] = percentile(latenciesMs, 0.50);
+  latency["p95"] = percentile(latenciesMs, 0.95);
+  latency["max"] = *std::max_element(latenciesMs.begin(), latenciesMs.end());
+  results["executeLatencyMs"] = latency;
+
+  // Comm message throughput
+  const int commMessageCount = 1000;
+  std::string commId = xeus::new_xguid();
+  std::string openMsgId = client.send(client.Shell, "comm_open",
+    { { "comm_id", commId }, { "target_name", benchmark_comm_target_name }, { "data", nl::json::object() } });
+  client.waitForIdle(openMsgId);
+  auto commStartTime = benchmark_clock::now();
+  for (int messageIndex = 0; messageIndex < commMessageCount; ++messageIndex)
+  {
+    client.send(client.Shell, "comm_msg", { { "comm_id", commId }, { "data", { { "index", messageIndex } } } });
+  }
+  int echoedCount = 0;
+  {
+    std::string msgType, parentMsgId;
+    nl::json content;
+    while (echoedCount < commMessageCount && client.receiveIOPub(msgType, parentMsgId, content))
+    {
+      if (msgType == "comm_msg" && content.value("comm_id", "") == commId)
+      {
+        ++echoedCount;
+      }
+    }
+  }
+  double commDurationSec = elapsedSec(commStartTime);
+  client.send(client.Shell, "comm_close", { { "comm_id", commId }, { "data", nl::json::object() } });
+  if (echoedCount < commMessageCount)
+  {
+    error = "comm messages were not echoed";
+    return false;
+  }
+  results["commThroughput"] = commMessageCount / commDurationSec;
+
+  // IOPub stream throughput
+  const int printedLineCount = 20000;
+  std::string code = "for i in range(" + std::to_string(printedLineCount) + "):\n  print('x' * 100)\n";
+  auto streamStartTime = benchmark_clock::now();
+  std::string executeMsgId = client.send(client.Shell, "execute_request",
+    { { "code", code }, { "silent", false }, { "store_history", false },
+      { "user_expressions", nl::json::object() }, { "allow_stdin", false }, { "stop_on_error", true } });
+  double streamBytes = 0.0;
+  {
+    std::string msgType, parentMsgId;
+    nl::json content;
+    bool idle = false;
+    while (!idle && client.receiveIOPub(msgType, parentMsgId, content))
+    {
+      if (parentMsgId != executeMsgId)
+      {
+        continue;
+      }
+      if (msgType == "stream")
+      {
+        streamBytes += content.value("text", std::string()).size();
+      }
+      idle = (msgType == "status" && content.value("execution_state", "") == "idle");
+    }
+  }
+  double streamDurationSec = elapsedSec(streamStartTime);
+  client.receiveReply(client.Shell, executeMsgId);
+  results["iopubBytes"] = streamBytes;
+  results["iopubThroughput"] = streamBytes / streamDurationSec;
+
+  // Idle CPU usage
+  const double idleDurationSec = 3.0;
+  double cpuStartSec = processCpuTimeSec();
+  auto idleStartTime = benchmark_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(idleDurationSec));
+  results["idleCpuPercent"] = 100.0 * (processCpuTimeSec() - cpuStartSec) / elapsedSec(idleStartTime);
+
+  return true;
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+int qSlicerJupyterKernelProtocolBenchmark(int argc, char* argv[])
+{
+  double maxExecuteLatencyMs = 50.0;
+  double minCommThroughput = 500.0;
+  double minIOPubThroughput = 1e6;
+  double maxIdleCpuPercent = 5.0;
+  bool enforceThresholds = false;
+  QString outputFilePath;
+  QString modulePath;
+  QString applicationName;
+  for (int argIndex = 1; argIndex + 1 < argc; argIndex += 2)
+  {
+    std::string name = argv[argIndex];
+    QString value = argv[argIndex + 1];
+    if (name == "--max-execute-latency-ms") { maxExecuteLatencyMs = value.toDouble(); }
+    else if (name == "--min-comm-throughput") { minCommThroughput = value.toDouble(); }
+    else if (name == "--min-iopub-throughput") { minIOPubThroughput = value.toDouble(); }
+    else if (name == "--max-idle-cpu-percent") { maxIdleCpuPercent = value.toDouble(); }
+    else if (name == "--enforce-thresholds")
+    {
+      enforceThresholds = (value.compare("ON", Qt::CaseInsensitive) == 0
+        || value.compare("TRUE", Qt::CaseInsensitive) == 0 || value == "1");
+    }
+    else if (name == "--output") { outputFilePath = value; }
+    else if (name == "--module-path") { modulePath = value; }
+    else if (name == "--application-name") { applicationName = value; }
+    else
+    {
+      std::cerr << "Unknown argument: " << name << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Benchmark options must not be interpreted as application options
+  int appArgc = 1;
+  qSlicerApplication app(appArgc, argv);
+  if (!applicationName.isEmpty())
+  {
+    // Kernel resource folder name contains the application name
+    app.setApplicationName(applicationName);
+  }
+  if (!app.corePythonManager() || !app.corePythonManager()->mainContext())
+  {
+    std::cerr << "Python is not available" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  QTemporaryDir tempDir;
+  QJsonObject connection;
+  connection["transport"] = "tcp";
+  connection["ip"] = "127.0.0.1";
+  connection["signature_scheme"] = "hmac-sha256";
+  connection["key"] = QString::fromStdString(xeus::new_xguid());
+  for (const char* portName : { "shell_port", "control_port", "stdin_port", "iopub_port", "hb_port" })
+  {
+    connection[portName] = findFreePort();
+  }
+  QString connectionFilePath = tempDir.filePath("kernel-benchmark.json");
+  QFile connectionFile(connectionFilePath);
+  if (!connectionFile.open(QIODevice::WriteOnly)
+    || connectionFile.write(QJsonDocument(connection).toJson()) < 0)
+  {
+    std::cerr << "Cannot write connection file " << qPrintable(connectionFilePath) << std::endl;
+    return EXIT_FAILURE;
+  }
+  connectionFile.close();
+
+  // The module path determines the module share directory, which contains the kernel resources
+  qSlicerJupyterKernelModule kernelModule;
+  kernelModule.setPath(modulePath);
+  kernelModule.initialize(app.applicationLogic());
+  kernelModule.setMRMLScene(app.mrmlScene());
+  QString kernelConfigurePy = kernelModule.resourceFolderPath() + "/kernel-configure.py";
+  if (!QFileInfo::exists(kernelConfigurePy))
+  {
+    std::cerr << "Kernel resources are not found: " << qPrintable(kernelConfigurePy) << std::endl;
+    return EXIT_FAILURE;
+  }
+  kernelModule.setHistoryFilePath(tempDir.filePath("history.bin"));
+  kernelModule.setPollMode(qSlicerJupyterKernelModule::PollModeSocketNotifier);
+  kernelModule.startKernel(connectionFilePath);
+
+  // Comm target that sends back each received message
+  std::map<std::string, std::unique_ptr<xeus::xcomm>> echoComms;
+  xeus::get_interpreter().comm_manager().register_comm_target(benchmark_comm_target_name,
+    [&echoComms](xeus::xcomm&& comm, const xeus::xmessage&)
+    {
+    std::string commId = comm.id();
+    xeus::xcomm* echoComm = new xeus::xcomm(std::move(comm));
+    echoComms[commId].reset(echoComm);
+    echoComm->on_message([echoComm](const xeus::xmessage& message)
+      {
+      echoComm->send(nl::json::object(), message.content()["data"], xeus::buffer_sequence());
+      });
+    });
+
+  // The client runs in a separate thread, while the kernel processes messages in the main thread
+  QJsonObject results;
+  std::string error;
+  bool success = false;
+  FakeJupyterClient client(connection);
+  std::thread clientThread([&]()
+    {
+    success = runBenchmark(client, results, error);
+    std::string shutdownMsgId = client.send(client.Control, "shutdown_request", { { "restart", false } });
+    client.receiveReply(client.Control, shutdownMsgId);
+    QMetaObject::invokeMethod(&app, "quit", Qt::QueuedConnection);
+    });
+  app.exec();
+  clientThread.join();
+
+  if (!success)
+  {
+    std::cerr << "Benchmark failed: " << error << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  QJsonObject thresholds;
+  thresholds["maxExecuteLatencyMs"] = maxExecuteLatencyMs;
+  thresholds["minCommThroughput"] = minCommThroughput;
+  thresholds["minIOPubThroughput"] = minIOPubThroughput;
+  thresholds["maxIdleCpuPercent"] = maxIdleCpuPercent;
+  thresholds["enforced"] = enforceThresholds;
+  results["thresholds"] = thresholds;
+  results["startupTimes"] = QJsonObject::fromVariantMap(kernelModule.startupTimes());
+
+  QByteArray resultsJson = QJsonDocument(results).toJson();
+  std::cout << resultsJson.constData() << std::endl;
+  if (!outputFilePath.isEmpty())
+  {
+    QFile outputFile(outputFilePath);
+    if (!outputFile.open(QIODevice::WriteOnly) || outputFile.write(resultsJson) < 0)
+    {
+      std::cerr << "Cannot write results to " << qPrintable(outputFilePath) << std::endl;
+    }
+  }
+
+  bool passed = true;
+  double executeLatencyMs = results["executeLatencyMs"].toObject()["p95"].toDouble();
+  if (executeLatencyMs > maxExecuteLatencyMs)
+  {
+    std::cerr << "Execute latency (p95) " << executeLatencyMs << "ms is above threshold " << maxExecuteLatencyMs << "ms" << std::endl;
+    passed = false;
+  }
+  if (results["commThroughput"].toDouble() < minCommThroughput)
+  {
+    std::cerr << "Comm throughput " << results["commThroughput"].toDouble() << "/s is below threshold " << minCommThroughput << "/s" << std::endl;
+    passed = false;
+  }
+  if (results["iopubThroughput"].toDouble() < minIOPubThroughput)
+  {
+    std::cerr << "IOPub throughput " << results["iopubThroughput"].toDouble() << "B/s is below threshold " << minIOPubThroughput << "B/s" << std::endl;
+    passed = false;
+  }
+  if (results["idleCpuPercent"].toDouble() > maxIdleCpuPercent)
+  {
+    std::cerr << "Idle CPU usage " << results["idleCpuPercent"].toDouble() << "% is above threshold " << maxIdleCpuPercent << "%" << std::endl;
+    passed = false;
+  }
+  if (!passed && !enforceThresholds)
+  {
+    std::cerr << "Thresholds are not enforced, the benchmark is reported as passed" << std::endl;
+    return EXIT_SUCCESS;
+  }
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
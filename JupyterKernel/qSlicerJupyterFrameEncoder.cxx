@@ -0,0 +1,352 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "qSlicerJupyterFrameEncoder.h"
+#include "qSlicerJupyterViewCapture.h"
+#include "xSlicerKernelStats.h"
+#include "xSlicerTrace.h"
+
+// Qt includes
+#include <QDebug>
+#include <QMetaObject>
+#include <QRunnable>
+#include <QThread>
+#include <QVariantMap>
+
+// STL includes
+#include <cstring>
+
+namespace
+{
+//-----------------------------------------------------------------------------
+class qSlicerJupyterFrameEncoderTask : public QRunnable
+{
+public:
+  qSlicerJupyterFrameEncoderTask(qSlicerJupyterFrameEncoder* encoder, xSlicerKernelStats* stats,
+    const QString& streamId, const QImage& image, const QString& format, int quality)
+    : Encoder(encoder)
+    , KernelStats(stats)
+    , StreamId(streamId)
+    , Image(image)
+    , Format(format)
+    , Quality(quality)
+    , DeltaEncoding(false)
+    , TileSize(64)
+  {
+  }
+
+  /// Encode only the regions that are different from the reference image.
+  /// If referenceImage is null then the complete image is encoded.
+  void setDeltaEncoding(const QImage& referenceImage, int tileSize)
+  {
+    this->DeltaEncoding = true;
+    this->ReferenceImage = referenceImage;
+    this->TileSize = tileSize;
+  }
+
+  void run() override
+  {
+    if (xSlicerTrace::instance().isEnabled())
+    {
+      xSlicerTrace::instance().setCurrentThreadName("Frame encoder");
+    }
+    XSLICER_TRACE_SCOPE("encode", this->StreamId.toStdString());
+    xSlicerKernelStats::clock::time_point startTime = xSlicerKernelStats::clock::now();
+    if (!this->DeltaEncoding)
+    {
+      QByteArray imageData = qSlicerJupyterViewCapture::encodeImage(this->Image, this->Format, this->Quality);
+      this->recordStats(startTime, imageData.size());
+      // The encoder waits for all tasks to complete before it is deleted,
+      // therefore the pointer is valid here.
+      QMetaObject::invokeMethod(this->Encoder, "onFrameEncoded", Qt::QueuedConnection,
+        Q_ARG(QString, this->StreamId), Q_ARG(QByteArray, imageData),
+        Q_ARG(int, this->Image.width()), Q_ARG(int, this->Image.height()));
+      return;
+    }
+
+    bool keyframe = this->ReferenceImage.isNull();
+    QList<QRect> regions;
+    if (!keyframe)
+    {
+      regions = qSlicerJupyterFrameEncoder::changedRegions(this->ReferenceImage, this->Image, this->TileSize);
+      qint64 changedArea = 0;
+      foreach(const QRect& region, regions)
+      {
+        changedArea += qint64(region.width()) * region.height();
+      }
+      // If most of the image changed then encoding the entire image is more efficient
+      keyframe = (changedArea * 2 > qint64(this->Image.width()) * this->Image.height());
+    }
+    if (keyframe)
+    {
+      regions.clear();
+      regions << this->Image.rect();
+    }
+
+    QVariantList tiles;
+    bool success = true;
+    int encodedSize = 0;
+    foreach(const QRect& region, regions)
+    {
+      QByteArray tileData = qSlicerJupyterViewCapture::encodeImage(
+        keyframe ? this->Image : this->Image.copy(region), this->Format, this->Quality);
+      if (tileData.isEmpty())
+      {
+        success = false;
+        tiles.clear();
+        break;
+      }
+      encodedSize += tileData.size();
+      QVariantMap tile;
+      tile["x"] = region.x();
+      tile["y"] = region.y();
+      tile["width"] = region.width();
+      tile["height"] = region.height();
+      tile["mimeType"] = qSlicerJupyterViewCapture::mimeType(this->Format);
+      tile["data"] = tileData;
+      tiles << tile;
+    }
+    this->recordStats(startTime, encodedSize);
+    QMetaObject::invokeMethod(this->Encoder, "onDeltaFrameEncoded", Qt::QueuedConnection,
+      Q_ARG(QString, this->StreamId), Q_ARG(QVariantList, tiles),
+      Q_ARG(int, this->Image.width()), Q_ARG(int, this->Image.height()),
+      Q_ARG(bool, keyframe), Q_ARG(bool, success));
+  }
+
+protected:
+  void recordStats(xSlicerKernelStats::clock::time_point startTime, int encodedSize)
+  {
+    if (this->KernelStats)
+    {
+      this->KernelStats->record("encode", this->Format.toStdString(), startTime, encodedSize);
+    }
+  }
+
+  qSlicerJupyterFrameEncoder* Encoder;
+  xSlicerKernelStats* KernelStats;
+  QString StreamId;
+  QImage Image;
+  QString Format;
+  int Quality;
+  bool DeltaEncoding;
+  QImage ReferenceImage;
+  int TileSize;
+};
+}
+
+//-----------------------------------------------------------------------------
+qSlicerJupyterFrameEncoder::qSlicerJupyterFrameEncoder(QObject* parent)
+  : Superclass(parent)
+  , DroppedFrameCount(0)
+  , TileSize(64)
+  , KernelStats(nullptr)
+{
+  // Leave one core for rendering on the main thread
+  this->ThreadPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+}
+
+//-----------------------------------------------------------------------------
+qSlicerJupyterFrameEncoder::~qSlicerJupyterFrameEncoder()
+{
+  this->ThreadPool.clear();
+  this->ThreadPool.waitForDone();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::submitFrame(const QString& streamId, const QImage& image,
+  const QString& format, int quality/*=-1*/)
+{
+  Frame frame;
+  frame.Image = image;
+  frame.Format = format;
+  frame.Quality = quality;
+
+  Stream& stream = this->Streams[streamId];
+  if (stream.Encoding)
+  {
+    // The encoder of this stream is busy, keep only the most recent frame
+    if (stream.HasPendingFrame)
+    {
+      ++this->DroppedFrameCount;
+    }
+    stream.PendingFrame = frame;
+    stream.HasPendingFrame = true;
+    return;
+  }
+  this->startEncoding(streamId, frame);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::startEncoding(const QString& streamId, const Frame& frame)
+{
+  Stream& stream = this->Streams[streamId];
+  stream.Encoding = true;
+  stream.EncodedFrame = frame;
+  qSlicerJupyterFrameEncoderTask* task = new qSlicerJupyterFrameEncoderTask(this, this->KernelStats,
+    streamId, frame.Image, frame.Format, frame.Quality);
+  if (stream.DeltaEncoding)
+  {
+    const Frame& reference = stream.ReferenceFrame;
+    bool keyframeRequired = reference.Image.isNull()
+      || stream.FramesSinceKeyframe >= stream.KeyframeInterval
+      // Encoding parameters changed (for example, lossless image is requested after
+      // lossy images were sent), therefore unchanged regions must be sent again, too
+      || reference.Format != frame.Format
+      || reference.Quality != frame.Quality;
+    task->setDeltaEncoding(keyframeRequired ? QImage() : reference.Image, this->TileSize);
+  }
+  this->ThreadPool.start(task);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::onFrameEncoded(const QString& streamId, const QByteArray& imageData, int width, int height)
+{
+  this->onEncodingCompleted(streamId);
+  emit frameEncoded(streamId, imageData, width, height);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::onDeltaFrameEncoded(const QString& streamId, const QVariantList& tiles,
+  int width, int height, bool keyframe, bool success)
+{
+  auto streamIt = this->Streams.find(streamId);
+  if (streamIt != this->Streams.end())
+  {
+    if (success)
+    {
+      streamIt->ReferenceFrame = streamIt->EncodedFrame;
+      streamIt->FramesSinceKeyframe = keyframe ? 0 : streamIt->FramesSinceKeyframe + 1;
+    }
+    else
+    {
+      // Displayed image is unknown, send a complete image next time
+      streamIt->ReferenceFrame = Frame();
+    }
+  }
+  this->onEncodingCompleted(streamId);
+  if (success)
+  {
+    emit frameTilesEncoded(streamId, tiles, width, height, keyframe);
+  }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::onEncodingCompleted(const QString& streamId)
+{
+  auto streamIt = this->Streams.find(streamId);
+  if (streamIt == this->Streams.end())
+  {
+    // stream has been cleared
+    return;
+  }
+  streamIt->Encoding = false;
+  streamIt->EncodedFrame = Frame();
+  if (streamIt->HasPendingFrame)
+  {
+    Frame frame = streamIt->PendingFrame;
+    streamIt->PendingFrame = Frame();
+    streamIt->HasPendingFrame = false;
+    this->startEncoding(streamId, frame);
+  }
+  else if (!streamIt->DeltaEncoding)
+  {
+    // No need to keep track of streams that have no state
+    this->Streams.erase(streamIt);
+  }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::setStreamDeltaEncoding(const QString& streamId, bool enabled, int keyframeInterval/*=30*/)
+{
+  Stream& stream = this->Streams[streamId];
+  stream.DeltaEncoding = enabled;
+  stream.KeyframeInterval = keyframeInterval;
+  stream.ReferenceFrame = Frame();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::clearStream(const QString& streamId)
+{
+  this->Streams.remove(streamId);
+}
+
+//-----------------------------------------------------------------------------
+QList<QRect> qSlicerJupyterFrameEncoder::changedRegions(const QImage& referenceImage, const QImage& image, int tileSize)
+{
+  QList<QRect> regions;
+  if (referenceImage.size() != image.size() || referenceImage.format() != image.format() || tileSize <= 0)
+  {
+    regions << image.rect();
+    return regions;
+  }
+  const int bytesPerPixel = image.depth() / 8;
+  for (int tileY = 0; tileY < image.height(); tileY += tileSize)
+  {
+    const int tileHeight = qMin(tileSize, image.height() - tileY);
+    for (int tileX = 0; tileX < image.width(); tileX += tileSize)
+    {
+      const int tileWidth = qMin(tileSize, image.width() - tileX);
+      const int tileWidthBytes = tileWidth * bytesPerPixel;
+      const int tileOffsetBytes = tileX * bytesPerPixel;
+      for (int y = tileY; y < tileY + tileHeight; ++y)
+      {
+        if (std::memcmp(referenceImage.constScanLine(y) + tileOffsetBytes,
+          image.constScanLine(y) + tileOffsetBytes, tileWidthBytes) != 0)
+        {
+          regions << QRect(tileX, tileY, tileWidth, tileHeight);
+          break;
+        }
+      }
+    }
+  }
+  return regions;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::setTileSize(int size)
+{
+  this->TileSize = qMax(8, size);
+}
+
+//-----------------------------------------------------------------------------
+int qSlicerJupyterFrameEncoder::tileSize() const
+{
+  return this->TileSize;
+}
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::setMaxThreadCount(int count)
+{
+  this->ThreadPool.setMaxThreadCount(qMax(1, count));
+}
+
+//-----------------------------------------------------------------------------
+int qSlicerJupyterFrameEncoder::maxThreadCount() const
+{
+  return this->ThreadPool.maxThreadCount();
+}
+
+//-----------------------------------------------------------------------------
+int qSlicerJupyterFrameEncoder::droppedFrameCount() const
+{
+  return this->DroppedFrameCount;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterFrameEncoder::setKernelStats(xSlicerKernelStats* stats)
+{
+  this->KernelStats = stats;
+}
@@ -0,0 +1,146 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef __qSlicerJupyterFrameEncoder_h
+#define __qSlicerJupyterFrameEncoder_h
+
+// Qt includes
+#include <QByteArray>
+#include <QHash>
+#include <QImage>
+#include <QObject>
+#include <QRect>
+#include <QString>
+#include <QThreadPool>
+#include <QVariantList>
+
+#include "qSlicerJupyterKernelModuleExport.h"
+
+class xSlicerKernelStats;
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+/// Encodes view images in background threads.
+///
+/// Images are captured on the main thread (rendering and reading the render window
+/// requires the OpenGL context) and then encoded by a thread pool, so that
+/// the next frame can be rendered while the previous one is being encoded.
+///
+/// Frames are submitted to named streams (typically one stream per interactive view widget).
+/// Each stream encodes at most one frame at a time and keeps at most one frame waiting:
+/// if a new frame is submitted while another one is waiting then the waiting (stale) frame is dropped.
+/// Encoded frames are reported by the frameEncoded signal on the main thread,
+/// in the order they were submitted.
+///
+/// If delta encoding is enabled for a stream then each frame is compared to the previously
+/// encoded frame in tiles and only the changed tiles are encoded. Tiles are not merged, so each
+/// patch is one cell of a fixed grid (which allows the receiver to keep one image per grid cell).
+/// The complete image is encoded (keyframe) periodically,
+/// when the image size, format, or quality changes, or when most of the image has changed.
+/// Delta frames are reported by the frameTilesEncoded signal.
+class Q_SLICER_QTMODULES_JUPYTERKERNEL_EXPORT qSlicerJupyterFrameEncoder : public QObject
+{
+  Q_OBJECT
+
+public:
+  typedef QObject Superclass;
+  qSlicerJupyterFrameEncoder(QObject* parent = nullptr);
+  ~qSlicerJupyterFrameEncoder() override;
+
+  /// Queue an image for encoding. Must be called from the main thread.
+  /// \param format image file format name, such as PNG or JPG
+  /// \param quality image quality for lossy formats (0-100, -1 for default quality)
+  void submitFrame(const QString& streamId, const QImage& image, const QString& format, int quality = -1);
+
+  /// Maximum number of threads used for encoding.
+  void setMaxThreadCount(int count);
+  int maxThreadCount() const;
+
+  /// Number of frames that were replaced by a newer frame before encoding started.
+  int droppedFrameCount() const;
+
+  /// Enable encoding of only the changed parts of the image.
+  /// \param keyframeInterval a complete image is encoded after this many delta frames
+  void setStreamDeltaEncoding(const QString& streamId, bool enabled, int keyframeInterval = 30);
+
+  /// Size of tiles that are compared between frames in delta encoding mode.
+  void setTileSize(int size);
+  int tileSize() const;
+
+  /// Remove all waiting frames of a stream (for example, when the widget that displays the stream is closed).
+  /// The frame that is being encoded is still reported.
+  void clearStream(const QString& streamId);
+
+  /// Get tiles (cells of a tileSize x tileSize grid) that are different in the two images.
+  /// Returns a single rectangle covering the entire image if the size or format of the images are different.
+  static QList<QRect> changedRegions(const QImage& referenceImage, const QImage& image, int tileSize);
+
+  /// Set object that collects encoding time statistics (stage: "encode", message type: image format).
+  /// The object is not owned by the encoder. Set to nullptr to disable statistics collection.
+  void setKernelStats(xSlicerKernelStats* stats);
+
+signals:
+  /// Emitted on the main thread when encoding of a frame is completed.
+  /// If encoding failed then imageData is empty.
+  void frameEncoded(const QString& streamId, const QByteArray& imageData, int width, int height);
+
+  /// Emitted on the main thread when encoding of a frame is completed for a stream that uses delta encoding.
+  /// Each tile is a map containing x, y, width, height (position is measured from the top-left corner),
+  /// mimeType, and data (encoded image of the tile). If keyframe is true then the tiles cover the entire image.
+  /// If nothing has changed since the previous frame then the tile list is empty.
+  void frameTilesEncoded(const QString& streamId, const QVariantList& tiles, int width, int height, bool keyframe);
+
+protected slots:
+  void onFrameEncoded(const QString& streamId, const QByteArray& imageData, int width, int height);
+  void onDeltaFrameEncoded(const QString& streamId, const QVariantList& tiles, int width, int height, bool keyframe, bool success);
+
+protected:
+  struct Frame
+  {
+    QImage Image;
+    QString Format;
+    int Quality{ -1 };
+  };
+
+  struct Stream
+  {
+    bool Encoding{ false };
+    bool HasPendingFrame{ false };
+    Frame PendingFrame;
+
+    bool DeltaEncoding{ false };
+    int KeyframeInterval{ 30 };
+    int FramesSinceKeyframe{ 0 };
+    /// Frame that is being encoded
+    Frame EncodedFrame;
+    /// Last successfully encoded frame, delta is computed relative to this
+    Frame ReferenceFrame;
+  };
+
+  void startEncoding(const QString& streamId, const Frame& frame);
+  void onEncodingCompleted(const QString& streamId);
+
+  QThreadPool ThreadPool;
+  QHash<QString, Stream> Streams;
+  int DroppedFrameCount;
+  int TileSize;
+  xSlicerKernelStats* KernelStats;
+
+private:
+  Q_DISABLE_COPY(qSlicerJupyterFrameEncoder);
+};
+
+#endif
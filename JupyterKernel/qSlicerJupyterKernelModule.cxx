@@ -19,8 +19,10 @@
 #include <vtkSlicerJupyterKernelLogic.h>
 
 // JupyterKernel includes
+#include "qSlicerJupyterFrameEncoder.h"
 #include "qSlicerJupyterKernelModule.h"
 #include "qSlicerJupyterKernelModuleWidget.h"
+#include "qSlicerJupyterViewCapture.h"
 
 #include "qSlicerApplication.h"
 #include "qSlicerPythonManager.h"
@@ -37,12 +39,21 @@
 #endif
 
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QLabel>
+#include <QLocalServer>
+#include <QLocalSocket>
 #include <QMainWindow>
+#include <QSaveFile>
+#include <QSettings>
 #include <QStandardPaths>
 #include <QStatusBar>
 #include <QTextStream>
+#include <QTimer>
 
 // XEUS includes
 #include "xeus/xkernel.hpp"
@@ -52,15 +63,24 @@
 #include "xeus-zmq/xzmq_context.hpp"
 #include "zmq.hpp"
 
+#include "xSlicerCellProfiler.h"
+#include "xSlicerHistoryManager.h"
 #include "xSlicerInterpreter.h"
+#include "xSlicerKernelStats.h"
 #include "xSlicerServer.h"
+#include "xSlicerTrace.h"
 
 // Slicer includes
 #include "qSlicerApplication.h"
 #include "qSlicerCommandOptions.h"
+#include "qMRMLSliceWidget.h"
+
+// CTK includes
+#include <ctkVTKAbstractView.h>
 
 // Qt includes
 #include <QDebug>
+#include <QDir>
 #include <QFileInfo>
 #include <QProcess>
 
@@ -84,10 +104,50 @@ public:
   bool Started;
   QString ConnectionFile;
   xeus::xkernel * Kernel;
+  xSlicerInterpreter* Interpreter; // owned by Kernel
   xeus::xconfiguration Config;
   QLabel* StatusLabel;
+  qSlicerJupyterKernelModule::PollMode PollMode;
+  double MessageBatchTimeBudgetSec;
+  bool CommMessageCoalescing;
+  bool FastInterrupt;
+  xSlicerKernelStats KernelStats;
+  xSlicerCellProfiler CellProfiler;
+  bool CellProfiling;
+  double StreamFlushIntervalSec;
+  double IOPubDataRateLimit;
+  QString HistoryFilePath;
+  int HistoryMaxEntries;
+  int KernelPoolSize;
+  QLocalServer* KernelPoolServer;
+  QLocalSocket* KernelPoolConnection;
+  QByteArray KernelPoolRequest;
+  // Duration of kernel startup phases in seconds, in the order they were performed
+  QList<QPair<QString, double> > StartupTimes;
+  // Declared after KernelStats so that encoding threads are stopped before KernelStats is deleted
+  qSlicerJupyterFrameEncoder FrameEncoder;
+
+  xSlicerServer* server() const;
+
+  void onKernelPoolConnection();
+
+  /// Record duration of a startup phase and restart the timer.
+  void recordStartupPhase(const QString& phase, QElapsedTimer& timer);
+  /// Write startup times to the application log.
+  void logStartupTimes();
+  void onKernelPoolRequestReceived();
+  /// Use the working directory and environment of the launcher, as if Jupyter started this application.
+  void applyKernelPoolLauncherEnvironment(const QString& workingDirectory, const QJsonObject& environment);
 };
 
+namespace
+{
+  // Kernel pool is stopped if no kernel is requested for this long (kernel-pool.py --linger option)
+  const int KernelPoolLingerSec = 3600;
+  // Time the kernel pool launcher has to send its request after it claimed the application
+  const int KernelPoolRequestTimeoutMsec = 30000;
+}
+
 //-----------------------------------------------------------------------------
 // qSlicerJupyterKernelModulePrivate methods
 
@@ -96,8 +156,168 @@ qSlicerJupyterKernelModulePrivate::qSlicerJupyterKernelModulePrivate(qSlicerJupy
 : q_ptr(&object)
 , Started(false)
 , Kernel(NULL)
+, Interpreter(NULL)
 , StatusLabel(NULL)
+, PollMode(qSlicerJupyterKernelModule::PollModeSocketNotifier)
+, MessageBatchTimeBudgetSec(0.1)
+, CommMessageCoalescing(false)
+, FastInterrupt(true)
+, CellProfiling(false)
+, StreamFlushIntervalSec(0.005)
+, IOPubDataRateLimit(0.0)
+, HistoryMaxEntries(10000)
+, KernelPoolSize(0)
+, KernelPoolServer(nullptr)
+, KernelPoolConnection(nullptr)
+{
+}
+
+//-----------------------------------------------------------------------------
+xSlicerServer* qSlicerJupyterKernelModulePrivate::server() const
+{
+  if (this->Kernel == nullptr)
+  {
+    return nullptr;
+  }
+  return reinterpret_cast<xSlicerServer*>(&this->Kernel->get_server());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterKernelModulePrivate::recordStartupPhase(const QString& phase, QElapsedTimer& timer)
 {
+  this->StartupTimes.append(qMakePair(phase, timer.nsecsElapsed() * 1e-9));
+  timer.restart();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterKernelModulePrivate::logStartupTimes()
+{
+  QStringList phaseTimes;
+  double totalTime = 0.0;
+  for (const QPair<QString, double>& phaseTime : this->StartupTimes)
+  {
+    phaseTimes << QString("%1=%2s").arg(phaseTime.first).arg(phaseTime.second, 0, 'f', 3);
+    totalTime += phaseTime.second;
+  }
+  qDebug().noquote() << QString("Jupyter kernel startup: %1s (%2)").arg(totalTime, 0, 'f', 3).arg(phaseTimes.join(", "));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterKernelModulePrivate::onKernelPoolConnection()
+{
+  QLocalSocket* socket = this->KernelPoolServer->nextPendingConnection();
+  if (!socket)
+  {
+    return;
+  }
+  if (this->KernelPoolConnection)
+  {
+    // The application is already handed over to a launcher
+    socket->write("{\"status\": \"error\", \"message\": \"kernel is already in use\"}\n");
+    socket->disconnectFromServer();
+    socket->deleteLater();
+    return;
+  }
+  this->KernelPoolConnection = socket;
+  QObject::connect(socket, &QLocalSocket::readyRead, q_ptr, [this]() { this->onKernelPoolRequestReceived(); });
+
+  // The launcher has claimed this application, therefore no other launcher can use it.
+  // If the launcher does not send a request (e.g., it is terminated) then the application must exit,
+  // otherwise it would keep running without ever starting a kernel.
+  QObject::connect(socket, &QLocalSocket::disconnected, q_ptr, [this]()
+    {
+      if (!this->Started)
+      {
+        qWarning() << "Kernel pool launcher disconnected before sending a kernel request";
+        qSlicerApplication::application()->exit(1);
+      }
+    });
+  QTimer::singleShot(KernelPoolRequestTimeoutMsec, q_ptr, [this]()
+    {
+      if (!this->Started)
+      {
+        qWarning() << "Kernel pool launcher did not send a kernel request in time";
+        qSlicerApplication::application()->exit(1);
+      }
+    });
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterKernelModulePrivate::onKernelPoolRequestReceived()
+{
+  if (this->Started)
+  {
+    return;
+  }
+  // The request is a single line: {"connection_file": "...", "cwd": "...", "env": {"name": "value", ...}}
+  this->KernelPoolRequest.append(this->KernelPoolConnection->readAll());
+  int lineEnd = this->KernelPoolRequest.indexOf('\n');
+  if (lineEnd < 0)
+  {
+    return;
+  }
+  QJsonObject request = QJsonDocument::fromJson(this->KernelPoolRequest.left(lineEnd)).object();
+  QString connectionFile = request["connection_file"].toString();
+  this->applyKernelPoolLauncherEnvironment(request["cwd"].toString(), request["env"].toObject());
+  q_ptr->startKernel(connectionFile);
+
+  QJsonObject reply;
+  if (this->Started)
+  {
+    reply["status"] = "ok";
+    reply["pid"] = QCoreApplication::applicationPid();
+  }
+  else
+  {
+    reply["status"] = "error";
+    reply["message"] = QString("failed to start kernel using connection file %1").arg(connectionFile);
+  }
+  this->KernelPoolConnection->write(QJsonDocument(reply).toJson(QJsonDocument::Compact) + "\n");
+  this->KernelPoolConnection->flush();
+  this->KernelPoolServer->close();
+  if (!this->Started)
+  {
+    // The launcher starts a new application instead of this one
+    qSlicerApplication::application()->exit(1);
+    return;
+  }
+  // Jupyter manages the kernel process through the launcher, therefore the application
+  // must exit when the launcher is terminated.
+  qSlicerJupyterKernelModule* q = q_ptr;
+  QObject::connect(this->KernelPoolConnection, &QLocalSocket::disconnected, q, [q]() { q->stopKernel(); });
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterKernelModulePrivate::applyKernelPoolLauncherEnvironment(
+  const QString& workingDirectory, const QJsonObject& environment)
+{
+  if (!workingDirectory.isEmpty() && !QDir::setCurrent(workingDirectory))
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot change working directory to " << workingDirectory;
+  }
+  // Variables that the Slicer launcher sets up for the application must not be overwritten
+  // by the values of the pool launcher process.
+  const QStringList preservedVariables = { "PATH", "LD_LIBRARY_PATH", "DYLD_LIBRARY_PATH", "DYLD_FRAMEWORK_PATH",
+    "PYTHONHOME", "PYTHONPATH", "PYTHONNOUSERSITE", "QT_PLUGIN_PATH" };
+  QJsonObject changedVariables;
+  for (auto it = environment.begin(); it != environment.end(); ++it)
+  {
+    if (preservedVariables.contains(it.key(), Qt::CaseInsensitive)
+      || qgetenv(it.key().toLocal8Bit().constData()) == it.value().toString().toLocal8Bit())
+    {
+      continue;
+    }
+    changedVariables[it.key()] = it.value();
+  }
+  if (changedVariables.isEmpty())
+  {
+    return;
+  }
+  // os.environ is not updated by qputenv. Updating os.environ sets the process environment, too.
+  // JSON object of strings is a valid Python dict literal.
+  qSlicerPythonManager* pythonManager = qSlicerApplication::application()->pythonManager();
+  pythonManager->executeString(QString("import os\nos.environ.update(%1)")
+    .arg(QString::fromUtf8(QJsonDocument(changedVariables).toJson(QJsonDocument::Compact))));
 }
 
 //-----------------------------------------------------------------------------
@@ -108,6 +328,12 @@ qSlicerJupyterKernelModule::qSlicerJupyterKernelModule(QObject* _parent)
   : Superclass(_parent)
   , d_ptr(new qSlicerJupyterKernelModulePrivate(*this))
 {
+  Q_D(qSlicerJupyterKernelModule);
+  d->FrameEncoder.setKernelStats(&d->KernelStats);
+  QObject::connect(&d->FrameEncoder, SIGNAL(frameEncoded(QString, QByteArray, int, int)),
+    this, SIGNAL(viewFrameEncoded(QString, QByteArray, int, int)));
+  QObject::connect(&d->FrameEncoder, SIGNAL(frameTilesEncoded(QString, QVariantList, int, int, bool)),
+    this, SIGNAL(viewFrameTilesEncoded(QString, QVariantList, int, int, bool)));
 }
 
 //-----------------------------------------------------------------------------
@@ -156,12 +382,22 @@ QStringList qSlicerJupyterKernelModule::dependencies() const
 //-----------------------------------------------------------------------------
 void qSlicerJupyterKernelModule::setup()
 {
+  Q_D(qSlicerJupyterKernelModule);
   this->Superclass::setup();
+  // Pool size is persistent, so that the kernel specification can be updated later
+  // (e.g., when the kernel is installed from the module GUI) without losing the pool.
+  QSettings settings;
+  d->KernelPoolSize = qMax(0, settings.value("JupyterKernel/KernelPoolSize", 0).toInt());
+  // Poll mode is persistent, so that kernels that are started from the kernel specification
+  // or from the kernel pool use the mode that was last chosen.
+  d->PollMode = settings.value("JupyterKernel/PollMode", "SocketNotifier").toString() == "Timer"
+    ? PollModeTimer : PollModeSocketNotifier;
 }
 
 //-----------------------------------------------------------------------------
 bool qSlicerJupyterKernelModule::updateKernelSpec()
 {
+  Q_D(qSlicerJupyterKernelModule);
   QString kernelFolder = this->resourceFolderPath();
   if (kernelFolder.isEmpty())
   {
@@ -202,17 +438,39 @@ bool qSlicerJupyterKernelModule::updateKernelSpec()
   {
     kernelJson.replace("{slicer_version_minor}", QString::number(app->minorVersion()));
   }
+  QString realExecutable = app->launcherExecutableFilePath();
+  if (realExecutable.isEmpty())
+    {
+    realExecutable = app->applicationFilePath();
+    }
   if (kernelJson.indexOf("{slicer_launcher_executable}") != -1)
   {
-    QString realExecutable = app->launcherExecutableFilePath();
-    if (realExecutable.isEmpty())
-      {
-      realExecutable = app->applicationFilePath();
-      }
-
     kernelJson.replace("{slicer_launcher_executable}", realExecutable);
   }
 
+  if (d->KernelPoolSize > 0)
+  {
+    // Jupyter runs the pool launcher, which hands over the connection file to a pre-started application
+    QString pythonExecutable = QStandardPaths::findExecutable("PythonSlicer");
+    QString kernelPoolPy = kernelFolder + "/kernel-pool.py";
+    if (pythonExecutable.isEmpty() || !QFileInfo::exists(kernelPoolPy))
+    {
+      qWarning() << Q_FUNC_INFO << ": kernel pool is not used, PythonSlicer or kernel-pool.py is not found";
+    }
+    else
+    {
+      QJsonObject kernelSpec = QJsonDocument::fromJson(kernelJson.toUtf8()).object();
+      QJsonArray argv;
+      argv << pythonExecutable << kernelPoolPy
+        << "--slicer" << realExecutable
+        << "--pool-size" << QString::number(d->KernelPoolSize)
+        << "--linger" << QString::number(KernelPoolLingerSec)
+        << "{connection_file}";
+      kernelSpec["argv"] = argv;
+      kernelJson = QString::fromUtf8(QJsonDocument(kernelSpec).toJson());
+    }
+  }
+
   // Compare to existing kernel
 
   QString kernelJsonPath = kernelFolder + "/kernel.json";
@@ -265,16 +523,40 @@ void qSlicerJupyterKernelModule::startKernel(const QString& connectionFile)
   }
   else
   {
+    d->StartupTimes.clear();
+    QElapsedTimer phaseTimer;
+    phaseTimer.start();
+
     d->Config = xeus::load_configuration(connectionFile.toStdString());
+    d->recordStartupPhase("configuration", phaseTimer);
 
     using interpreter_ptr = std::unique_ptr<xSlicerInterpreter>;
     interpreter_ptr interpreter = interpreter_ptr(new xSlicerInterpreter());
     interpreter->set_jupyter_kernel_module(this);
+    interpreter->set_kernel_stats(&d->KernelStats);
+    interpreter->set_cell_profiler(&d->CellProfiler);
+    interpreter->set_cell_profiling(d->CellProfiling);
+    interpreter->set_stream_flush_interval(d->StreamFlushIntervalSec);
+    interpreter->set_iopub_data_rate_limit(d->IOPubDataRateLimit);
+    d->Interpreter = interpreter.get();
+    d->recordStartupPhase("interpreter", phaseTimer);
 
     using history_manager_ptr = std::unique_ptr<xeus::xhistory_manager>;
-    history_manager_ptr hist = xeus::make_in_memory_history_manager();
+    QString historyFilePath = this->historyFilePath();
+    if (historyFilePath.isEmpty())
+    {
+      historyFilePath = this->kernelSpecPath() + "/history.bin";
+    }
+    history_manager_ptr hist = make_xSlicerHistoryManager(historyFilePath, static_cast<std::size_t>(qMax(0, d->HistoryMaxEntries)));
+    if (!hist)
+    {
+      qWarning() << Q_FUNC_INFO << ": history is only stored in memory, cannot use history file " << historyFilePath;
+      hist = xeus::make_in_memory_history_manager();
+    }
+    d->recordStartupPhase("history", phaseTimer);
 
     auto context = xeus::make_zmq_context();
+    d->recordStartupPhase("zmqContext", phaseTimer);
 
     nl::json debugger_config;
     debugger_config["python"] = QStandardPaths::findExecutable("PythonSlicer").toStdString();
@@ -292,24 +574,56 @@ void qSlicerJupyterKernelModule::startKernel(const QString& connectionFile)
                                   // , xpyt::make_python_debugger, debugger_config
 
                                   );
+    d->recordStartupPhase("kernel", phaseTimer);
+
+    d->server()->setPollMode(d->PollMode == PollModeSocketNotifier
+      ? xSlicerServer::PollModeSocketNotifier : xSlicerServer::PollModeTimer);
+    d->server()->setBatchTimeBudgetSec(d->MessageBatchTimeBudgetSec);
+    d->server()->setCommMessageCoalescing(d->CommMessageCoalescing);
+    d->server()->setControlWatcherEnabled(d->FastInterrupt);
+    d->server()->setKernelStats(&d->KernelStats);
+    xSlicerInterpreter* kernelInterpreter = d->Interpreter;
+    d->server()->setIOPubFlushCallback([kernelInterpreter]() { kernelInterpreter->flush_streams(); });
+
+    // Comm targets, display hook, and kernel-configure.py are not needed for answering
+    // kernel_info requests, therefore they are set up after the kernel is reported as ready.
+    d->server()->setDeferredInitializationCallback([this]()
+      {
+      Q_D(qSlicerJupyterKernelModule);
+      QElapsedTimer deferredPhaseTimer;
+      deferredPhaseTimer.start();
+      d->Interpreter->configure_deferred();
+      d->recordStartupPhase("deferredConfiguration", deferredPhaseTimer);
+      QString kernelConfigurePy = this->resourceFolderPath() + "/kernel-configure.py";
+      QFile kernelConfigurePyFile(kernelConfigurePy);
+      if (kernelConfigurePyFile.open(QFile::ReadOnly | QFile::Text))
+      {
+        QTextStream in(&kernelConfigurePyFile);
+        QString kernelConfigurePyContent = in.readAll();
+        qSlicerPythonManager* pythonManager = qSlicerApplication::application()->pythonManager();
+        pythonManager->executeString(kernelConfigurePyContent);
+      }
+      else
+      {
+        qWarning() << Q_FUNC_INFO << " failed: cannot open kernel configure " << kernelConfigurePy;
+      }
+      d->recordStartupPhase("kernelConfigureScript", deferredPhaseTimer);
+      d->logStartupTimes();
+      });
+    d->recordStartupPhase("serverSetup", phaseTimer);
 
     d->Kernel->start();
-
-    d->Started = true;
-
-    QString kernelConfigurePy = this->resourceFolderPath() + "/kernel-configure.py";
-    QFile kernelConfigurePyFile(kernelConfigurePy);
-    if (kernelConfigurePyFile.open(QFile::ReadOnly | QFile::Text))
-    {
-      QTextStream in(&kernelConfigurePyFile);
-      QString kernelConfigurePyContent = in.readAll();
-      qSlicerPythonManager* pythonManager = qSlicerApplication::application()->pythonManager();
-      pythonManager->executeString(kernelConfigurePyContent);
-    }
-    else
+    // Kernel start includes interpreter configuration, report its steps separately
+    double interpreterConfigureTime = 0.0;
+    for (const std::pair<std::string, double>& configureTime : d->Interpreter->configure_times())
     {
-      qWarning() << Q_FUNC_INFO << " failed: cannot open kernel configure " << kernelConfigurePy;
+      d->StartupTimes.append(qMakePair(QString::fromStdString(configureTime.first), configureTime.second));
+      interpreterConfigureTime += configureTime.second;
     }
+    d->StartupTimes.append(qMakePair(QString("kernelStart"), phaseTimer.nsecsElapsed() * 1e-9 - interpreterConfigureTime));
+    phaseTimer.restart();
+
+    d->Started = true;
 
     QStatusBar* statusBar = NULL;
     if (qSlicerApplication::application()->mainWindow())
@@ -325,6 +639,8 @@ void qSlicerJupyterKernelModule::startKernel(const QString& connectionFile)
       }
       d->StatusLabel->setText(tr("<b><font color=\"red\">Application is managed by Jupyter</font></b>"));
     }
+    d->recordStartupPhase("statusDisplay", phaseTimer);
+    d->logStartupTimes();
     emit kernelStarted();
   }
 }
@@ -481,6 +797,516 @@ void qSlicerJupyterKernelModule::setPollIntervalSec(double intervalSec)
   reinterpret_cast<xSlicerServer*>(&d->Kernel->get_server())->setPollIntervalSec(intervalSec);
 }
 
+//---------------------------------------------------------------------------
+qSlicerJupyterKernelModule::PollMode qSlicerJupyterKernelModule::pollMode() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->PollMode;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setPollMode(PollMode mode)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->PollMode = mode;
+  QSettings settings;
+  settings.setValue("JupyterKernel/PollMode", mode == PollModeTimer ? "Timer" : "SocketNotifier");
+  xSlicerServer* server = d->server();
+  if (server)
+  {
+    server->setPollMode(mode == PollModeSocketNotifier
+      ? xSlicerServer::PollModeSocketNotifier : xSlicerServer::PollModeTimer);
+  }
+}
+
+//---------------------------------------------------------------------------
+double qSlicerJupyterKernelModule::messageBatchTimeBudgetSec() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->MessageBatchTimeBudgetSec;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setMessageBatchTimeBudgetSec(double budgetSec)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->MessageBatchTimeBudgetSec = budgetSec;
+  xSlicerServer* server = d->server();
+  if (server)
+  {
+    server->setBatchTimeBudgetSec(budgetSec);
+  }
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::commMessageCoalescing() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->CommMessageCoalescing;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setCommMessageCoalescing(bool enable)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->CommMessageCoalescing = enable;
+  xSlicerServer* server = d->server();
+  if (server)
+  {
+    server->setCommMessageCoalescing(enable);
+  }
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::fastInterrupt() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->FastInterrupt;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setFastInterrupt(bool enable)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->FastInterrupt = enable;
+  xSlicerServer* server = d->server();
+  if (server)
+  {
+    server->setControlWatcherEnabled(enable);
+  }
+}
+
+//---------------------------------------------------------------------------
+int qSlicerJupyterKernelModule::interruptCount() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  xSlicerServer* server = d->server();
+  return server ? server->interruptCount() : 0;
+}
+
+//---------------------------------------------------------------------------
+int qSlicerJupyterKernelModule::pendingMessageCount() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  xSlicerServer* server = d->server();
+  return server ? server->pendingMessageCount() : 0;
+}
+
+//---------------------------------------------------------------------------
+int qSlicerJupyterKernelModule::lastMessageBatchSize() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  xSlicerServer* server = d->server();
+  return server ? server->lastBatchSize() : 0;
+}
+
+//---------------------------------------------------------------------------
+int qSlicerJupyterKernelModule::maxMessageBatchSize() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  xSlicerServer* server = d->server();
+  return server ? server->maxBatchSize() : 0;
+}
+
+//---------------------------------------------------------------------------
+int qSlicerJupyterKernelModule::coalescedMessageCount() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  xSlicerServer* server = d->server();
+  return server ? server->coalescedMessageCount() : 0;
+}
+
+//---------------------------------------------------------------------------
+double qSlicerJupyterKernelModule::streamFlushIntervalSec() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->StreamFlushIntervalSec;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setStreamFlushIntervalSec(double intervalSec)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->StreamFlushIntervalSec = intervalSec;
+  if (d->Interpreter)
+  {
+    d->Interpreter->set_stream_flush_interval(intervalSec);
+  }
+}
+
+//---------------------------------------------------------------------------
+double qSlicerJupyterKernelModule::iopubDataRateLimit() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->IOPubDataRateLimit;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setIOPubDataRateLimit(double bytesPerSec)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->IOPubDataRateLimit = bytesPerSec;
+  if (d->Interpreter)
+  {
+    d->Interpreter->set_iopub_data_rate_limit(bytesPerSec);
+  }
+}
+
+//---------------------------------------------------------------------------
+QVariantMap qSlicerJupyterKernelModule::kernelStats() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  nl::json stats = d->KernelStats.to_json();
+  xSlicerServer* server = d->server();
+  if (server)
+  {
+    stats["server"]["pendingMessageCount"] = server->pendingMessageCount();
+    stats["server"]["lastBatchSize"] = server->lastBatchSize();
+    stats["server"]["maxBatchSize"] = server->maxBatchSize();
+    stats["server"]["coalescedMessageCount"] = server->coalescedMessageCount();
+  }
+  QJsonDocument statsDocument = QJsonDocument::fromJson(QByteArray::fromStdString(stats.dump()));
+  return statsDocument.toVariant().toMap();
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::resetKernelStats()
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->KernelStats.reset();
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::displayImage(const QByteArray& imageData, const QString& mimeType/*="image/png"*/)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  if (!d->Interpreter)
+  {
+    return false;
+  }
+  d->Interpreter->publish_image(imageData, mimeType.toStdString());
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::displayQImage(const QImage& image, const QString& format/*="PNG"*/, int quality/*=-1*/)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  if (!d->Interpreter)
+  {
+    return false;
+  }
+  QByteArray imageData = qSlicerJupyterViewCapture::encodeImage(image, format, quality);
+  if (imageData.isEmpty())
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot encode image as " << format;
+    return false;
+  }
+  d->Interpreter->publish_image(imageData, qSlicerJupyterViewCapture::mimeType(format).toStdString(),
+    image.width(), image.height());
+  return true;
+}
+
+//---------------------------------------------------------------------------
+QByteArray qSlicerJupyterKernelModule::captureView(const QString& layoutLabel, const QString& format/*="PNG"*/,
+  int quality/*=-1*/, int maxSize/*=0*/)
+{
+  ctkVTKAbstractView* view = qSlicerJupyterViewCapture::viewByLayoutLabel(layoutLabel);
+  if (!view)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: view not found by layout label " << layoutLabel;
+    return QByteArray();
+  }
+  return this->captureRenderView(view, format, quality, maxSize);
+}
+
+//---------------------------------------------------------------------------
+QByteArray qSlicerJupyterKernelModule::captureRenderView(QWidget* view, const QString& format/*="PNG"*/,
+  int quality/*=-1*/, int maxSize/*=0*/, bool forceRender/*=true*/)
+{
+  ctkVTKAbstractView* renderView = qobject_cast<ctkVTKAbstractView*>(view);
+  if (!renderView)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid render view";
+    return QByteArray();
+  }
+  QImage image = qSlicerJupyterViewCapture::captureView(renderView, forceRender);
+  image = qSlicerJupyterViewCapture::limitSize(image, maxSize);
+  return qSlicerJupyterViewCapture::encodeImage(image, format, quality);
+}
+
+//---------------------------------------------------------------------------
+QByteArray qSlicerJupyterKernelModule::captureLayout(const QString& format/*="PNG"*/, int quality/*=-1*/, int maxSize/*=0*/)
+{
+  QImage image = qSlicerJupyterViewCapture::captureLayout();
+  image = qSlicerJupyterViewCapture::limitSize(image, maxSize);
+  return qSlicerJupyterViewCapture::encodeImage(image, format, quality);
+}
+
+//---------------------------------------------------------------------------
+QByteArray qSlicerJupyterKernelModule::captureLightbox(QWidget* sliceWidget, int rows, int columns,
+  double startOffset, double endOffset, const QString& format/*="PNG"*/, int quality/*=-1*/, int maxSize/*=0*/)
+{
+  qMRMLSliceWidget* mrmlSliceWidget = qobject_cast<qMRMLSliceWidget*>(sliceWidget);
+  if (!mrmlSliceWidget)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid slice widget";
+    return QByteArray();
+  }
+  QImage image = qSlicerJupyterViewCapture::captureSliceSweep(mrmlSliceWidget, startOffset, endOffset, rows, columns);
+  image = qSlicerJupyterViewCapture::limitSize(image, maxSize);
+  return qSlicerJupyterViewCapture::encodeImage(image, format, quality);
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::captureRenderViewAsync(QWidget* view, const QString& streamId,
+  const QString& format/*="JPG"*/, int quality/*=-1*/, int maxSize/*=0*/, bool forceRender/*=true*/)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  ctkVTKAbstractView* renderView = qobject_cast<ctkVTKAbstractView*>(view);
+  if (!renderView)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid render view";
+    return false;
+  }
+  // Rendering and reading the image must be done on the main thread,
+  // only encoding is done in the background.
+  QImage image = qSlicerJupyterViewCapture::captureView(renderView, forceRender);
+  if (image.isNull())
+  {
+    return false;
+  }
+  image = qSlicerJupyterViewCapture::limitSize(image, maxSize);
+  d->FrameEncoder.submitFrame(streamId, image, format, quality);
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::captureSliceAtOffsetAsync(QWidget* sliceWidget, double offset, const QString& streamId,
+  const QString& format/*="PNG"*/, int quality/*=-1*/, int maxSize/*=0*/)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  qMRMLSliceWidget* mrmlSliceWidget = qobject_cast<qMRMLSliceWidget*>(sliceWidget);
+  if (!mrmlSliceWidget)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid slice widget";
+    return false;
+  }
+  QImage image = qSlicerJupyterViewCapture::captureSliceAtOffset(mrmlSliceWidget, offset);
+  if (image.isNull())
+  {
+    return false;
+  }
+  image = qSlicerJupyterViewCapture::limitSize(image, maxSize);
+  d->FrameEncoder.submitFrame(streamId, image, format, quality);
+  return true;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::clearFrameStream(const QString& streamId)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->FrameEncoder.clearStream(streamId);
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setFrameStreamDeltaEncoding(const QString& streamId, bool enabled, int keyframeInterval/*=30*/)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->FrameEncoder.setStreamDeltaEncoding(streamId, enabled, keyframeInterval);
+}
+
+//---------------------------------------------------------------------------
+int qSlicerJupyterKernelModule::frameEncoderThreadCount() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->FrameEncoder.maxThreadCount();
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setFrameEncoderThreadCount(int count)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->FrameEncoder.setMaxThreadCount(count);
+}
+
+//---------------------------------------------------------------------------
+int qSlicerJupyterKernelModule::droppedFrameCount() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->FrameEncoder.droppedFrameCount();
+}
+
+//---------------------------------------------------------------------------
+QString qSlicerJupyterKernelModule::historyFilePath() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->HistoryFilePath;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setHistoryFilePath(const QString& filePath)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->HistoryFilePath = filePath;
+}
+
+//---------------------------------------------------------------------------
+int qSlicerJupyterKernelModule::historyMaxEntries() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->HistoryMaxEntries;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setHistoryMaxEntries(int maxEntries)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->HistoryMaxEntries = maxEntries;
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::cellProfiling() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  // Profiling may have been enabled/disabled from the notebook
+  return d->Interpreter ? d->Interpreter->cell_profiling() : d->CellProfiling;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setCellProfiling(bool enable)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->CellProfiling = enable;
+  if (d->Interpreter)
+  {
+    d->Interpreter->set_cell_profiling(enable);
+  }
+}
+
+//---------------------------------------------------------------------------
+QVariantList qSlicerJupyterKernelModule::cellProfiles() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  QJsonDocument profilesDocument = QJsonDocument::fromJson(QByteArray::fromStdString(d->CellProfiler.to_json().dump()));
+  return profilesDocument.toVariant().toList();
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::clearCellProfiles()
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->CellProfiler.reset();
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::tracing() const
+{
+  return xSlicerTrace::instance().isEnabled();
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setTracing(bool enable)
+{
+  xSlicerTrace::instance().setEnabled(enable);
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::writeTrace(const QString& filePath)
+{
+  std::string trace = xSlicerTrace::instance().toChromeTrace().dump();
+  QSaveFile traceFile(filePath);
+  if (!traceFile.open(QIODevice::WriteOnly)
+    || traceFile.write(trace.data(), static_cast<qint64>(trace.size())) < 0
+    || !traceFile.commit())
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot write " << filePath;
+    return false;
+  }
+  return true;
+}
+
+//---------------------------------------------------------------------------
+QString qSlicerJupyterKernelModule::traceJson() const
+{
+  return QString::fromStdString(xSlicerTrace::instance().toChromeTrace().dump());
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::clearTrace()
+{
+  xSlicerTrace::instance().clear();
+}
+
+//---------------------------------------------------------------------------
+QVariantMap qSlicerJupyterKernelModule::startupTimes() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  QVariantMap startupTimes;
+  double totalTime = 0.0;
+  for (const QPair<QString, double>& phaseTime : d->StartupTimes)
+  {
+    startupTimes[phaseTime.first] = phaseTime.second;
+    totalTime += phaseTime.second;
+  }
+  startupTimes["total"] = totalTime;
+  return startupTimes;
+}
+
+//---------------------------------------------------------------------------
+int qSlicerJupyterKernelModule::kernelPoolSize() const
+{
+  Q_D(const qSlicerJupyterKernelModule);
+  return d->KernelPoolSize;
+}
+
+//---------------------------------------------------------------------------
+void qSlicerJupyterKernelModule::setKernelPoolSize(int poolSize)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  d->KernelPoolSize = qMax(0, poolSize);
+  QSettings settings;
+  settings.setValue("JupyterKernel/KernelPoolSize", d->KernelPoolSize);
+}
+
+//---------------------------------------------------------------------------
+bool qSlicerJupyterKernelModule::listenForKernelConnection(const QString& serverName, const QString& readyFilePath)
+{
+  Q_D(qSlicerJupyterKernelModule);
+  if (d->Started || d->KernelPoolServer)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: kernel is already started or waiting for connection";
+    return false;
+  }
+  d->KernelPoolServer = new QLocalServer(this);
+  // Only the same user can hand over a kernel to this application
+  d->KernelPoolServer->setSocketOptions(QLocalServer::UserAccessOption);
+  QLocalServer::removeServer(serverName);
+  if (!d->KernelPoolServer->listen(serverName))
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot listen on " << serverName << ": " << d->KernelPoolServer->errorString();
+    delete d->KernelPoolServer;
+    d->KernelPoolServer = nullptr;
+    return false;
+  }
+  QObject::connect(d->KernelPoolServer, &QLocalServer::newConnection, this, [d]() { d->onKernelPoolConnection(); });
+
+  // Write the file atomically, so that launchers never read an incomplete file
+  QJsonObject readyInfo;
+  readyInfo["server"] = d->KernelPoolServer->fullServerName();
+  readyInfo["pid"] = QCoreApplication::applicationPid();
+  QSaveFile readyFile(readyFilePath);
+  if (!readyFile.open(QIODevice::WriteOnly)
+    || readyFile.write(QJsonDocument(readyInfo).toJson(QJsonDocument::Compact)) < 0
+    || !readyFile.commit())
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot write " << readyFilePath;
+    d->KernelPoolServer->close();
+    return false;
+  }
+  return true;
+}
+
 //---------------------------------------------------------------------------
 QString qSlicerJupyterKernelModule::connectionFile()
 {
@@ -18,12 +18,17 @@
 #ifndef __qSlicerJupyterKernelModule_h
 #define __qSlicerJupyterKernelModule_h
 
+// Qt includes
+#include <QImage>
+#include <QVariantMap>
+
 // SlicerQt includes
 #include "qSlicerLoadableModule.h"
 
 #include "qSlicerJupyterKernelModuleExport.h"
 
 class qSlicerJupyterKernelModulePrivate;
+class QWidget;
 
 /// \ingroup Slicer_QtModules_ExtensionTemplate
 class Q_SLICER_QTMODULES_JUPYTERKERNEL_EXPORT
@@ -36,10 +41,40 @@ qSlicerJupyterKernelModule
 #endif
   Q_INTERFACES(qSlicerLoadableModule);
   Q_PROPERTY(double pollIntervalSec READ pollIntervalSec WRITE setPollIntervalSec)
+  Q_PROPERTY(PollMode pollMode READ pollMode WRITE setPollMode)
+  Q_PROPERTY(double messageBatchTimeBudgetSec READ messageBatchTimeBudgetSec WRITE setMessageBatchTimeBudgetSec)
+  Q_PROPERTY(bool commMessageCoalescing READ commMessageCoalescing WRITE setCommMessageCoalescing)
+  Q_PROPERTY(int pendingMessageCount READ pendingMessageCount)
+  Q_PROPERTY(int lastMessageBatchSize READ lastMessageBatchSize)
+  Q_PROPERTY(int maxMessageBatchSize READ maxMessageBatchSize)
+  Q_PROPERTY(int coalescedMessageCount READ coalescedMessageCount)
+  Q_PROPERTY(bool fastInterrupt READ fastInterrupt WRITE setFastInterrupt)
+  Q_PROPERTY(int interruptCount READ interruptCount)
+  Q_PROPERTY(double streamFlushIntervalSec READ streamFlushIntervalSec WRITE setStreamFlushIntervalSec)
+  Q_PROPERTY(double iopubDataRateLimit READ iopubDataRateLimit WRITE setIOPubDataRateLimit)
+  Q_PROPERTY(int frameEncoderThreadCount READ frameEncoderThreadCount WRITE setFrameEncoderThreadCount)
+  Q_PROPERTY(int droppedFrameCount READ droppedFrameCount)
+  Q_PROPERTY(QString historyFilePath READ historyFilePath WRITE setHistoryFilePath)
+  Q_PROPERTY(int historyMaxEntries READ historyMaxEntries WRITE setHistoryMaxEntries)
+  Q_PROPERTY(int kernelPoolSize READ kernelPoolSize WRITE setKernelPoolSize)
+  Q_PROPERTY(bool cellProfiling READ cellProfiling WRITE setCellProfiling)
+  Q_PROPERTY(bool tracing READ tracing WRITE setTracing)
   Q_PROPERTY(QString connectionFile READ connectionFile)
   Q_PROPERTY(bool internalJupyterServerRunning READ isInternalJupyterServerRunning)
 public:
 
+  /// Defines how the kernel detects incoming requests.
+  enum PollMode
+  {
+    /// Check for incoming messages at regular intervals (see pollIntervalSec).
+    /// Fallback mode, in case socket notifiers do not work on a platform.
+    PollModeTimer,
+    /// Process messages as soon as they arrive (event-driven, no CPU usage when idle).
+    /// This is the default mode.
+    PollModeSocketNotifier
+  };
+  Q_ENUM(PollMode);
+
   typedef qSlicerLoadableModule Superclass;
   explicit qSlicerJupyterKernelModule(QObject *parent=0);
   virtual ~qSlicerJupyterKernelModule();
@@ -55,6 +90,8 @@ public:
   QStringList categories()const override;
   QStringList dependencies()const override;
 
+  /// Create kernel.json file in the kernel specification folder.
+  /// If kernelPoolSize is larger than 0 then the kernel is launched using kernel-pool.py.
   Q_INVOKABLE virtual bool updateKernelSpec();
 
   /// Get path where KernelSpec is created.
@@ -62,6 +99,15 @@ public:
 
   Q_INVOKABLE virtual bool slicerKernelSpecInstallCommandArgs(QString& executable, QStringList& args);
 
+  /// Wait for a kernel pool launcher (kernel-pool.py) to provide a connection file, then start the kernel.
+  /// Used by pre-started Slicer instances of a kernel pool.
+  /// \param serverName name of the local server (named pipe or Unix domain socket) that the launcher connects to
+  /// \param readyFilePath file that is created when the application is ready to start a kernel.
+  ///   It contains the full server name and process ID.
+  /// The application exits when the launcher process exits, as Jupyter manages the kernel through that process.
+  /// Returns false if the local server cannot be started.
+  Q_INVOKABLE bool listenForKernelConnection(const QString& serverName, const QString& readyFilePath);
+
   /// Install Jupyter server in Slicer's Python environment
   Q_INVOKABLE virtual bool installInternalJupyterServer();
 
@@ -79,11 +125,185 @@ public:
   /// Only applicable to server that is started with detached=false.
   bool isInternalJupyterServerRunning() const;
 
+  /// Get message processing statistics of the kernel.
+  /// Returns a dictionary: {stage: {messageType: {count, bytes, mean, max, p50, p95, p99}}}.
+  /// Stages: queue (waiting for processing), handler (processing), reply (receiving to replying),
+  /// interpreter (Python execution, completion, inspection), iopub (publishing outputs).
+  /// Durations are in seconds. Current message queue status is reported in "server" item.
+  Q_INVOKABLE QVariantMap kernelStats() const;
+
+  /// Clear all collected kernel statistics.
+  Q_INVOKABLE void resetKernelStats();
+
+  /// Get duration of kernel startup phases in seconds: {phase: seconds, ..., total: seconds}.
+  /// Phases: configuration, interpreter, history, zmqContext, kernel (sockets and threads),
+  /// serverSetup, pythonInterpreter and outputRedirection (interpreter configuration), kernelStart, statusDisplay.
+  /// deferredConfiguration (comm targets, display hook) and kernelConfigureScript are added when
+  /// the deferred initialization is completed (after the first kernel_info reply).
+  /// Startup times are also written to the application log.
+  Q_INVOKABLE QVariantMap startupTimes() const;
+
+  /// Get resource usage of executed cells (recorded when cellProfiling is enabled).
+  /// Returns a list of dictionaries (most recent 1000 cells), one for each execution:
+  /// executionCount, code (beginning of the cell), wallTimeSec, cpuTimeSec, rssBytes, rssDeltaBytes,
+  /// pythonAllocatedBlocksDelta, mrmlNodeCount, mrmlNodeCountDelta.
+  /// The list can be viewed as a table by calling pandas.DataFrame(slicer.modules.jupyterkernel.cellProfiles()).
+  Q_INVOKABLE QVariantList cellProfiles() const;
+
+  /// Remove all recorded cell profiles.
+  Q_INVOKABLE void clearCellProfiles();
+
+  /// Write kernel activity timeline (recorded when tracing is enabled) to a JSON file.
+  /// The file can be opened in Chrome (chrome://tracing) or Perfetto (https://ui.perfetto.dev).
+  Q_INVOKABLE bool writeTrace(const QString& filePath);
+
+  /// Get kernel activity timeline in Chrome trace event format (JSON string).
+  Q_INVOKABLE QString traceJson() const;
+
+  /// Remove all recorded trace events.
+  Q_INVOKABLE void clearTrace();
+
+  /// Display an encoded image (PNG, JPEG, ...) in the output of the currently executed notebook cell.
+  /// The image data is sent to the notebook without creating intermediate Python strings.
+  /// Returns false if the kernel is not running.
+  Q_INVOKABLE bool displayImage(const QByteArray& imageData, const QString& mimeType = "image/png");
+
+  /// Encode a QImage and display it in the output of the currently executed notebook cell.
+  /// \param format image file format name, such as PNG or JPG
+  /// \param quality image quality for lossy formats (0-100, -1 for default quality)
+  /// Returns false if the kernel is not running or the image cannot be encoded.
+  Q_INVOKABLE bool displayQImage(const QImage& image, const QString& format = "PNG", int quality = -1);
+
+  /// Render a view and return its content as an encoded image.
+  /// \param layoutLabel label of the view as displayed in the view's header (such as "1", "R", "Y", "G")
+  ///   or view name (such as "Red"). If empty then the first 3D view is captured.
+  /// \param format image file format name, such as PNG or JPG
+  /// \param quality image quality for lossy formats (0-100, -1 for default quality)
+  /// \param maxSize if larger than 0 then the image is scaled down so that its width and height
+  ///   are not larger than this value.
+  /// Returns empty array if the view is not found or the image cannot be encoded.
+  Q_INVOKABLE QByteArray captureView(const QString& layoutLabel, const QString& format = "PNG", int quality = -1, int maxSize = 0);
+
+  /// Same as captureView but the view is specified by its widget (ctkVTKAbstractView, such as qMRMLSliceView or qMRMLThreeDView).
+  /// If forceRender is false then the image that is currently displayed in the view is returned.
+  Q_INVOKABLE QByteArray captureRenderView(QWidget* view, const QString& format = "PNG", int quality = -1, int maxSize = 0, bool forceRender = true);
+
+  /// Capture all the views in the current layout and return it as an encoded image.
+  Q_INVOKABLE QByteArray captureLayout(const QString& format = "PNG", int quality = -1, int maxSize = 0);
+
+  /// Sweep a slice view through a range of slice offsets and return the rendered slices
+  /// tiled into a single encoded image (rows x columns, in row-major order).
+  /// The mosaic is composited in memory and encoded once, no temporary files are written.
+  /// \param sliceWidget slice widget (qMRMLSliceWidget) to capture
+  /// \param startOffset slice offset of the first tile
+  /// \param endOffset slice offset of the last tile
+  /// Other parameters are the same as in captureRenderView.
+  /// Returns empty array if the images cannot be captured or encoded.
+  Q_INVOKABLE QByteArray captureLightbox(QWidget* sliceWidget, int rows, int columns, double startOffset, double endOffset,
+    const QString& format = "PNG", int quality = -1, int maxSize = 0);
+
+  /// Render a view and encode its content in a background thread.
+  /// When encoding is completed, viewFrameEncoded signal is emitted with the same streamId.
+  /// If a previous frame of the same stream is still being encoded then the new frame waits,
+  /// replacing any frame that was already waiting (only the most recent frame is encoded).
+  /// Parameters are the same as in captureRenderView.
+  /// Returns false if the view cannot be captured.
+  Q_INVOKABLE bool captureRenderViewAsync(QWidget* view, const QString& streamId, const QString& format = "JPG",
+    int quality = -1, int maxSize = 0, bool forceRender = true);
+
+  /// Render a slice view at the specified slice offset and encode the image in a background thread.
+  /// The slice is not displayed in the view and the slice offset of the view is not changed
+  /// (see qSlicerJupyterViewCapture::captureSliceAtOffset), which allows rendering slices in advance.
+  /// When encoding is completed, viewFrameEncoded signal is emitted with the same streamId.
+  /// Other parameters are the same as in captureRenderViewAsync.
+  /// Returns false if the slice cannot be captured.
+  Q_INVOKABLE bool captureSliceAtOffsetAsync(QWidget* sliceWidget, double offset, const QString& streamId,
+    const QString& format = "PNG", int quality = -1, int maxSize = 0);
+
+  /// Discard frames of the stream that are waiting for encoding.
+  Q_INVOKABLE void clearFrameStream(const QString& streamId);
+
+  /// Only encode regions of the image that have changed since the previous frame of the stream.
+  /// If enabled then viewFrameTilesEncoded signal is emitted instead of viewFrameEncoded.
+  /// \param keyframeInterval the complete image is encoded after this many partial updates
+  Q_INVOKABLE void setFrameStreamDeltaEncoding(const QString& streamId, bool enabled, int keyframeInterval = 30);
+
   /// Deprecated. Use kernelSpecPath() instead.
   Q_INVOKABLE virtual QString resourceFolderPath();
 
   double pollIntervalSec();
 
+  /// Get how the kernel detects incoming requests.
+  /// The mode can be changed before or after the kernel is started.
+  /// The mode is saved in application settings and used by all kernels started later.
+  PollMode pollMode() const;
+
+  /// Maximum time the kernel spends processing queued messages before it lets
+  /// the application process other events (rendering, user interaction).
+  double messageBatchTimeBudgetSec() const;
+
+  /// If enabled then only the most recent of consecutive mouse move events
+  /// sent to the same widget is processed.
+  bool commMessageCoalescing() const;
+
+  /// Number of received messages that are waiting to be processed.
+  /// If this number keeps growing then the kernel cannot keep up with the incoming requests.
+  int pendingMessageCount() const;
+  /// Number of messages processed at the last wake-up of the kernel.
+  int lastMessageBatchSize() const;
+  /// Largest number of messages processed at a single wake-up since the kernel started.
+  int maxMessageBatchSize() const;
+  /// Number of mouse move events skipped because of comm message coalescing.
+  int coalescedMessageCount() const;
+
+  /// If enabled (default) then the control channel is serviced by a background thread
+  /// while a cell is executed, so that interrupt requests raise KeyboardInterrupt
+  /// in the running Python code immediately.
+  bool fastInterrupt() const;
+  /// Number of interrupt requests delivered to running cells since the kernel started.
+  int interruptCount() const;
+
+  /// Printed outputs are collected and sent to the notebook together
+  /// when they are older than this interval or when execution of the cell is completed.
+  double streamFlushIntervalSec() const;
+
+  /// Maximum number of bytes per second that printed outputs can send to the notebook.
+  /// Additional outputs are discarded. 0 means unlimited.
+  double iopubDataRateLimit() const;
+
+  /// Maximum number of threads used by captureRenderViewAsync for image encoding.
+  int frameEncoderThreadCount() const;
+
+  /// Number of frames that captureRenderViewAsync discarded because a newer frame was available.
+  int droppedFrameCount() const;
+
+  /// File where the kernel stores the history of executed inputs.
+  /// If empty (default) then history.bin in the kernel specification folder is used.
+  /// If the file cannot be written then history is only kept in memory.
+  /// The value is used when the kernel is started.
+  QString historyFilePath() const;
+
+  /// Maximum number of inputs kept in the history file. 0 means unlimited.
+  /// The value is used when the kernel is started.
+  int historyMaxEntries() const;
+
+  /// Number of pre-started idle Slicer instances that are kept running for quick kernel startup.
+  /// 0 (default) means that Jupyter starts a new Slicer instance for each kernel.
+  /// The value is used when the kernel specification is created (see updateKernelSpec).
+  /// The value is saved in the application settings.
+  int kernelPoolSize() const;
+
+  /// If enabled then time, memory usage change, and MRML node count change of each executed cell
+  /// is recorded (see cellProfiles) and sent to the notebook in the "slicer_profile" item
+  /// of the execute_reply metadata. Disabled by default.
+  /// It can be also enabled/disabled in a notebook by executing __kernel_profile_enable() / __kernel_profile_disable().
+  bool cellProfiling() const;
+
+  /// If enabled then the timeline of message processing, Python execution, view rendering,
+  /// image encoding, and publishing is recorded (the most recent 65536 events in each thread).
+  /// Disabled by default. See writeTrace.
+  bool tracing() const;
+
   QString connectionFile();
 
 public slots:
@@ -91,6 +311,18 @@ public slots:
   void startKernel(const QString& connectionFile);
   void stopKernel();
   void setPollIntervalSec(double intervalSec);
+  void setPollMode(PollMode mode);
+  void setMessageBatchTimeBudgetSec(double budgetSec);
+  void setCommMessageCoalescing(bool enable);
+  void setFastInterrupt(bool enable);
+  void setStreamFlushIntervalSec(double intervalSec);
+  void setIOPubDataRateLimit(double bytesPerSec);
+  void setFrameEncoderThreadCount(int count);
+  void setHistoryFilePath(const QString& filePath);
+  void setHistoryMaxEntries(int maxEntries);
+  void setKernelPoolSize(int poolSize);
+  void setCellProfiling(bool enable);
+  void setTracing(bool enable);
 
 signals:
   // Called after kernel has successfully started
@@ -99,6 +331,13 @@ signals:
   // Called when Jupyter requested stopping of the kernel.
   void kernelStopRequested();
 
+  // Called when encoding of an image requested by captureRenderViewAsync is completed.
+  void viewFrameEncoded(const QString& streamId, const QByteArray& imageData, int width, int height);
+
+  // Called when encoding of an image requested by captureRenderViewAsync is completed
+  // for a stream that uses delta encoding. Each tile is a dictionary containing x, y, width, height, and data.
+  void viewFrameTilesEncoded(const QString& streamId, const QVariantList& tiles, int width, int height, bool keyframe);
+
 protected:
 
   /// Initialize the module. Register the volumes reader/writer
@@ -18,6 +18,7 @@
 // Qt includes
 #include <QDebug>
 #include <QClipboard>
+#include <QFileDialog>
 
 // SlicerQt includes
 #include "qSlicerJupyterKernelModuleWidget.h"
@@ -77,6 +78,7 @@ void qSlicerJupyterKernelModuleWidget::setup()
       QString manualInstallCommand = executable + " " + args.join(" ");
       d->ManualInstallCommandTextEdit->setText(manualInstallCommand);
     }
+    d->TracingCheckBox->setChecked(kernelModule->tracing());
   }
 
   // Stopping of the server does not work and it is not really needed either.
@@ -87,6 +89,10 @@ void qSlicerJupyterKernelModuleWidget::setup()
   connect(d->StopJupyterNotebookPushButton, SIGNAL(clicked()), this, SLOT(stopJupyterServer()));
 
   connect(d->CopyCommandToClipboardPushButton, SIGNAL(clicked()), this, SLOT(copyInstallCommandToClipboard()));
+
+  connect(d->TracingCheckBox, SIGNAL(toggled(bool)), this, SLOT(setTracing(bool)));
+  connect(d->SaveTracePushButton, SIGNAL(clicked()), this, SLOT(saveTrace()));
+  connect(d->ClearTracePushButton, SIGNAL(clicked()), this, SLOT(clearTrace()));
 }
 
 //-----------------------------------------------------------------------------
@@ -189,3 +195,45 @@ void qSlicerJupyterKernelModuleWidget::stopJupyterServer()
     d->JupyterServerStatusLabel->setText(tr("Jupyter server stop failed. See application log for details."));
   }
 }
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterKernelModuleWidget::setTracing(bool enable)
+{
+  qSlicerJupyterKernelModule* kernelModule = dynamic_cast<qSlicerJupyterKernelModule*>(this->module());
+  if (!kernelModule)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid module";
+    return;
+  }
+  kernelModule->setTracing(enable);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterKernelModuleWidget::saveTrace()
+{
+  qSlicerJupyterKernelModule* kernelModule = dynamic_cast<qSlicerJupyterKernelModule*>(this->module());
+  if (!kernelModule)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid module";
+    return;
+  }
+  QString filePath = QFileDialog::getSaveFileName(this, tr("Save trace"), "SlicerKernelTrace.json",
+    tr("Trace files (*.json)"));
+  if (filePath.isEmpty())
+  {
+    return;
+  }
+  kernelModule->writeTrace(filePath);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerJupyterKernelModuleWidget::clearTrace()
+{
+  qSlicerJupyterKernelModule* kernelModule = dynamic_cast<qSlicerJupyterKernelModule*>(this->module());
+  if (!kernelModule)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid module";
+    return;
+  }
+  kernelModule->clearTrace();
+}
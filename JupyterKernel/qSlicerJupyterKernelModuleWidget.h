@@ -46,6 +46,10 @@ public slots:
   void startJupyterServer();
   void stopJupyterServer();
 
+  void setTracing(bool enable);
+  void saveTrace();
+  void clearTrace();
+
 protected:
   QScopedPointer<qSlicerJupyterKernelModuleWidgetPrivate> d_ptr;
 
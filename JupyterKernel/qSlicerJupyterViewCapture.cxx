@@ -0,0 +1,254 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "qSlicerJupyterViewCapture.h"
+#include "xSlicerTrace.h"
+
+// Qt includes
+#include <QBuffer>
+#include <QDebug>
+#include <QImageWriter>
+
+// STL includes
+#include <cstring>
+
+// CTK includes
+#include <ctkVTKAbstractView.h>
+#include <ctkVTKWidgetsUtils.h>
+
+// Slicer includes
+#include "qSlicerApplication.h"
+#include "qSlicerLayoutManager.h"
+#include "qMRMLSliceView.h"
+#include "qMRMLSliceWidget.h"
+#include "qMRMLThreeDView.h"
+#include "qMRMLThreeDWidget.h"
+
+// MRML includes
+#include <vtkMRMLSliceLogic.h>
+#include <vtkMRMLSliceNode.h>
+#include <vtkMRMLViewNode.h>
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkRenderWindow.h>
+#include <vtkWindowToImageFilter.h>
+
+//-----------------------------------------------------------------------------
+ctkVTKAbstractView* qSlicerJupyterViewCapture::viewByLayoutLabel(const QString& layoutLabel)
+{
+  qSlicerLayoutManager* layoutManager = qSlicerApplication::application()->layoutManager();
+  if (!layoutManager)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: layout manager is not available";
+    return nullptr;
+  }
+  for (int threeDViewIndex = 0; threeDViewIndex < layoutManager->threeDViewCount(); ++threeDViewIndex)
+  {
+    qMRMLThreeDWidget* threeDWidget = layoutManager->threeDWidget(threeDViewIndex);
+    vtkMRMLViewNode* viewNode = threeDWidget ? threeDWidget->mrmlViewNode() : nullptr;
+    if (!viewNode)
+    {
+      continue;
+    }
+    if (layoutLabel.isEmpty()
+      || layoutLabel == viewNode->GetLayoutLabel()
+      || layoutLabel == viewNode->GetLayoutName())
+    {
+      return threeDWidget->threeDView();
+    }
+  }
+  foreach(const QString& sliceViewName, layoutManager->sliceViewNames())
+  {
+    qMRMLSliceWidget* sliceWidget = layoutManager->sliceWidget(sliceViewName);
+    vtkMRMLSliceNode* sliceNode = sliceWidget ? sliceWidget->mrmlSliceNode() : nullptr;
+    if (!sliceNode)
+    {
+      continue;
+    }
+    if (layoutLabel.isEmpty()
+      || layoutLabel == sliceNode->GetLayoutLabel()
+      || layoutLabel == sliceViewName)
+    {
+      return sliceWidget->sliceView();
+    }
+  }
+  return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+QImage qSlicerJupyterViewCapture::captureView(ctkVTKAbstractView* view, bool forceRender/*=true*/)
+{
+  XSLICER_TRACE_SCOPE("render", "captureView");
+  if (!view || !view->renderWindow())
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid view";
+    return QImage();
+  }
+  if (forceRender)
+  {
+    view->forceRender();
+  }
+  vtkNew<vtkWindowToImageFilter> windowToImageFilter;
+  windowToImageFilter->SetInput(view->renderWindow());
+  windowToImageFilter->SetInputBufferTypeToRGB();
+  // The view has just been rendered (or it is up-to-date), no need to render again
+  windowToImageFilter->ShouldRerenderOff();
+  windowToImageFilter->ReadFrontBufferOff();
+  windowToImageFilter->Update();
+  return ctk::vtkImageDataToQImage(windowToImageFilter->GetOutput());
+}
+
+//-----------------------------------------------------------------------------
+QImage qSlicerJupyterViewCapture::captureSliceSweep(qMRMLSliceWidget* sliceWidget,
+  double startOffset, double endOffset, int rows, int columns)
+{
+  if (!sliceWidget || !sliceWidget->sliceLogic() || !sliceWidget->sliceView())
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid slice widget";
+    return QImage();
+  }
+  if (rows < 1 || columns < 1)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid number of rows or columns";
+    return QImage();
+  }
+  XSLICER_TRACE_SCOPE("render", "captureSliceSweep");
+  vtkMRMLSliceLogic* sliceLogic = sliceWidget->sliceLogic();
+  const double originalOffset = sliceLogic->GetSliceOffset();
+  const int numberOfFrames = rows * columns;
+  QImage mosaic;
+  for (int frameIndex = 0; frameIndex < numberOfFrames; ++frameIndex)
+  {
+    double offset = startOffset;
+    if (numberOfFrames > 1)
+    {
+      offset += (endOffset - startOffset) * frameIndex / (numberOfFrames - 1);
+    }
+    sliceLogic->SetSliceOffset(offset);
+    QImage frame = qSlicerJupyterViewCapture::captureView(sliceWidget->sliceView(), true);
+    if (frame.isNull())
+    {
+      mosaic = QImage();
+      break;
+    }
+    if (mosaic.isNull())
+    {
+      mosaic = QImage(frame.width() * columns, frame.height() * rows, frame.format());
+      mosaic.fill(Qt::black);
+    }
+    if (frame.format() != mosaic.format()
+      || frame.width() * columns != mosaic.width() || frame.height() * rows != mosaic.height())
+    {
+      qWarning() << Q_FUNC_INFO << " failed: view size changed during capture";
+      mosaic = QImage();
+      break;
+    }
+    // Copy the frame into its tile, line by line
+    const int bytesPerFrameLine = frame.width() * frame.depth() / 8;
+    const int tileLeft = (frameIndex % columns) * bytesPerFrameLine;
+    const int tileTop = (frameIndex / columns) * frame.height();
+    for (int y = 0; y < frame.height(); ++y)
+    {
+      memcpy(mosaic.scanLine(tileTop + y) + tileLeft, frame.constScanLine(y), bytesPerFrameLine);
+    }
+  }
+  sliceLogic->SetSliceOffset(originalOffset);
+  return mosaic;
+}
+
+//-----------------------------------------------------------------------------
+QImage qSlicerJupyterViewCapture::captureSliceAtOffset(qMRMLSliceWidget* sliceWidget, double offset)
+{
+  if (!sliceWidget || !sliceWidget->sliceLogic() || !sliceWidget->sliceView()
+    || !sliceWidget->sliceView()->renderWindow())
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid slice widget";
+    return QImage();
+  }
+  XSLICER_TRACE_SCOPE("render", "captureSliceAtOffset");
+  vtkMRMLSliceLogic* sliceLogic = sliceWidget->sliceLogic();
+  vtkRenderWindow* renderWindow = sliceWidget->sliceView()->renderWindow();
+  const double originalOffset = sliceLogic->GetSliceOffset();
+  // Render into the back buffer only, so that the slice does not appear on the screen
+  const int swapBuffers = renderWindow->GetSwapBuffers();
+  renderWindow->SwapBuffersOff();
+  sliceLogic->SetSliceOffset(offset);
+  QImage image = qSlicerJupyterViewCapture::captureView(sliceWidget->sliceView(), true);
+  sliceLogic->SetSliceOffset(originalOffset);
+  renderWindow->SetSwapBuffers(swapBuffers);
+  // The back buffer contains the captured slice now, make sure the current slice is rendered again
+  sliceWidget->sliceView()->scheduleRender();
+  return image;
+}
+
+//-----------------------------------------------------------------------------
+QImage qSlicerJupyterViewCapture::captureLayout()
+{
+  XSLICER_TRACE_SCOPE("render", "captureLayout");
+  qSlicerLayoutManager* layoutManager = qSlicerApplication::application()->layoutManager();
+  if (!layoutManager || !layoutManager->viewport())
+  {
+    qWarning() << Q_FUNC_INFO << " failed: layout manager is not available";
+    return QImage();
+  }
+  return layoutManager->viewport()->grab().toImage();
+}
+
+//-----------------------------------------------------------------------------
+QImage qSlicerJupyterViewCapture::limitSize(const QImage& image, int maxSize)
+{
+  if (maxSize <= 0 || (image.width() <= maxSize && image.height() <= maxSize))
+  {
+    return image;
+  }
+  return image.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+//-----------------------------------------------------------------------------
+QByteArray qSlicerJupyterViewCapture::encodeImage(const QImage& image, const QString& format, int quality/*=-1*/)
+{
+  QByteArray imageData;
+  if (image.isNull())
+  {
+    return imageData;
+  }
+  XSLICER_TRACE_SCOPE("encode", format.toStdString());
+  QBuffer buffer(&imageData);
+  buffer.open(QIODevice::WriteOnly);
+  // Qt image plugins use libjpeg-turbo (SIMD-accelerated) and zlib for encoding.
+  QImageWriter writer(&buffer, format.toLatin1());
+  writer.setQuality(quality);
+  if (!writer.write(image))
+  {
+    qWarning() << Q_FUNC_INFO << " failed: " << writer.errorString();
+    return QByteArray();
+  }
+  return imageData;
+}
+
+//-----------------------------------------------------------------------------
+QString qSlicerJupyterViewCapture::mimeType(const QString& format)
+{
+  QString lowerCaseFormat = format.toLower();
+  if (lowerCaseFormat == "jpg")
+  {
+    lowerCaseFormat = "jpeg";
+  }
+  return QString("image/") + lowerCaseFormat;
+}
@@ -0,0 +1,81 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef __qSlicerJupyterViewCapture_h
+#define __qSlicerJupyterViewCapture_h
+
+// Qt includes
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+#include "qSlicerJupyterKernelModuleExport.h"
+
+class ctkVTKAbstractView;
+class qMRMLSliceWidget;
+class QWidget;
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+/// Utility functions for capturing and encoding view contents.
+///
+/// Images are read directly from the render window of the view, without
+/// grabbing the widget and creating Python wrappers for intermediate objects.
+class Q_SLICER_QTMODULES_JUPYTERKERNEL_EXPORT qSlicerJupyterViewCapture
+{
+public:
+  /// Find a 3D or slice view by layout label (displayed in the view's header,
+  /// such as "1", "R", "Y", "G") or by view name (such as "Red").
+  /// If layoutLabel is empty then the first 3D view is returned.
+  /// Returns nullptr if the view is not found.
+  static ctkVTKAbstractView* viewByLayoutLabel(const QString& layoutLabel);
+
+  /// Read the content of the render window of a view.
+  /// If forceRender is true then the view is rendered before reading the image.
+  static QImage captureView(ctkVTKAbstractView* view, bool forceRender = true);
+
+  /// Move the slice through a range of offsets and tile the rendered slices into a single image.
+  /// Frames are placed in row-major order, each frame is copied into the preallocated mosaic
+  /// directly from the render window (no intermediate files or image encoding).
+  /// The original slice offset is restored after capturing.
+  /// Returns null image in case of an error.
+  static QImage captureSliceSweep(qMRMLSliceWidget* sliceWidget, double startOffset, double endOffset, int rows, int columns);
+
+  /// Render the slice at the specified offset without displaying it in the view.
+  /// Buffer swapping is disabled while rendering, therefore the view keeps showing the current slice,
+  /// and the original slice offset is restored right after capturing (before any events are processed).
+  /// It allows rendering slices in advance (prefetching) while the user is browsing slices.
+  /// Returns null image in case of an error.
+  static QImage captureSliceAtOffset(qMRMLSliceWidget* sliceWidget, double offset);
+
+  /// Grab the entire view layout (all views in the viewport).
+  static QImage captureLayout();
+
+  /// Scale down the image so that neither its width nor its height is larger than maxSize.
+  /// If maxSize <= 0 then the image is returned unchanged.
+  static QImage limitSize(const QImage& image, int maxSize);
+
+  /// Encode the image in the specified file format ("PNG", "JPG", ...).
+  /// Quality is between 0-100 (-1 = default). For PNG format, lower quality means
+  /// faster encoding with less compression.
+  /// Returns empty array in case of an error.
+  static QByteArray encodeImage(const QImage& image, const QString& format, int quality = -1);
+
+  /// Get MIME type corresponding to an image file format (e.g., "JPG" -> "image/jpeg").
+  static QString mimeType(const QString& format);
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "xSlicerCellProfiler.h"
+
+// Slicer includes
+#include <qSlicerApplication.h>
+
+// MRML includes
+#include <vtkMRMLScene.h>
+
+// PythonQt includes
+#include <PythonQt.h>
+
+// On Windows, pyerrors.h redefines snprintf to _snprintf, which breaks json.hpp
+#if defined(WIN32) && defined(snprintf)
+  #undef snprintf
+#endif
+
+// STL includes
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  // Number of characters of the cell code stored in the table
+  const std::size_t code_preview_length = 80;
+
+  //----------------------------------------------------------------------------
+  double process_cpu_time_sec()
+  {
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+    {
+      return 0.0;
+    }
+    auto toSec = [](const FILETIME& time)
+      {
+      return ((static_cast<unsigned long long>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7;
+      };
+    return toSec(kernelTime) + toSec(userTime);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6
+      + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+#endif
+  }
+
+  //----------------------------------------------------------------------------
+  std::int64_t process_resident_bytes()
+  {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+      return 0;
+    }
+    return static_cast<std::int64_t>(counters.WorkingSetSize);
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+    {
+      return 0;
+    }
+    return static_cast<std::int64_t>(info.resident_size);
+#else
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file)
+    {
+      return 0;
+    }
+    long totalPages = 0;
+    long residentPages = 0;
+    int readCount = fscanf(file, "%ld %ld", &totalPages, &residentPages);
+    fclose(file);
+    if (readCount != 2)
+    {
+      return 0;
+    }
+    return static_cast<std::int64_t>(residentPages) * sysconf(_SC_PAGESIZE);
+#endif
+  }
+
+  //----------------------------------------------------------------------------
+  std::int64_t python_allocated_blocks()
+  {
+    std::int64_t blocks = 0;
+    PyGILState_STATE gilState = PyGILState_Ensure();
+    // borrowed reference
+    PyObject* getAllocatedBlocks = PySys_GetObject("getallocatedblocks");
+    if (getAllocatedBlocks)
+    {
+      PyObject* result = PyObject_CallObject(getAllocatedBlocks, nullptr);
+      if (result)
+      {
+        blocks = PyLong_AsLongLong(result);
+        Py_DECREF(result);
+      }
+    }
+    if (PyErr_Occurred())
+    {
+      PyErr_Clear();
+    }
+    PyGILState_Release(gilState);
+    return blocks;
+  }
+}
+
+//----------------------------------------------------------------------------
+xSlicerCellProfiler::snapshot xSlicerCellProfiler::takeSnapshot()
+{
+  snapshot result;
+  result.wallTime = clock::now();
+  result.cpuTimeSec = process_cpu_time_sec();
+  result.rssBytes = process_resident_bytes();
+  result.pythonAllocatedBlocks = python_allocated_blocks();
+  qSlicerApplication* app = qSlicerApplication::application();
+  vtkMRMLScene* scene = app ? app->mrmlScene() : nullptr;
+  result.mrmlNodeCount = scene ? scene->GetNumberOfNodes() : 0;
+  return result;
+}
+
+//----------------------------------------------------------------------------
+nl::json xSlicerCellProfiler::record(int executionCount, const std::string& code,
+  const snapshot& start, const snapshot& end)
+{
+  nl::json entry;
+  entry["executionCount"] = executionCount;
+  entry["code"] = code.size() > code_preview_length ? code.substr(0, code_preview_length) + "..." : code;
+  entry["wallTimeSec"] = std::chrono::duration<double>(end.wallTime - start.wallTime).count();
+  entry["cpuTimeSec"] = end.cpuTimeSec - start.cpuTimeSec;
+  entry["rssBytes"] = end.rssBytes;
+  entry["rssDeltaBytes"] = end.rssBytes - start.rssBytes;
+  entry["pythonAllocatedBlocksDelta"] = end.pythonAllocatedBlocks - start.pythonAllocatedBlocks;
+  entry["mrmlNodeCount"] = end.mrmlNodeCount;
+  entry["mrmlNodeCountDelta"] = end.mrmlNodeCount - start.mrmlNodeCount;
+  m_entries.push_back(entry);
+  while (m_entries.size() > m_maxEntries)
+  {
+    m_entries.pop_front();
+  }
+  return entry;
+}
+
+//----------------------------------------------------------------------------
+nl::json xSlicerCellProfiler::to_json() const
+{
+  nl::json entries = nl::json::array();
+  for (const nl::json& entry : m_entries)
+  {
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+//----------------------------------------------------------------------------
+void xSlicerCellProfiler::reset()
+{
+  m_entries.clear();
+}
+
+//----------------------------------------------------------------------------
+void xSlicerCellProfiler::setMaxEntries(std::size_t maxEntries)
+{
+  m_maxEntries = maxEntries;
+  while (m_entries.size() > m_maxEntries)
+  {
+    m_entries.pop_front();
+  }
+}
+
+//----------------------------------------------------------------------------
+std::size_t xSlicerCellProfiler::maxEntries() const
+{
+  return m_maxEntries;
+}
@@ -0,0 +1,61 @@
+#ifndef xSlicerCellProfiler_h
+#define xSlicerCellProfiler_h
+
+// xeus includes
+#include <xeus/xmessage.hpp>
+
+// STL includes
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+/// Measures resource usage of executed notebook cells.
+///
+/// A snapshot of process resource usage is taken before and after a cell is executed,
+/// and the differences are stored in a table (most recent entries are kept):
+/// - wallTimeSec, cpuTimeSec: elapsed real time and process CPU time (all threads)
+/// - rssDeltaBytes: change in resident memory size of the process
+/// - pythonAllocatedBlocksDelta: change in the number of memory blocks allocated by Python
+/// - mrmlNodeCountDelta: change in the number of nodes in the MRML scene
+///
+/// Taking a snapshot costs a few microseconds, therefore profiling can be left enabled
+/// even in long notebooks.
+class xSlicerCellProfiler
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct snapshot
+  {
+    clock::time_point wallTime;
+    double cpuTimeSec = 0.0;
+    std::int64_t rssBytes = 0;
+    std::int64_t pythonAllocatedBlocks = 0;
+    std::int64_t mrmlNodeCount = 0;
+  };
+
+  xSlicerCellProfiler() = default;
+
+  /// Get current resource usage. Must be called from the main thread.
+  static snapshot takeSnapshot();
+
+  /// Store resource usage of a cell execution and return the stored entry.
+  nl::json record(int executionCount, const std::string& code, const snapshot& start, const snapshot& end);
+
+  /// All stored entries, from the oldest to the most recent.
+  nl::json to_json() const;
+
+  /// Remove all stored entries.
+  void reset();
+
+  /// Maximum number of stored entries. Oldest entries are removed when the limit is reached.
+  void setMaxEntries(std::size_t maxEntries);
+  std::size_t maxEntries() const;
+
+protected:
+  std::size_t m_maxEntries = 1000;
+  std::deque<nl::json> m_entries;
+};
+
+#endif
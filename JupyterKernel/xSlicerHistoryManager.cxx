@@ -0,0 +1,445 @@
+#include "xSlicerHistoryManager.h"
+
+// Qt includes
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QtEndian>
+
+// STL includes
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+namespace
+{
+  // File header: magic, generation (incremented at each compaction), last reserved session number
+  const std::uint32_t file_magic = 0x484A4853; // "SHJH"
+  const qint64 file_header_size = 3 * sizeof(std::uint32_t);
+  // Each record: magic, session, line, input length, output length, input, output
+  const std::uint32_t record_magic = 0x524A4853; // "SHJR"
+  const qint64 record_header_size = 5 * sizeof(std::uint32_t);
+  // Other kernels hold the lock only while a record is written or a history request is answered
+  const int lock_timeout_msec = 5000;
+
+  std::uint32_t read_uint32(const uchar* data)
+  {
+    return qFromLittleEndian<std::uint32_t>(data);
+  }
+
+  QByteArray file_header(std::uint32_t generation, std::int32_t session)
+  {
+    QByteArray header(file_header_size, 0);
+    uchar* data = reinterpret_cast<uchar*>(header.data());
+    qToLittleEndian<std::uint32_t>(file_magic, data);
+    qToLittleEndian<std::uint32_t>(generation, data + 4);
+    qToLittleEndian<std::int32_t>(session, data + 8);
+    return header;
+  }
+
+  QByteArray record_header(std::int32_t session, std::int32_t line, std::uint32_t input_length, std::uint32_t output_length)
+  {
+    QByteArray header(record_header_size, 0);
+    uchar* data = reinterpret_cast<uchar*>(header.data());
+    qToLittleEndian<std::uint32_t>(record_magic, data);
+    qToLittleEndian<std::int32_t>(session, data + 4);
+    qToLittleEndian<std::int32_t>(line, data + 8);
+    qToLittleEndian<std::uint32_t>(input_length, data + 12);
+    qToLittleEndian<std::uint32_t>(output_length, data + 16);
+    return header;
+  }
+}
+
+xSlicerHistoryManager::file_lock::file_lock(const xSlicerHistoryManager& manager)
+  : m_manager(manager)
+  , m_locked(manager.m_lock_file.tryLock(lock_timeout_msec))
+{
+  if (!m_locked)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot lock history file " << m_manager.m_file_path;
+  }
+}
+
+xSlicerHistoryManager::file_lock::~file_lock()
+{
+  m_manager.unmap_file();
+  if (m_locked)
+  {
+    m_manager.m_lock_file.unlock();
+  }
+}
+
+bool xSlicerHistoryManager::file_lock::is_locked() const
+{
+  return m_locked;
+}
+
+xSlicerHistoryManager::xSlicerHistoryManager(const QString& file_path, std::size_t max_entries)
+  : m_file_path(file_path)
+  , m_file(file_path)
+  , m_lock_file(file_path + ".lock")
+  , m_max_entries(max_entries)
+{
+}
+
+xSlicerHistoryManager::~xSlicerHistoryManager()
+{
+  unmap_file();
+  m_file.close();
+}
+
+bool xSlicerHistoryManager::open()
+{
+  QDir().mkpath(QFileInfo(m_file_path).absolutePath());
+  if (!m_file.open(QIODevice::ReadWrite))
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot open history file " << m_file_path << ": " << m_file.errorString();
+    return false;
+  }
+  file_lock lock(*this);
+  if (!lock.is_locked() || !initialize_file() || !refresh())
+  {
+    return false;
+  }
+  // Reserve a session number, so that kernels that are started later use a different one
+  std::int32_t last_session = static_cast<std::int32_t>(read_uint32(m_mapped_data + 8));
+  m_session = std::max(last_session, m_index.empty() ? 0 : m_index.back().session) + 1;
+  qToLittleEndian<std::int32_t>(m_session, m_mapped_data + 8);
+  if (m_max_entries > 0 && m_index.size() > m_max_entries)
+  {
+    compact();
+  }
+  return true;
+}
+
+int xSlicerHistoryManager::session() const
+{
+  return m_session;
+}
+
+std::size_t xSlicerHistoryManager::entry_count() const
+{
+  return m_index.size();
+}
+
+void xSlicerHistoryManager::configure_impl()
+{
+}
+
+bool xSlicerHistoryManager::initialize_file()
+{
+  if (!map_file())
+  {
+    return false;
+  }
+  if (m_mapped_size >= file_header_size && read_uint32(m_mapped_data) == file_magic)
+  {
+    return true;
+  }
+  if (m_mapped_size > 0)
+  {
+    qWarning() << Q_FUNC_INFO << ": discarding invalid history file " << m_file_path;
+  }
+  unmap_file();
+  QByteArray header = file_header(0, 0);
+  if (!m_file.resize(0) || !m_file.seek(0) || m_file.write(header) != header.size() || !m_file.flush())
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot write history file " << m_file_path;
+    return false;
+  }
+  return map_file();
+}
+
+bool xSlicerHistoryManager::refresh() const
+{
+  if (!map_file() || m_mapped_size < file_header_size)
+  {
+    return false;
+  }
+  std::uint32_t generation = read_uint32(m_mapped_data + 4);
+  if (generation != m_generation || m_mapped_size < m_indexed_size)
+  {
+    // The file was compacted, offsets in the index are no longer valid
+    m_index.clear();
+    m_indexed_size = file_header_size;
+    m_generation = generation;
+  }
+  std::size_t first_new_entry = m_index.size();
+  qint64 offset = m_indexed_size;
+  while (offset + record_header_size <= m_mapped_size)
+  {
+    const uchar* header = m_mapped_data + offset;
+    if (read_uint32(header) != record_magic)
+    {
+      break;
+    }
+    index_entry entry;
+    entry.session = static_cast<std::int32_t>(read_uint32(header + 4));
+    entry.line = static_cast<std::int32_t>(read_uint32(header + 8));
+    entry.input_length = read_uint32(header + 12);
+    entry.output_length = read_uint32(header + 16);
+    entry.offset = offset + record_header_size;
+    qint64 record_end = entry.offset + entry.input_length + entry.output_length;
+    if (record_end > m_mapped_size)
+    {
+      break;
+    }
+    m_index.push_back(entry);
+    offset = record_end;
+  }
+  m_indexed_size = offset;
+  if (offset < m_mapped_size)
+  {
+    // Records are written while the file is locked, therefore this is not a record
+    // that another process is writing now, but incomplete or corrupted data.
+    qWarning() << Q_FUNC_INFO << ": discarding invalid data at the end of history file " << m_file_path;
+    unmap_file();
+    if (!m_file.resize(offset) || !map_file())
+    {
+      qWarning() << Q_FUNC_INFO << " failed: cannot truncate history file " << m_file_path;
+      return false;
+    }
+  }
+  // Records of kernels that run at the same time are interleaved in the file
+  auto entry_less = [](const index_entry& a, const index_entry& b)
+    {
+      return a.session < b.session || (a.session == b.session && a.line < b.line);
+    };
+  std::stable_sort(m_index.begin() + first_new_entry, m_index.end(), entry_less);
+  std::inplace_merge(m_index.begin(), m_index.begin() + first_new_entry, m_index.end(), entry_less);
+  return true;
+}
+
+bool xSlicerHistoryManager::compact()
+{
+  if (m_max_entries == 0 || m_index.size() <= m_max_entries || !map_file())
+  {
+    return true;
+  }
+  // Keep the most recently written records. They are stored contiguously at the end of the file,
+  // therefore they can be moved to the beginning of the file in one piece.
+  std::vector<qint64> offsets;
+  offsets.reserve(m_index.size());
+  for (const index_entry& entry : m_index)
+  {
+    offsets.push_back(entry.offset);
+  }
+  std::size_t first_kept_entry = m_index.size() - m_max_entries;
+  std::nth_element(offsets.begin(), offsets.begin() + first_kept_entry, offsets.end());
+  qint64 kept_data_start = offsets[first_kept_entry] - record_header_size;
+  qint64 kept_data_size = m_mapped_size - kept_data_start;
+
+  // The file is modified in place (instead of writing a new file and replacing the old one),
+  // so that other processes that have the file open see the change.
+  // Changed generation number in the header tells them that their index must be rebuilt.
+  memmove(m_mapped_data + file_header_size, m_mapped_data + kept_data_start, kept_data_size);
+  qToLittleEndian<std::uint32_t>(read_uint32(m_mapped_data + 4) + 1, m_mapped_data + 4);
+  // The file must be unmapped before it can be resized (on Windows)
+  unmap_file();
+  if (!m_file.resize(file_header_size + kept_data_size))
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot resize history file " << m_file_path;
+  }
+  return refresh();
+}
+
+bool xSlicerHistoryManager::map_file() const
+{
+  qint64 file_size = m_file.size();
+  if (m_mapped_data && m_mapped_size == file_size)
+  {
+    return true;
+  }
+  unmap_file();
+  if (file_size == 0)
+  {
+    return true;
+  }
+  m_mapped_data = m_file.map(0, file_size);
+  if (!m_mapped_data)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot map history file " << m_file_path << ": " << m_file.errorString();
+    return false;
+  }
+  m_mapped_size = file_size;
+  return true;
+}
+
+void xSlicerHistoryManager::unmap_file() const
+{
+  if (m_mapped_data)
+  {
+    m_file.unmap(m_mapped_data);
+  }
+  m_mapped_data = nullptr;
+  m_mapped_size = 0;
+}
+
+void xSlicerHistoryManager::store_inputs_impl(int line_num, const std::string& input, const std::string& output)
+{
+  if (!m_file.isOpen())
+  {
+    return;
+  }
+  file_lock lock(*this);
+  // Records that other processes appended are indexed before appending, so that
+  // the end of the file is known and the index remains sorted
+  if (!lock.is_locked() || !refresh())
+  {
+    return;
+  }
+  // The whole record is written at once, so that an incomplete record is only left in the file
+  // if the application crashes while writing.
+  QByteArray record = record_header(m_session, line_num,
+    static_cast<std::uint32_t>(input.size()), static_cast<std::uint32_t>(output.size()));
+  record.append(input.data(), static_cast<int>(input.size()));
+  record.append(output.data(), static_cast<int>(output.size()));
+  unmap_file();
+  if (!m_file.seek(m_indexed_size) || m_file.write(record) != record.size() || !m_file.flush())
+  {
+    qWarning() << Q_FUNC_INFO << " failed: cannot write history file " << m_file_path;
+    return;
+  }
+  if (!refresh())
+  {
+    return;
+  }
+
+  // Compact the file when it is significantly larger than the limit,
+  // to avoid rewriting the file at each input.
+  if (m_max_entries > 0 && m_index.size() > m_max_entries + m_max_entries / 2)
+  {
+    compact();
+  }
+}
+
+std::string xSlicerHistoryManager::input(const index_entry& entry) const
+{
+  if (!map_file() || entry.offset + entry.input_length > m_mapped_size)
+  {
+    return std::string();
+  }
+  return std::string(reinterpret_cast<const char*>(m_mapped_data + entry.offset), entry.input_length);
+}
+
+std::string xSlicerHistoryManager::output(const index_entry& entry) const
+{
+  qint64 output_offset = entry.offset + entry.input_length;
+  if (!map_file() || output_offset + entry.output_length > m_mapped_size)
+  {
+    return std::string();
+  }
+  return std::string(reinterpret_cast<const char*>(m_mapped_data + output_offset), entry.output_length);
+}
+
+nl::json xSlicerHistoryManager::history_item(const index_entry& entry, bool output) const
+{
+  if (output)
+  {
+    return nl::json::array({ entry.session, entry.line, nl::json::array({ input(entry), this->output(entry) }) });
+  }
+  return nl::json::array({ entry.session, entry.line, input(entry) });
+}
+
+nl::json xSlicerHistoryManager::reply(nl::json history)
+{
+  nl::json reply;
+  reply["history"] = std::move(history);
+  reply["status"] = "ok";
+  return reply;
+}
+
+nl::json xSlicerHistoryManager::get_tail_impl(int n, bool /*raw*/, bool output) const
+{
+  nl::json history = nl::json::array();
+  file_lock lock(*this);
+  if (!lock.is_locked() || !refresh())
+  {
+    return reply(std::move(history));
+  }
+  std::size_t count = n > 0 ? std::min(static_cast<std::size_t>(n), m_index.size()) : m_index.size();
+  for (auto it = m_index.end() - count; it != m_index.end(); ++it)
+  {
+    history.push_back(history_item(*it, output));
+  }
+  return reply(std::move(history));
+}
+
+nl::json xSlicerHistoryManager::get_range_impl(int session, int start, int stop, bool /*raw*/, bool output) const
+{
+  // Zero and negative session numbers are relative to the current session
+  if (session <= 0)
+  {
+    session += m_session;
+  }
+  nl::json history = nl::json::array();
+  file_lock lock(*this);
+  if (!lock.is_locked() || !refresh())
+  {
+    return reply(std::move(history));
+  }
+  // Entries are sorted by session and line number, find the first entry by binary search
+  auto it = std::lower_bound(m_index.begin(), m_index.end(), std::make_pair(session, start),
+    [](const index_entry& entry, const std::pair<int, int>& key)
+    {
+      return entry.session < key.first || (entry.session == key.first && entry.line < key.second);
+    });
+  for (; it != m_index.end() && it->session == session; ++it)
+  {
+    // stop is exclusive, non-positive value means the end of the session
+    if (stop > 0 && it->line >= stop)
+    {
+      break;
+    }
+    history.push_back(history_item(*it, output));
+  }
+  return reply(std::move(history));
+}
+
+nl::json xSlicerHistoryManager::search_impl(const std::string& pattern, bool /*raw*/, bool output, int n, bool unique) const
+{
+  QRegularExpression regex(QRegularExpression::wildcardToRegularExpression(QString::fromStdString(pattern)),
+    QRegularExpression::DotMatchesEverythingOption);
+  file_lock lock(*this);
+  if (!lock.is_locked() || !refresh())
+  {
+    return reply(nl::json::array());
+  }
+  // Search from the most recent entry and stop when enough matches are found
+  std::vector<const index_entry*> matches;
+  std::set<std::string> found_inputs;
+  for (auto it = m_index.rbegin(); it != m_index.rend(); ++it)
+  {
+    if (n > 0 && matches.size() >= static_cast<std::size_t>(n))
+    {
+      break;
+    }
+    std::string entry_input = input(*it);
+    if (!regex.match(QString::fromStdString(entry_input)).hasMatch())
+    {
+      continue;
+    }
+    if (unique && !found_inputs.insert(entry_input).second)
+    {
+      continue;
+    }
+    matches.push_back(&(*it));
+  }
+  nl::json history = nl::json::array();
+  for (auto it = matches.rbegin(); it != matches.rend(); ++it)
+  {
+    history.push_back(history_item(**it, output));
+  }
+  return reply(std::move(history));
+}
+
+std::unique_ptr<xeus::xhistory_manager> make_xSlicerHistoryManager(const QString& file_path, std::size_t max_entries)
+{
+  std::unique_ptr<xSlicerHistoryManager> history_manager(new xSlicerHistoryManager(file_path, max_entries));
+  if (!history_manager->open())
+  {
+    return nullptr;
+  }
+  return std::move(history_manager);
+}
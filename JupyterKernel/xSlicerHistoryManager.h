@@ -0,0 +1,137 @@
+#ifndef xSlicerHistoryManager_h
+#define xSlicerHistoryManager_h
+
+// xeus includes
+#include <xeus/xhistory_manager.hpp>
+
+// Qt includes
+#include <QFile>
+#include <QLockFile>
+#include <QString>
+
+// STL includes
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// History manager that stores executed inputs in a file, so that history is preserved
+/// when the kernel is restarted.
+///
+/// Inputs are appended to the file as binary records. Only a small index (session, line number,
+/// position in the file) is kept in memory and inputs are read from the memory-mapped file
+/// when they are requested. Range queries use binary search in the index.
+///
+/// The file is shared by all kernels of the same Slicer version, which may run at the same time
+/// (for example, members of a kernel pool). Each access to the file is protected by a lock file
+/// and records that other processes appended since the last access are added to the index before
+/// the file is used. Session numbers are reserved in the file header when the history is opened,
+/// therefore concurrently running kernels never use the same session number.
+///
+/// When the number of stored entries exceeds the retention cap by more than 50%,
+/// the file is compacted in place: only the most recently written entries are kept.
+/// Therefore memory and disk usage is bounded, regardless of the length of the sessions.
+class xSlicerHistoryManager : public xeus::xhistory_manager
+{
+
+public:
+
+    xSlicerHistoryManager(const QString& file_path, std::size_t max_entries);
+    virtual ~xSlicerHistoryManager();
+
+    /// Open the history file, build the index, and reserve a new session number.
+    /// Returns false if the file cannot be opened.
+    bool open();
+
+    /// Current session number (one larger than the last session that was started using the file).
+    int session() const;
+
+    /// Number of entries that are currently stored.
+    std::size_t entry_count() const;
+
+private:
+
+    struct index_entry
+    {
+        std::int32_t session;
+        std::int32_t line;
+        qint64 offset; // position of the input text in the file
+        std::uint32_t input_length;
+        std::uint32_t output_length;
+    };
+
+    /// Holds the lock of the history file while the object exists.
+    /// The file is unmapped when the lock is released, so that other processes can resize it.
+    class file_lock
+    {
+    public:
+        explicit file_lock(const xSlicerHistoryManager& manager);
+        ~file_lock();
+        bool is_locked() const;
+    private:
+        const xSlicerHistoryManager& m_manager;
+        bool m_locked;
+    };
+
+    void configure_impl() override;
+
+    void store_inputs_impl(int line_num,
+                           const std::string& input,
+                           const std::string& output) override;
+
+    nl::json get_tail_impl(int n, bool raw, bool output) const override;
+
+    nl::json get_range_impl(int session,
+                            int start,
+                            int stop,
+                            bool raw,
+                            bool output) const override;
+
+    nl::json search_impl(const std::string& pattern,
+                         bool raw,
+                         bool output,
+                         int n,
+                         bool unique) const override;
+
+    /// Write the file header if the file is new or it is not a history file.
+    /// Must be called while the file is locked.
+    bool initialize_file();
+
+    /// Add records to the index that were appended since the last call (by this or other processes).
+    /// The index is rebuilt if the file was compacted by another process. Incomplete record at
+    /// the end of the file (for example, due to application crash while writing) is removed.
+    /// Must be called while the file is locked.
+    bool refresh() const;
+
+    /// Keep only the last m_max_entries entries in the file. Must be called while the file is locked.
+    bool compact();
+
+    /// Make sure that the memory-mapped region contains the entire file.
+    bool map_file() const;
+    void unmap_file() const;
+
+    std::string input(const index_entry& entry) const;
+    std::string output(const index_entry& entry) const;
+    nl::json history_item(const index_entry& entry, bool output) const;
+    static nl::json reply(nl::json history);
+
+    QString m_file_path;
+    mutable QFile m_file;
+    mutable QLockFile m_lock_file;
+    mutable uchar* m_mapped_data = nullptr;
+    mutable qint64 m_mapped_size = 0;
+
+    // Sorted by session and line number
+    mutable std::vector<index_entry> m_index;
+    // File content up to this position is in the index
+    mutable qint64 m_indexed_size = 0;
+    // Incremented in the file header at each compaction
+    mutable std::uint32_t m_generation = 0;
+    std::size_t m_max_entries;
+    int m_session = 1;
+};
+
+/// Create a file-backed history manager. Returns nullptr if the history file cannot be opened.
+std::unique_ptr<xeus::xhistory_manager> make_xSlicerHistoryManager(const QString& file_path, std::size_t max_entries);
+
+#endif
@@ -3,13 +3,20 @@
 #include "xSlicerInterpreter.h"
 
 #include <xeus/xguid.hpp>
+#include <xeus/xhelper.hpp>
 
 #include <qSlicerApplication.h>
 #include <qSlicerPythonManager.h>
 
 #include "qSlicerJupyterKernelModule.h"
+#include "xSlicerCellProfiler.h"
+#include "xSlicerKernelStats.h"
+#include "xSlicerTrace.h"
+#include "xSlicerViewInteraction.h"
 
+#include <QDebug>
 #include <QObject>
+#include <QTimer>
 
 #include <PythonQt.h>
 
@@ -23,32 +30,79 @@ xSlicerInterpreter::xSlicerInterpreter()
   // GIL is already released, so we need to prevent
   // the interpreter from attempting to release it again.
   m_release_gil_at_startup = false;
+
+  // Output is published when no more output is received for a short time
+  // (if output keeps coming then it is published when the buffer gets old or large).
+  m_stream_flush_timer = new QTimer();
+  m_stream_flush_timer->setSingleShot(true);
+  m_stream_flush_timer->setInterval(static_cast<int>(m_stream_flush_interval.count() * 1000.0));
+  QObject::connect(m_stream_flush_timer, &QTimer::timeout, [=]() { this->flush_streams(); });
+}
+
+xSlicerInterpreter::~xSlicerInterpreter()
+{
+  m_stream_flush_timer->stop();
+  delete m_stream_flush_timer;
 }
 
 
 void xSlicerInterpreter::configure_impl()
 {
+  auto start_time = std::chrono::steady_clock::now();
   xpyt::interpreter::configure_impl();
-
-  auto handle_comm_opened = [](xeus::xcomm&& comm, const xeus::xmessage&) {
-    std::cout << "Comm opened for target: " << comm.target().name() << std::endl;
-  };
-  comm_manager().register_comm_target("echo_target", handle_comm_opened);
+  auto python_configured_time = std::chrono::steady_clock::now();
+  m_configure_times.emplace_back("pythonInterpreter",
+    std::chrono::duration<double>(python_configured_time - start_time).count());
 
   // Custom output redirection
+  // Outputs are buffered, as publishing each small piece of text separately
+  // would be very slow when a script prints many lines.
   QObject::connect(PythonQt::self(), &PythonQt::pythonStdOut,
     [=](const QString& text) {
-    publish_stream("stdout", text.toStdString());
+    buffer_stream("stdout", text.toStdString());
   });
   QObject::connect(PythonQt::self(), &PythonQt::pythonStdErr,
     [=](const QString& text) {
-    publish_stream("stderr", text.toStdString());
+    buffer_stream("stderr", text.toStdString());
   });
+  m_configure_times.emplace_back("outputRedirection",
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - python_configured_time).count());
+
+  // Comm targets and display hook are set up in configure_deferred
+}
+
+void xSlicerInterpreter::configure_deferred()
+{
+  if (m_deferred_configuration_done)
+  {
+    return;
+  }
+  m_deferred_configuration_done = true;
+  auto start_time = std::chrono::steady_clock::now();
+
+  auto handle_comm_opened = [](xeus::xcomm&& comm, const xeus::xmessage&) {
+    std::cout << "Comm opened for target: " << comm.target().name() << std::endl;
+  };
+  comm_manager().register_comm_target("echo_target", handle_comm_opened);
+
+  // Interactive views can send interaction events directly to the view,
+  // without running Python code for each event
+  m_view_interaction_target.reset(new xSlicerViewInteractionTarget(comm_manager(), m_jupyter_kernel_module));
+  auto comm_targets_time = std::chrono::steady_clock::now();
+  m_configure_times.emplace_back("commTargets",
+    std::chrono::duration<double>(comm_targets_time - start_time).count());
 
   // Custom display redirection
   // Make xeus-python display hook available as slicer.xeusPythonDisplayHook
   py::module slicer_module = py::module::import("slicer");
   slicer_module.attr("xeusPythonDisplayHook") = m_displayhook;
+  m_configure_times.emplace_back("displayHook",
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - comm_targets_time).count());
+}
+
+const std::vector<std::pair<std::string, double>>& xSlicerInterpreter::configure_times() const
+{
+  return m_configure_times;
 }
 
 void xSlicerInterpreter::execute_request_impl(send_reply_callback cb,
@@ -84,9 +138,46 @@ void xSlicerInterpreter::execute_request_impl(send_reply_callback cb,
     result["status"] = "ok";
     // TODO: publish data and report result
   }
+  else if (qscode.endsWith(QString("__kernel_profile_enable()")))
+  {
+    set_cell_profiling(true);
+    publish_execution_result(execution_counter,
+      { { "text/plain", "Cell profiling enabled. Results: slicer.modules.jupyterkernel.cellProfiles()" } }, nl::json::object());
+    cb(xeus::create_successful_reply());
+  }
+  else if (qscode.endsWith(QString("__kernel_profile_disable()")))
+  {
+    set_cell_profiling(false);
+    publish_execution_result(execution_counter, { { "text/plain", "Cell profiling disabled." } }, nl::json::object());
+    cb(xeus::create_successful_reply());
+  }
   else
   {
-    return xpyt::interpreter::execute_request_impl(cb, execution_counter, code, config, user_expressions);
+    bool profiling = m_cell_profiling && m_cell_profiler;
+    xSlicerCellProfiler::snapshot profile_start;
+    if (profiling)
+    {
+      profile_start = xSlicerCellProfiler::takeSnapshot();
+    }
+    // Make sure all outputs are published before the reply is sent
+    auto flushing_cb = [this, cb, profiling, profile_start, execution_counter, code](nl::json reply)
+    {
+      flush_streams();
+      if (profiling)
+      {
+        // The server moves this item from the reply content to the reply metadata
+        reply["slicer_profile"] = m_cell_profiler->record(execution_counter, code,
+          profile_start, xSlicerCellProfiler::takeSnapshot());
+      }
+      cb(std::move(reply));
+    };
+    XSLICER_TRACE_SCOPE("interpreter", "execute_request");
+    auto start_time = xSlicerKernelStats::clock::now();
+    xpyt::interpreter::execute_request_impl(flushing_cb, execution_counter, code, config, user_expressions);
+    if (m_kernel_stats)
+    {
+      m_kernel_stats->record("interpreter", "execute_request", start_time, code.size());
+    }
   }
 }
 
@@ -101,7 +192,18 @@ nl::json xSlicerInterpreter::complete_request_impl(const std::string& code,
     std::cout << std::endl;
   }
 
-  return xpyt::interpreter::complete_request_impl(code, cursor_pos);
+  XSLICER_TRACE_SCOPE("interpreter", "complete_request");
+  auto start_time = xSlicerKernelStats::clock::now();
+  nl::json reply;
+  if (!indexed_reply("complete", code, cursor_pos, 0, reply))
+  {
+    reply = xpyt::interpreter::complete_request_impl(code, cursor_pos);
+  }
+  if (m_kernel_stats)
+  {
+    m_kernel_stats->record("interpreter", "complete_request", start_time, code.size());
+  }
+  return reply;
 }
 
 nl::json xSlicerInterpreter::inspect_request_impl(const std::string& code,
@@ -117,7 +219,46 @@ nl::json xSlicerInterpreter::inspect_request_impl(const std::string& code,
     std::cout << std::endl;
   }
 
-  return xpyt::interpreter::inspect_request_impl(code, cursor_pos, detail_level);
+  XSLICER_TRACE_SCOPE("interpreter", "inspect_request");
+  auto start_time = xSlicerKernelStats::clock::now();
+  nl::json reply;
+  if (!indexed_reply("inspect", code, cursor_pos, detail_level, reply))
+  {
+    reply = xpyt::interpreter::inspect_request_impl(code, cursor_pos, detail_level);
+  }
+  if (m_kernel_stats)
+  {
+    m_kernel_stats->record("interpreter", "inspect_request", start_time, code.size());
+  }
+  return reply;
+}
+
+bool xSlicerInterpreter::indexed_reply(const char* function_name, const std::string& code,
+  int cursor_pos, int detail_level, nl::json& reply)
+{
+  bool found = false;
+  PyGILState_STATE gil_state = PyGILState_Ensure();
+  try
+  {
+    // The index module is imported by kernel-configure.py, do not import it here
+    // to avoid delaying the response while the module is loaded
+    py::dict modules = py::module::import("sys").attr("modules");
+    if (modules.contains("kernel_completion_index"))
+    {
+      py::object result = modules["kernel_completion_index"].attr(function_name)(code, cursor_pos, detail_level);
+      if (!result.is_none())
+      {
+        reply = nl::json::parse(result.cast<std::string>());
+        found = true;
+      }
+    }
+  }
+  catch (const std::exception& e)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: " << e.what();
+  }
+  PyGILState_Release(gil_state);
+  return found;
 }
 
 nl::json xSlicerInterpreter::is_complete_request_impl(const std::string& code)
@@ -144,6 +285,7 @@ void xSlicerInterpreter::shutdown_request_impl()
     std::cout << "Received shutdown_request" << std::endl;
     std::cout << std::endl;
   }
+  flush_streams();
   return xpyt::interpreter::shutdown_request_impl();
 }
 
@@ -151,3 +293,140 @@ void xSlicerInterpreter::set_jupyter_kernel_module(qSlicerJupyterKernelModule* m
 {
   m_jupyter_kernel_module = module;
 }
+
+void xSlicerInterpreter::set_kernel_stats(xSlicerKernelStats* stats)
+{
+  m_kernel_stats = stats;
+}
+
+void xSlicerInterpreter::set_cell_profiler(xSlicerCellProfiler* profiler)
+{
+  m_cell_profiler = profiler;
+}
+
+void xSlicerInterpreter::set_cell_profiling(bool enabled)
+{
+  m_cell_profiling = enabled;
+}
+
+bool xSlicerInterpreter::cell_profiling() const
+{
+  return m_cell_profiling;
+}
+
+void xSlicerInterpreter::buffer_stream(const std::string& name, const std::string& text)
+{
+  if (!accept_stream_data(text.size()))
+  {
+    return;
+  }
+  if (!m_stream_buffer.empty() && name != m_stream_buffer_name)
+  {
+    // Keep the order of stdout and stderr outputs
+    flush_streams();
+  }
+  if (m_stream_buffer.empty())
+  {
+    m_stream_buffer_name = name;
+  }
+  m_stream_buffer += text;
+
+  // Output is published immediately if nothing was published recently, so that a single
+  // message (e.g., "Loading...") appears without delay, even if the cell then runs for a long time
+  // without printing anything. Only outputs that follow within the flush interval are coalesced.
+  // The event loop is not running while a cell is executed, therefore the flush timer
+  // is not triggered during execution, but remaining outputs are published
+  // at the next output after the interval or at the end of execution.
+  if (m_stream_buffer.size() >= m_stream_buffer_max_size
+    || std::chrono::steady_clock::now() - m_stream_last_publish_time >= m_stream_flush_interval)
+  {
+    flush_streams();
+  }
+  else if (!m_stream_flush_timer->isActive())
+  {
+    m_stream_flush_timer->start();
+  }
+}
+
+void xSlicerInterpreter::flush_streams()
+{
+  m_stream_flush_timer->stop();
+  if (m_stream_buffer.empty())
+  {
+    return;
+  }
+  // Clear the buffer before publishing, as publishing triggers flush_streams() call
+  std::string name;
+  std::string text;
+  name.swap(m_stream_buffer_name);
+  text.swap(m_stream_buffer);
+  m_stream_last_publish_time = std::chrono::steady_clock::now();
+  publish_stream(name, text);
+}
+
+bool xSlicerInterpreter::accept_stream_data(std::size_t size)
+{
+  if (m_iopub_data_rate_limit <= 0.0)
+  {
+    return true;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (now - m_iopub_rate_window_start >= std::chrono::seconds(1))
+  {
+    m_iopub_rate_window_start = now;
+    m_iopub_rate_window_bytes = 0.0;
+    m_iopub_rate_limited = false;
+  }
+  if (m_iopub_rate_window_bytes + size > m_iopub_data_rate_limit)
+  {
+    if (!m_iopub_rate_limited)
+    {
+      m_iopub_rate_limited = true;
+      flush_streams();
+      publish_stream("stderr", "IOPub data rate exceeded. Output is truncated.\n"
+        "To change the limit, set slicer.modules.jupyterkernel.iopubDataRateLimit "
+        "(in bytes/sec, 0 means unlimited).\n");
+    }
+    return false;
+  }
+  m_iopub_rate_window_bytes += size;
+  return true;
+}
+
+void xSlicerInterpreter::set_stream_flush_interval(double interval_sec)
+{
+  m_stream_flush_interval = std::chrono::duration<double>(interval_sec);
+  m_stream_flush_timer->setInterval(static_cast<int>(interval_sec * 1000.0));
+}
+
+double xSlicerInterpreter::stream_flush_interval() const
+{
+  return m_stream_flush_interval.count();
+}
+
+void xSlicerInterpreter::set_iopub_data_rate_limit(double bytes_per_sec)
+{
+  m_iopub_data_rate_limit = bytes_per_sec;
+}
+
+double xSlicerInterpreter::iopub_data_rate_limit() const
+{
+  return m_iopub_data_rate_limit;
+}
+
+void xSlicerInterpreter::publish_image(const QByteArray& image_data, const std::string& mime_type,
+  int width, int height)
+{
+  XSLICER_TRACE_SCOPE("publish", mime_type);
+  // Jupyter clients expect images to be base64-encoded in the JSON message content
+  // (binary buffers are not rendered by frontends for display_data messages).
+  QByteArray encoded_data = image_data.toBase64();
+  nl::json data;
+  data[mime_type] = std::string(encoded_data.constData(), encoded_data.size());
+  nl::json metadata = nl::json::object();
+  if (width > 0 && height > 0)
+  {
+    metadata[mime_type] = { { "width", width }, { "height", height } };
+  }
+  display_data(std::move(data), std::move(metadata), nl::json::object());
+}
@@ -5,11 +5,22 @@
 
 #include <xeus-python/xinterpreter.hpp>
 
+#include <QByteArray>
 #include <QStringList>
 
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 //using xpyt::interpreter;
 
+class QTimer;
 class qSlicerJupyterKernelModule;
+class xSlicerCellProfiler;
+class xSlicerKernelStats;
+class xSlicerViewInteractionTarget;
 
 class xSlicerInterpreter : public xpyt::interpreter
 {
@@ -17,12 +28,61 @@ class xSlicerInterpreter : public xpyt::interpreter
 public:
 
     xSlicerInterpreter();
-    virtual ~xSlicerInterpreter() = default;
+    virtual ~xSlicerInterpreter();
 
     void set_jupyter_kernel_module(qSlicerJupyterKernelModule* module);
 
+    /// Set object that collects timing statistics (not owned by the interpreter).
+    void set_kernel_stats(xSlicerKernelStats* stats);
+
+    /// Set object that stores resource usage of executed cells (not owned by the interpreter).
+    void set_cell_profiler(xSlicerCellProfiler* profiler);
+
+    /// If enabled then resource usage of each executed cell is recorded in the cell profiler
+    /// and added to the execute_reply metadata (in "slicer_profile" item).
+    /// Can be also enabled/disabled by executing __kernel_profile_enable() / __kernel_profile_disable().
+    void set_cell_profiling(bool enabled);
+    bool cell_profiling() const;
+
+    /// Publish all buffered stdout/stderr output.
+    /// Must be called before any other message is published on IOPub
+    /// to preserve output order.
+    void flush_streams();
+
+    /// Output is published immediately if no output was published within this interval,
+    /// otherwise it is buffered and published when the interval has elapsed.
+    void set_stream_flush_interval(double interval_sec);
+    double stream_flush_interval() const;
+
+    /// Maximum number of stdout/stderr bytes published per second.
+    /// Additional output is discarded, to prevent a runaway output from freezing the web browser.
+    /// Set to 0 to disable the limit.
+    void set_iopub_data_rate_limit(double bytes_per_sec);
+    double iopub_data_rate_limit() const;
+
+    /// Publish an already encoded image (PNG, JPEG, ...) as display data.
+    /// The image is base64-encoded directly into the message, without creating
+    /// intermediate Python objects. Optionally, image size can be specified
+    /// so that the notebook can reserve space for the image before it is decoded.
+    void publish_image(const QByteArray& image_data, const std::string& mime_type,
+      int width = 0, int height = 0);
+
+    /// Complete initialization steps that are not needed for answering the first
+    /// kernel_info request (comm targets, display hook). Does nothing if it has been already done.
+    void configure_deferred();
+
+    /// Durations of configuration steps in seconds, in the order they were performed.
+    const std::vector<std::pair<std::string, double>>& configure_times() const;
+
 private:
 
+    /// Add text to the output buffer. Buffer is published when it gets large or old,
+    /// or another message is published.
+    void buffer_stream(const std::string& name, const std::string& text);
+
+    /// Returns false if publishing this amount of data would exceed the IOPub data rate limit.
+    bool accept_stream_data(std::size_t size);
+
     void configure_impl() override;
 
     void execute_request_impl(send_reply_callback cb,
@@ -40,12 +100,37 @@ private:
 
     nl::json is_complete_request_impl(const std::string& code) override;
 
+    /// Answer complete/inspect request from the code completion index (see kernel_completion_index.py).
+    /// Returns false if the index cannot answer the request (index is not available yet,
+    /// or the code refers to an object that is not indexed, such as a user variable).
+    bool indexed_reply(const char* function_name, const std::string& code,
+                       int cursor_pos, int detail_level, nl::json& reply);
+
     nl::json kernel_info_request_impl() override;
 
     void shutdown_request_impl() override;
 
     bool m_print_debug_output = false;
     qSlicerJupyterKernelModule* m_jupyter_kernel_module = nullptr;
+    xSlicerKernelStats* m_kernel_stats = nullptr;
+    xSlicerCellProfiler* m_cell_profiler = nullptr;
+    bool m_cell_profiling = false;
+    std::unique_ptr<xSlicerViewInteractionTarget> m_view_interaction_target;
+    bool m_deferred_configuration_done = false;
+    std::vector<std::pair<std::string, double>> m_configure_times;
+
+    std::string m_stream_buffer_name;
+    std::string m_stream_buffer;
+    std::size_t m_stream_buffer_max_size = 64 * 1024;
+    // Time when buffered output was last published (outputs are coalesced within the flush interval)
+    std::chrono::steady_clock::time_point m_stream_last_publish_time;
+    std::chrono::duration<double> m_stream_flush_interval = std::chrono::milliseconds(5);
+    QTimer* m_stream_flush_timer = nullptr;
+
+    double m_iopub_data_rate_limit = 0.0;
+    std::chrono::steady_clock::time_point m_iopub_rate_window_start;
+    double m_iopub_rate_window_bytes = 0.0;
+    bool m_iopub_rate_limited = false;
 };
 
 #endif
@@ -0,0 +1,136 @@
+#include "xSlicerKernelStats.h"
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------
+void xSlicerKernelStats::histogram::add(double durationSec, std::size_t messageBytes)
+{
+  double durationUsec = durationSec * 1e6;
+  int bin = 0;
+  if (durationUsec >= 1.0)
+  {
+    bin = std::min(NumberOfBins - 1, static_cast<int>(BinsPerOctave * std::log2(durationUsec)) + 1);
+  }
+  ++this->bins[bin];
+  ++this->count;
+  this->bytes += messageBytes;
+  this->sum += durationSec;
+  this->max = std::max(this->max, durationSec);
+}
+
+//----------------------------------------------------------------------------
+double xSlicerKernelStats::histogram::percentile(double fraction) const
+{
+  if (this->count == 0)
+  {
+    return 0.0;
+  }
+  std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(fraction * this->count));
+  std::uint64_t cumulativeCount = 0;
+  for (int bin = 0; bin < NumberOfBins; ++bin)
+  {
+    cumulativeCount += this->bins[bin];
+    if (cumulativeCount >= rank)
+    {
+      // Report upper edge of the bin (the error is less than 20%)
+      double upperEdgeSec = std::pow(2.0, static_cast<double>(bin) / BinsPerOctave) * 1e-6;
+      return std::min(upperEdgeSec, this->max);
+    }
+  }
+  return this->max;
+}
+
+//----------------------------------------------------------------------------
+void xSlicerKernelStats::record(const std::string& stage, const std::string& messageType,
+  double durationSec, std::size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_histograms[stage][messageType].add(durationSec, bytes);
+}
+
+//----------------------------------------------------------------------------
+void xSlicerKernelStats::record(const std::string& stage, const std::string& messageType,
+  clock::time_point startTime, std::size_t bytes)
+{
+  std::chrono::duration<double> duration = clock::now() - startTime;
+  this->record(stage, messageType, duration.count(), bytes);
+}
+
+//----------------------------------------------------------------------------
+void xSlicerKernelStats::reset()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_histograms.clear();
+}
+
+//----------------------------------------------------------------------------
+nl::json xSlicerKernelStats::to_json() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  nl::json result = nl::json::object();
+  for (const auto& stage : m_histograms)
+  {
+    nl::json stageStats = nl::json::object();
+    for (const auto& messageType : stage.second)
+    {
+      const histogram& h = messageType.second;
+      nl::json stats;
+      stats["count"] = h.count;
+      stats["bytes"] = h.bytes;
+      stats["mean"] = h.count > 0 ? h.sum / h.count : 0.0;
+      stats["max"] = h.max;
+      stats["p50"] = h.percentile(0.50);
+      stats["p95"] = h.percentile(0.95);
+      stats["p99"] = h.percentile(0.99);
+      stageStats[messageType.first] = stats;
+    }
+    result[stage.first] = stageStats;
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------
+std::size_t xSlicerKernelStats::estimated_size(const nl::json& content)
+{
+  switch (content.type())
+  {
+  case nl::json::value_t::string:
+    return content.get_ref<const std::string&>().size();
+  case nl::json::value_t::object:
+    {
+    std::size_t size = 0;
+    for (auto it = content.begin(); it != content.end(); ++it)
+    {
+      size += it.key().size() + estimated_size(it.value());
+    }
+    return size;
+    }
+  case nl::json::value_t::array:
+    {
+    std::size_t size = 0;
+    for (const auto& item : content)
+    {
+      size += estimated_size(item);
+    }
+    return size;
+    }
+  case nl::json::value_t::binary:
+    return content.get_binary().size();
+  default:
+    // numbers, booleans, null
+    return 8;
+  }
+}
+
+//----------------------------------------------------------------------------
+std::size_t xSlicerKernelStats::estimated_size(const xeus::buffer_sequence& buffers)
+{
+  std::size_t size = 0;
+  for (const auto& buffer : buffers)
+  {
+    size += buffer.size();
+  }
+  return size;
+}
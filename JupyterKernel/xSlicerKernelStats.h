@@ -0,0 +1,76 @@
+#ifndef xSlicerKernelStats_h
+#define xSlicerKernelStats_h
+
+// xeus includes
+#include <xeus/xmessage.hpp>
+
+// STL includes
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+/// Collects timing and size statistics of the messages processed by the kernel.
+///
+/// Durations are accumulated in histograms with logarithmic bins (4 bins per octave,
+/// starting at 1 microsecond), separately for each processing stage and message type.
+/// Recording a value is a constant-time operation, therefore statistics
+/// collection can be left enabled all the time.
+///
+/// Stages recorded by the kernel:
+/// - queue: time from receiving a message until starting to process it
+/// - handler: time spent processing the message (from dispatch start to dispatch end)
+/// - reply: time from receiving a message until the reply is sent
+/// - interpreter: time spent in the interpreter (executing code, completion, inspection)
+/// - iopub: time spent handing over IOPub messages to the publisher thread
+class xSlicerKernelStats
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  xSlicerKernelStats() = default;
+
+  /// Add a new measurement.
+  void record(const std::string& stage, const std::string& messageType,
+    double durationSec, std::size_t bytes = 0);
+
+  /// Add a new measurement, with duration computed from a start time point.
+  void record(const std::string& stage, const std::string& messageType,
+    clock::time_point startTime, std::size_t bytes = 0);
+
+  /// Remove all measurements.
+  void reset();
+
+  /// Get statistics of all stages and message types:
+  /// {stage: {messageType: {count, bytes, mean, max, p50, p95, p99}}}
+  /// All durations are in seconds.
+  nl::json to_json() const;
+
+  /// Approximate size of a message payload, in bytes.
+  /// It is much cheaper to compute than the serialized message size.
+  static std::size_t estimated_size(const nl::json& content);
+  static std::size_t estimated_size(const xeus::buffer_sequence& buffers);
+
+protected:
+  static const int NumberOfBins = 128;
+  static const int BinsPerOctave = 4;
+
+  struct histogram
+  {
+    std::array<std::uint64_t, NumberOfBins> bins = {};
+    std::uint64_t count = 0;
+    std::uint64_t bytes = 0;
+    double sum = 0.0;
+    double max = 0.0;
+
+    void add(double durationSec, std::size_t bytes);
+    double percentile(double fraction) const;
+  };
+
+  mutable std::mutex m_mutex;
+  std::map<std::string, std::map<std::string, histogram>> m_histograms;
+};
+
+#endif
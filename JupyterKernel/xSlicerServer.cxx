@@ -4,22 +4,55 @@
 #include <qSlicerApplication.h>
 #include <qSlicerModuleManager.h>
 #include "qSlicerJupyterKernelModule.h"
+#include "xSlicerTrace.h"
 
 // STL includes
+#include <algorithm>
+#include <iterator>
 #include <memory>
 #include <thread>
 
 // zmq includes
 #include <zmq_addon.hpp>
 
+// xeus includes
+#include <xeus/xmessage.hpp>
+#include <xeus-zmq/xzmq_serializer.hpp>
+
+// PythonQt includes (for PyErr_SetInterrupt)
+#include <PythonQt.h>
+
+// On Windows, pyerrors.h redefines snprintf to _snprintf, which breaks json.hpp
+#if defined(WIN32) && defined(snprintf)
+  #undef snprintf
+#endif
+
 // Qt includes
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QTimer>
 
 xSlicerServer::xSlicerServer(xeus::xcontext& context,
                            const xeus::xconfiguration& c,
                            nl::json::error_handler_t eh)
     : xserver_zmq(context, c, eh)
+    , m_pollMode(PollModeSocketNotifier)
+    , m_polling(false)
+    , m_batchTimeBudgetSec(0.1)
+    , m_commMessageCoalescing(false)
+    , m_lastBatchSize(0)
+    , m_maxBatchSize(0)
+    , m_coalescedMessageCount(0)
+    , m_kernelStats(nullptr)
+    , m_controlWatcherEnabled(true)
+    , m_controlWatcherActive(false)
+    , m_executeDepth(0)
+    // Only inproc sockets are used in this context, therefore no I/O threads are needed
+    , m_controlWatcherContext(0)
+    , m_interruptCount(0)
+    , m_interruptDelivered(false)
+    , m_authentication(xeus::make_xauthentication(c.m_signature_scheme, c.m_key))
+    , m_errorHandler(eh)
 {
   // 10ms interval is short enough so that users will not notice significant latency
   // yet it is long enough to minimize CPU load caused by polling.
@@ -27,11 +60,15 @@ xSlicerServer::xSlicerServer(xeus::xcontext& context,
   m_pollTimer = new QTimer();
   m_pollTimer->setInterval(10);
   QObject::connect(m_pollTimer, &QTimer::timeout, [=]() { this->poll(); });
+
+  // Server is created in the main thread
+  xSlicerTrace::instance().setCurrentThreadName("Main thread");
 }
 
 xSlicerServer::~xSlicerServer()
 {
-  m_pollTimer->stop();
+  terminateControlWatcher();
+  stopPolling();
   delete m_pollTimer;
 }
 
@@ -45,14 +82,17 @@ void xSlicerServer::start_impl(xeus::xpub_message msg)
 
     publish(std::move(msg), xeus::channel::SHELL);
 
-    m_pollTimer->start();
+    startPolling();
 }
 
 void xSlicerServer::stop_impl()
 {
   qDebug() << "Stopping Jupyter kernel server";
   //this->xserver_zmq::stop_impl();
-  m_pollTimer->stop();
+  // Shutdown may be processed while a cell is executed (from processEvents),
+  // the watcher thread must not use the control socket after channels are stopped.
+  terminateControlWatcher();
+  stopPolling();
   stop_channels();
   std::this_thread::sleep_for(std::chrono::milliseconds(50));
 
@@ -81,18 +121,655 @@ double xSlicerServer::pollIntervalSec()
   return m_pollTimer->interval() / 1000.0;
 }
 
+void xSlicerServer::setPollMode(PollMode mode)
+{
+  if (mode == m_pollMode)
+  {
+    return;
+  }
+  bool wasPolling = m_polling;
+  if (wasPolling)
+  {
+    stopPolling();
+  }
+  m_pollMode = mode;
+  if (wasPolling)
+  {
+    startPolling();
+  }
+}
+
+xSlicerServer::PollMode xSlicerServer::pollMode() const
+{
+  return m_pollMode;
+}
+
+void xSlicerServer::startPolling()
+{
+  m_polling = true;
+  if (m_pollMode == PollModeTimer)
+  {
+    m_pollTimer->start();
+    return;
+  }
+
+  zmq::socket_t* sockets[] = { &get_shell_socket(), &get_control_socket() };
+  for (zmq::socket_t* socket : sockets)
+  {
+    // Notifiers may be deleted while one of them is emitting activated signal
+    // (e.g., when shutdown request is processed), therefore use deleteLater.
+    socket_notifier_ptr notifier(new QSocketNotifier(socket->get(zmq::sockopt::fd), QSocketNotifier::Read), &QObject::deleteLater);
+    QSocketNotifier* notifierPtr = notifier.data();
+    QObject::connect(notifierPtr, &QSocketNotifier::activated, [=]() { this->onSocketNotifierActivated(notifierPtr); });
+    m_socketNotifiers.append(notifier);
+  }
+
+  // Messages that arrived before the notifiers were created would not
+  // trigger a notification, therefore process them now.
+  if (hasPendingMessages())
+  {
+    QTimer::singleShot(0, [=]() { this->onSocketNotifierActivated(nullptr); });
+  }
+}
+
+void xSlicerServer::stopPolling()
+{
+  m_polling = false;
+  m_pollTimer->stop();
+  m_socketNotifiers.clear();
+}
+
+void xSlicerServer::setBatchTimeBudgetSec(double budgetSec)
+{
+  m_batchTimeBudgetSec = budgetSec;
+}
+
+double xSlicerServer::batchTimeBudgetSec() const
+{
+  return m_batchTimeBudgetSec;
+}
+
+void xSlicerServer::setCommMessageCoalescing(bool enable)
+{
+  m_commMessageCoalescing = enable;
+}
+
+bool xSlicerServer::commMessageCoalescing() const
+{
+  return m_commMessageCoalescing;
+}
+
+int xSlicerServer::pendingMessageCount() const
+{
+  return static_cast<int>(m_pendingMessages.size());
+}
+
+int xSlicerServer::lastBatchSize() const
+{
+  return m_lastBatchSize;
+}
+
+int xSlicerServer::maxBatchSize() const
+{
+  return m_maxBatchSize;
+}
+
+int xSlicerServer::coalescedMessageCount() const
+{
+  return m_coalescedMessageCount;
+}
+
+void xSlicerServer::setKernelStats(xSlicerKernelStats* stats)
+{
+  m_kernelStats = stats;
+}
+
+void xSlicerServer::setIOPubFlushCallback(std::function<void()> callback)
+{
+  m_iopubFlushCallback = callback;
+}
+
+void xSlicerServer::setDeferredInitializationCallback(std::function<void()> callback)
+{
+  m_deferredInitializationCallback = callback;
+}
+
+void xSlicerServer::runDeferredInitialization()
+{
+  if (!m_deferredInitializationCallback)
+  {
+    return;
+  }
+  // Clear the callback before calling it, to make sure it runs only once
+  std::function<void()> callback;
+  callback.swap(m_deferredInitializationCallback);
+  callback();
+}
+
+void xSlicerServer::setControlWatcherEnabled(bool enable)
+{
+  m_controlWatcherEnabled = enable;
+}
+
+bool xSlicerServer::controlWatcherEnabled() const
+{
+  return m_controlWatcherEnabled;
+}
+
+int xSlicerServer::interruptCount() const
+{
+  return m_interruptCount;
+}
+
+bool xSlicerServer::hasPendingMessages()
+{
+  // Reading ZMQ_EVENTS also resets the edge-triggered ZMQ_FD state
+  if (get_shell_socket().get(zmq::sockopt::events) & ZMQ_POLLIN)
+  {
+    return true;
+  }
+  // ZMQ sockets are not thread-safe, the control socket is only accessed by its current owner
+  return !m_controlWatcherActive && (get_control_socket().get(zmq::sockopt::events) & ZMQ_POLLIN);
+}
+
+void xSlicerServer::onSocketNotifierActivated(QSocketNotifier* notifier)
+{
+  if (!m_polling || m_pollMode != PollModeSocketNotifier)
+  {
+    return;
+  }
+  if (notifier)
+  {
+    // Do not re-enter while the queue is drained (message processing may
+    // call processEvents, which could deliver the notification again).
+    notifier->setEnabled(false);
+  }
+
+  poll();
+
+  // Message processing may have stopped the server
+  if (!m_polling)
+  {
+    return;
+  }
+  if (!m_pendingMessages.empty())
+  {
+    // Time budget is used up, let the application process other events
+    // and then continue with the remaining messages.
+    QTimer::singleShot(0, [=]() { this->onSocketNotifierActivated(nullptr); });
+  }
+  if (notifier)
+  {
+    notifier->setEnabled(true);
+  }
+}
+
 void xSlicerServer::poll()
 {
-  auto msg = poll_channels(-1);
-  if (msg)
+  auto pollStartTime = xSlicerTrace::clock::now();
+  QElapsedTimer batchTimer;
+  batchTimer.start();
+  const qint64 budgetMsec = static_cast<qint64>(m_batchTimeBudgetSec * 1000.0);
+  int batchSize = 0;
+  readPendingMessages();
+  while (!m_pendingMessages.empty())
   {
-    if (msg.value().second == xeus::channel::SHELL)
+    ++batchSize;
+    dispatch(takeNextMessage());
+    if (!m_polling || batchTimer.elapsed() > budgetMsec)
     {
-      notify_shell_listener(std::move(msg.value().first));
+      break;
+    }
+    // Pick up messages that arrived while the previous one was processed,
+    // so that a control message can overtake queued shell messages.
+    readPendingMessages();
+  }
+  m_lastBatchSize = batchSize;
+  m_maxBatchSize = std::max(m_maxBatchSize, batchSize);
+  // Empty polls (every few milliseconds) would just fill up the trace buffer
+  if (batchSize > 0 && xSlicerTrace::instance().isEnabled())
+  {
+    xSlicerTrace::instance().addEvent("server", "poll (" + std::to_string(batchSize) + " messages)",
+      pollStartTime, xSlicerTrace::clock::now());
+  }
+}
+
+void xSlicerServer::readPendingMessages()
+{
+  if (m_controlWatcherActive)
+  {
+    // poll_channels would read the control socket, too
+    while (readMessage(get_shell_socket(), xeus::channel::SHELL))
+    {
+    }
+    return;
+  }
+  while (hasPendingMessages())
+  {
+    auto msg = poll_channels(0);
+    if (!msg)
+    {
+      break;
+    }
+    m_pendingMessages.push_back({ std::move(msg.value().first), msg.value().second, xSlicerKernelStats::clock::now() });
+  }
+}
+
+bool xSlicerServer::readMessage(zmq::socket_t& socket, xeus::channel channel)
+{
+  zmq::multipart_t wireMessage;
+  if (!wireMessage.recv(socket, ZMQ_DONTWAIT))
+  {
+    return false;
+  }
+  try
+  {
+    xeus::xmessage message = xeus::xzmq_serializer::deserialize(wireMessage, *m_authentication);
+    m_pendingMessages.push_back({ std::move(message), channel, xSlicerKernelStats::clock::now() });
+  }
+  catch (const std::exception& e)
+  {
+    qWarning() << Q_FUNC_INFO << " failed: invalid message received: " << e.what();
+  }
+  return true;
+}
+
+void xSlicerServer::dispatch(channel_message msg)
+{
+  const nl::json& header = msg.message.header();
+  std::string msgType = header.value("msg_type", "");
+  XSLICER_TRACE_SCOPE("server", msgType);
+  if (!m_kernelStats)
+  {
+    notifyListener(msg, msgType);
+    return;
+  }
+
+  m_kernelStats->record("queue", msgType, msg.receivedTime,
+    xSlicerKernelStats::estimated_size(msg.message.content())
+    + xSlicerKernelStats::estimated_size(msg.message.buffers()));
+  m_dispatchedMessages.push_back({ header.value("msg_id", ""), msgType, msg.receivedTime });
+
+  auto dispatchStartTime = xSlicerKernelStats::clock::now();
+  notifyListener(msg, msgType);
+  m_kernelStats->record("handler", msgType, dispatchStartTime);
+  m_dispatchedMessages.pop_back();
+}
+
+void xSlicerServer::notifyListener(channel_message& msg, const std::string& msgType)
+{
+  if (m_deferredInitializationCallback)
+  {
+    if (msgType == "kernel_info_request")
+    {
+      // Reply first, so that the notebook shows the kernel as ready,
+      // then complete the initialization when control returns to the event loop.
+      QTimer::singleShot(0, m_pollTimer, [this]() { this->runDeferredInitialization(); });
     }
     else
     {
-      notify_control_listener(std::move(msg.value().first));
+      runDeferredInitialization();
+    }
+  }
+  if (msg.channel == xeus::channel::CONTROL)
+  {
+    if (msgType == "interrupt_request")
+    {
+      // Interrupt requests that arrive while a cell is executed are handled by the control watcher.
+      // Nothing is running now, so there is nothing to interrupt.
+      send_control(makeReply(msg.message, "interrupt_reply", { { "status", "ok" } }));
+      return;
+    }
+    notify_control_listener(std::move(msg.message));
+    return;
+  }
+
+  bool watchExecution = m_controlWatcherEnabled && msgType == "execute_request";
+  if (watchExecution && m_executeDepth++ == 0)
+  {
+    startControlWatcher();
+  }
+  try
+  {
+    notify_shell_listener(std::move(msg.message));
+  }
+  catch (...)
+  {
+    if (watchExecution && --m_executeDepth == 0)
+    {
+      stopControlWatcher();
+    }
+    throw;
+  }
+  if (watchExecution && --m_executeDepth == 0)
+  {
+    stopControlWatcher();
+  }
+}
+
+void xSlicerServer::startControlWatcher()
+{
+  if (m_controlWatcherActive)
+  {
+    return;
+  }
+  if (!m_controlWatcherThread.joinable())
+  {
+    const char* commandAddress = "inproc://control-watcher";
+    m_controlWatcherCommandSocket = zmq::socket_t(m_controlWatcherContext, zmq::socket_type::pair);
+    m_controlWatcherCommandSocket.set(zmq::sockopt::linger, 0);
+    m_controlWatcherCommandSocket.bind(commandAddress);
+    m_controlWatcherThreadSocket = zmq::socket_t(m_controlWatcherContext, zmq::socket_type::pair);
+    m_controlWatcherThreadSocket.set(zmq::sockopt::linger, 0);
+    m_controlWatcherThreadSocket.connect(commandAddress);
+    m_controlWatcherThread = std::thread([this]() { this->controlWatcherLoop(); });
+  }
+  m_interruptDelivered = false;
+  m_controlWatcherActive = true;
+  sendControlWatcherCommand("watch");
+}
+
+void xSlicerServer::stopControlWatcher()
+{
+  if (!m_controlWatcherActive)
+  {
+    return;
+  }
+  sendControlWatcherCommand("release");
+  m_controlWatcherActive = false;
+
+  // Messages that could not be handled by the watcher are processed now
+  std::vector<xeus::xmessage> deferredMessages;
+  {
+    std::lock_guard<std::mutex> lock(m_controlWatcherMutex);
+    deferredMessages.swap(m_deferredControlMessages);
+  }
+  for (xeus::xmessage& message : deferredMessages)
+  {
+    m_pendingMessages.push_back({ std::move(message), xeus::channel::CONTROL, xSlicerKernelStats::clock::now() });
+  }
+
+  if (m_interruptDelivered)
+  {
+    // If the interrupt arrived when no more Python code was executed in the cell
+    // then the interrupt is still pending. Clear it, otherwise the next cell would be interrupted.
+    PyGILState_STATE gilState = PyGILState_Ensure();
+    if (PyErr_CheckSignals() != 0)
+    {
+      PyErr_Clear();
+    }
+    PyGILState_Release(gilState);
+    m_interruptDelivered = false;
+  }
+}
+
+void xSlicerServer::terminateControlWatcher()
+{
+  stopControlWatcher();
+  if (!m_controlWatcherThread.joinable())
+  {
+    return;
+  }
+  sendControlWatcherCommand("exit");
+  m_controlWatcherThread.join();
+  m_controlWatcherCommandSocket.close();
+  m_controlWatcherThreadSocket.close();
+}
+
+void xSlicerServer::sendControlWatcherCommand(const std::string& command)
+{
+  m_controlWatcherCommandSocket.send(zmq::buffer(command), zmq::send_flags::none);
+  if (command != "watch")
+  {
+    // The watcher thread acknowledges the command when it has stopped using the control socket
+    zmq::message_t acknowledgement;
+    (void)m_controlWatcherCommandSocket.recv(acknowledgement, zmq::recv_flags::none);
+  }
+}
+
+void xSlicerServer::controlWatcherLoop()
+{
+  zmq::socket_t& controlSocket = get_control_socket();
+  xSlicerTrace::instance().setCurrentThreadName("Control watcher");
+  bool watching = false;
+  while (true)
+  {
+    zmq::pollitem_t items[] = {
+      { static_cast<void*>(m_controlWatcherThreadSocket), 0, ZMQ_POLLIN, 0 },
+      { static_cast<void*>(controlSocket), 0, ZMQ_POLLIN, 0 } };
+    // The control socket is only polled while the main thread executes a cell
+    zmq::poll(items, watching ? 2 : 1, std::chrono::milliseconds(-1));
+    if (items[0].revents & ZMQ_POLLIN)
+    {
+      // Commands are processed first, so that the control socket is released without delay
+      zmq::message_t command;
+      if (!m_controlWatcherThreadSocket.recv(command, zmq::recv_flags::none))
+      {
+        continue;
+      }
+      std::string commandName = command.to_string();
+      if (commandName == "watch")
+      {
+        watching = true;
+        continue;
+      }
+      watching = false;
+      m_controlWatcherThreadSocket.send(zmq::buffer(commandName), zmq::send_flags::none);
+      if (commandName == "exit")
+      {
+        return;
+      }
+      continue;
+    }
+    if (!watching || !(items[1].revents & ZMQ_POLLIN))
+    {
+      continue;
+    }
+    zmq::multipart_t wireMessage;
+    if (!wireMessage.recv(controlSocket, ZMQ_DONTWAIT))
+    {
+      continue;
+    }
+    try
+    {
+      xeus::xmessage message = xeus::xzmq_serializer::deserialize(wireMessage, *m_authentication);
+      if (!handleWatchedControlMessage(message))
+      {
+        std::lock_guard<std::mutex> lock(m_controlWatcherMutex);
+        m_deferredControlMessages.push_back(std::move(message));
+      }
+    }
+    catch (const std::exception&)
+    {
+      // Invalid message (e.g., wrong signature), ignore it
+    }
+  }
+}
+
+bool xSlicerServer::handleWatchedControlMessage(const xeus::xmessage& message)
+{
+  std::string msgType = message.header().value("msg_type", "");
+  XSLICER_TRACE_SCOPE("server", msgType);
+  if (msgType == "interrupt_request")
+  {
+    // Raises KeyboardInterrupt in the main thread when it executes Python code next time
+    PyErr_SetInterrupt();
+    m_interruptDelivered = true;
+    ++m_interruptCount;
+    xeus::xmessage reply = makeReply(message, "interrupt_reply", { { "status", "ok" } });
+    xeus::xzmq_serializer::serialize(std::move(reply), *m_authentication, m_errorHandler).send(get_control_socket());
+    return true;
+  }
+  if (msgType == "kernel_info_request")
+  {
+    nl::json content;
+    {
+      std::lock_guard<std::mutex> lock(m_controlWatcherMutex);
+      content = m_kernelInfoReplyContent;
+    }
+    if (content.is_null())
+    {
+      return false;
+    }
+    xeus::xmessage reply = makeReply(message, "kernel_info_reply", std::move(content));
+    xeus::xzmq_serializer::serialize(std::move(reply), *m_authentication, m_errorHandler).send(get_control_socket());
+    return true;
+  }
+  if (msgType == "shutdown_request")
+  {
+    // Abort the execution so that the shutdown request can be processed
+    PyErr_SetInterrupt();
+    m_interruptDelivered = true;
+  }
+  return false;
+}
+
+xeus::xmessage xSlicerServer::makeReply(const xeus::xmessage& request, const std::string& msgType, nl::json content) const
+{
+  const nl::json& requestHeader = request.header();
+  nl::json header = xeus::make_header(msgType,
+    requestHeader.value("username", ""), requestHeader.value("session", ""));
+  return xeus::xmessage(request.identities(), std::move(header), requestHeader,
+    nl::json::object(), std::move(content), xeus::buffer_sequence());
+}
+
+void xSlicerServer::moveProfileToMetadata(xeus::xmessage& reply) const
+{
+  // The interpreter can only set the reply content, therefore it adds cell profiling
+  // results to the content and they are moved to the metadata here.
+  if (!reply.content().contains("slicer_profile")
+    || reply.header().value("msg_type", "") != "execute_reply")
+  {
+    return;
+  }
+  nl::json content = reply.content();
+  nl::json metadata = reply.metadata();
+  metadata["slicer_profile"] = std::move(content["slicer_profile"]);
+  content.erase("slicer_profile");
+  reply = xeus::xmessage(reply.identities(), reply.header(), reply.parent_header(),
+    std::move(metadata), std::move(content), reply.buffers());
+}
+
+void xSlicerServer::cacheKernelInfoReply(const xeus::xmessage& reply)
+{
+  if (reply.header().value("msg_type", "") != "kernel_info_reply")
+  {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(m_controlWatcherMutex);
+  m_kernelInfoReplyContent = reply.content();
+}
+
+void xSlicerServer::recordReply(const xeus::xmessage& reply)
+{
+  if (!m_kernelStats)
+  {
+    return;
+  }
+  std::string parentId = reply.parent_header().value("msg_id", "");
+  // Search from the end, as the most recently dispatched message is the most likely parent
+  // (messages can be dispatched recursively if message processing calls processEvents)
+  auto it = std::find_if(m_dispatchedMessages.rbegin(), m_dispatchedMessages.rend(),
+    [&parentId](const dispatched_message& msg) { return msg.id == parentId; });
+  if (it == m_dispatchedMessages.rend())
+  {
+    return;
+  }
+  m_kernelStats->record("reply", it->type, it->receivedTime,
+    xSlicerKernelStats::estimated_size(reply.content()));
+}
+
+void xSlicerServer::send_shell_impl(xeus::xmessage message)
+{
+  recordReply(message);
+  cacheKernelInfoReply(message);
+  moveProfileToMetadata(message);
+  xserver_zmq::send_shell_impl(std::move(message));
+}
+
+void xSlicerServer::send_control_impl(xeus::xmessage message)
+{
+  recordReply(message);
+  cacheKernelInfoReply(message);
+  xserver_zmq::send_control_impl(std::move(message));
+}
+
+void xSlicerServer::publish_impl(xeus::xpub_message message, xeus::channel c)
+{
+  std::string msgType = message.header().value("msg_type", "");
+  XSLICER_TRACE_SCOPE("iopub", msgType);
+  if (m_iopubFlushCallback && msgType != "stream")
+  {
+    m_iopubFlushCallback();
+  }
+  if (!m_kernelStats)
+  {
+    xserver_zmq::publish_impl(std::move(message), c);
+    return;
+  }
+  std::size_t bytes = xSlicerKernelStats::estimated_size(message.content())
+    + xSlicerKernelStats::estimated_size(message.buffers());
+  auto startTime = xSlicerKernelStats::clock::now();
+  xserver_zmq::publish_impl(std::move(message), c);
+  m_kernelStats->record("iopub", msgType, startTime, bytes);
+}
+
+xSlicerServer::channel_message xSlicerServer::takeNextMessage()
+{
+  auto it = std::find_if(m_pendingMessages.begin(), m_pendingMessages.end(),
+    [](const channel_message& msg) { return msg.channel == xeus::channel::CONTROL; });
+  if (it == m_pendingMessages.end())
+  {
+    it = m_pendingMessages.begin();
+    if (m_commMessageCoalescing)
+    {
+      // Skip messages that are superseded by the next message.
+      // Control messages are always taken first, so the next message in the queue
+      // is the next shell message.
+      while (std::next(it) != m_pendingMessages.end() && isCoalescable(it->message, std::next(it)->message))
+      {
+        ++it;
+        ++m_coalescedMessageCount;
+      }
+      m_pendingMessages.erase(m_pendingMessages.begin(), it);
+      it = m_pendingMessages.begin();
     }
   }
+  channel_message msg = std::move(*it);
+  m_pendingMessages.erase(it);
+  return msg;
+}
+
+bool xSlicerServer::isCoalescable(const xeus::xmessage& message, const xeus::xmessage& nextMessage)
+{
+  if (message.header().value("msg_type", "") != "comm_msg"
+    || nextMessage.header().value("msg_type", "") != "comm_msg")
+  {
+    return false;
+  }
+  const nl::json& content = message.content();
+  const nl::json& nextContent = nextMessage.content();
+  if (content.value("comm_id", "") != nextContent.value("comm_id", ""))
+  {
+    return false;
+  }
+  // Only events that describe the current pointer position can be dropped,
+  // as all the information they contain is included in the next event.
+  auto pointerMoveEvent = [](const nl::json& content)
+  {
+    auto data = content.find("data");
+    if (data == content.end() || !data->is_object())
+    {
+      return false;
+    }
+    auto event = data->find("content");
+    if (event == data->end() || !event->is_object())
+    {
+      return false;
+    }
+    auto eventName = event->find("event");
+    return eventName != event->end()
+      && (*eventName == "mousemove" || *eventName == "pointermove");
+  };
+  return pointerMoveEvent(content) && pointerMoveEvent(nextContent);
 }
@@ -2,11 +2,25 @@
 #define XSLICER_SERVER_HPP
 
 // xeus includes
+#include <xeus-zmq/xauthentication.hpp>
 #include <xeus-zmq/xserver_zmq.hpp>
 #include <xeus/xkernel_configuration.hpp>
 #include <zmq.hpp>
+#include <zmq_addon.hpp>
 
 #include "qSlicerJupyterKernelModuleExport.h"
+#include "xSlicerKernelStats.h"
+
+// STL includes
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 // Qt includes
 #include <QList>
@@ -21,6 +35,15 @@ class xSlicerServer : public xeus::xserver_zmq
 public:
     using socket_notifier_ptr = QSharedPointer<QSocketNotifier>;
 
+    /// Defines how incoming requests on the shell and control channels are detected.
+    enum PollMode
+    {
+      /// Check for incoming messages at regular time intervals (see setPollIntervalSec).
+      PollModeTimer,
+      /// Process incoming messages as soon as the ZMQ sockets signal them.
+      PollModeSocketNotifier
+    };
+
     xSlicerServer(xeus::xcontext& context,
                  const xeus::xconfiguration& config,
                  nl::json::error_handler_t eh);
@@ -30,19 +53,179 @@ public:
     void setPollIntervalSec(double intervalSec);
     double pollIntervalSec();
 
+    void setPollMode(PollMode mode);
+    PollMode pollMode() const;
+
+    /// Maximum time spent on processing queued messages in one poll.
+    /// Messages that cannot be processed within this time are processed
+    /// at the next poll, to keep the application responsive.
+    void setBatchTimeBudgetSec(double budgetSec);
+    double batchTimeBudgetSec() const;
+
+    /// If enabled then consecutive mouse move comm messages sent to the same comm
+    /// (such as ipyevents events of an interactive view widget) are
+    /// replaced by the most recent one.
+    void setCommMessageCoalescing(bool enable);
+    bool commMessageCoalescing() const;
+
+    /// Number of received messages that are waiting to be processed.
+    int pendingMessageCount() const;
+    /// Number of messages processed in the last poll.
+    int lastBatchSize() const;
+    /// Maximum number of messages processed in a single poll since the server started.
+    int maxBatchSize() const;
+    /// Number of messages that were dropped because a newer message superseded them.
+    int coalescedMessageCount() const;
+
+    /// Set object that collects message timing statistics.
+    /// The object is not owned by the server. Set to nullptr to disable statistics collection.
+    void setKernelStats(xSlicerKernelStats* stats);
+
+    /// Set function that is called before publishing any IOPub message other than stream output.
+    /// It allows publishing of buffered outputs, which ensures that the order of messages is preserved.
+    void setIOPubFlushCallback(std::function<void()> callback);
+
+    /// Set function that completes kernel initialization steps that are not needed for
+    /// answering kernel_info requests. It is called once: before the first request that is
+    /// not a kernel_info request is processed, or right after the first kernel_info reply is sent.
+    /// This allows the notebook to show the kernel as ready as early as possible.
+    void setDeferredInitializationCallback(std::function<void()> callback);
+    /// Run the deferred initialization now (if it has not been run yet).
+    void runDeferredInitialization();
+
+    /// If enabled then the control channel is serviced by a background thread while a cell is executed.
+    /// This allows interrupting a long-running cell (KeyboardInterrupt is raised in Python)
+    /// and answering kernel_info requests while the main thread is busy.
+    void setControlWatcherEnabled(bool enable);
+    bool controlWatcherEnabled() const;
+
+    /// Number of interrupt requests that were delivered while a cell was executed.
+    int interruptCount() const;
+
 protected:
 
+    struct channel_message
+    {
+      xeus::xmessage message;
+      xeus::channel channel;
+      xSlicerKernelStats::clock::time_point receivedTime;
+    };
+
+    /// Message that is being processed, used for computing reply latency
+    struct dispatched_message
+    {
+      std::string id;
+      std::string type;
+      xSlicerKernelStats::clock::time_point receivedTime;
+    };
+
     void start_impl(xeus::xpub_message message) override;
     void stop_impl() override;
 
+    void send_shell_impl(xeus::xmessage message) override;
+    void send_control_impl(xeus::xmessage message) override;
+    void publish_impl(xeus::xpub_message message, xeus::channel c) override;
+
+    void dispatch(channel_message msg);
+    void notifyListener(channel_message& msg, const std::string& msgType);
+    void recordReply(const xeus::xmessage& reply);
+    /// Store kernel info reply so that the control watcher can answer kernel info requests.
+    void cacheKernelInfoReply(const xeus::xmessage& reply);
+
+    /// Move cell profiling results from execute_reply content to metadata.
+    void moveProfileToMetadata(xeus::xmessage& reply) const;
+
     void poll();
 
+    /// Move all messages that are waiting on the sockets to the pending message queue.
+    void readPendingMessages();
+    /// Remove the next message to process from the pending message queue.
+    /// Control messages are processed before shell messages.
+    channel_message takeNextMessage();
+    static bool isCoalescable(const xeus::xmessage& message, const xeus::xmessage& nextMessage);
+
+    void startPolling();
+    void stopPolling();
+
+    /// Called when the file descriptor of a ZMQ socket is signaled.
+    void onSocketNotifierActivated(QSocketNotifier* notifier);
+
+    /// Returns true if there are messages waiting on the shell or control socket.
+    /// The control socket is not checked while it is used by the control watcher thread.
+    bool hasPendingMessages();
+
+    /// Read a message from a socket without using poll_channels
+    /// (used when the control socket must not be touched by the main thread).
+    bool readMessage(zmq::socket_t& socket, xeus::channel channel);
+
+    /// Start servicing the control channel in the control watcher thread.
+    /// The thread is created when it is first needed and then it is kept running.
+    void startControlWatcher();
+    /// Make the control watcher thread release the control socket
+    /// and queue the control messages that it deferred.
+    void stopControlWatcher();
+    /// Stop the control watcher and exit its thread.
+    void terminateControlWatcher();
+    /// Send a command ("watch", "release", or "exit") to the control watcher thread.
+    /// Except for "watch", wait until the thread does not use the control socket anymore.
+    void sendControlWatcherCommand(const std::string& command);
+    void controlWatcherLoop();
+    /// Process a control message in the watcher thread. Returns false if the message
+    /// must be processed by the main thread after the cell execution is completed.
+    bool handleWatchedControlMessage(const xeus::xmessage& message);
+    /// Create a reply message for a request.
+    xeus::xmessage makeReply(const xeus::xmessage& request, const std::string& msgType, nl::json content) const;
+
     // Socket notifier for stdin socket continuously generates signals
     // on Windows and on some Linux distributions, which would cause 100% CPU
     // usage even when the application is idle.
     // It is not clear why stdin socket behaves like this, but using a timer
     // to check for inputs at regular intervals solves the issue.
+    //
+    // In PollModeSocketNotifier mode only the shell and control sockets are watched
+    // (stdin socket is read synchronously by xeus while an input request is pending).
+    // ZMQ_FD is edge-triggered: it only becomes readable again after ZMQ_EVENTS
+    // has been queried, therefore each notifier is disabled while the queue is
+    // drained and it is re-armed only after ZMQ_EVENTS reports no more input.
     QTimer* m_pollTimer;
+    QList<socket_notifier_ptr> m_socketNotifiers;
+    PollMode m_pollMode;
+    bool m_polling;
+
+    std::deque<channel_message> m_pendingMessages;
+    double m_batchTimeBudgetSec;
+    bool m_commMessageCoalescing;
+    int m_lastBatchSize;
+    int m_maxBatchSize;
+    int m_coalescedMessageCount;
+
+    xSlicerKernelStats* m_kernelStats;
+    std::function<void()> m_iopubFlushCallback;
+    std::function<void()> m_deferredInitializationCallback;
+    std::vector<dispatched_message> m_dispatchedMessages;
+
+    // Control watcher: while an execute request is processed, the control socket is owned
+    // by m_controlWatcherThread. Interrupt requests are handled immediately in that thread,
+    // kernel_info requests are answered with the last kernel info reply, and other
+    // messages (e.g., shutdown) interrupt the execution and are processed after it completes.
+    // The thread is kept running between executions and it receives commands through an
+    // inproc socket pair, so that it is not blocked in polling when the main thread needs
+    // the control socket (creating a thread and waiting for a poll timeout at each execute
+    // request would add latency to each cell).
+    bool m_controlWatcherEnabled;
+    bool m_controlWatcherActive;
+    int m_executeDepth;
+    std::thread m_controlWatcherThread;
+    zmq::context_t m_controlWatcherContext;
+    zmq::socket_t m_controlWatcherCommandSocket; // used by the main thread
+    zmq::socket_t m_controlWatcherThreadSocket; // used by the control watcher thread
+    std::atomic<int> m_interruptCount;
+    std::atomic<bool> m_interruptDelivered;
+    std::mutex m_controlWatcherMutex;
+    std::vector<xeus::xmessage> m_deferredControlMessages;
+    nl::json m_kernelInfoReplyContent;
+    std::unique_ptr<xeus::xauthentication> m_authentication;
+    nl::json::error_handler_t m_errorHandler;
 };
 
 Q_SLICER_QTMODULES_JUPYTERKERNEL_EXPORT
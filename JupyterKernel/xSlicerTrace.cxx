@@ -0,0 +1,217 @@
+#include "xSlicerTrace.h"
+
+// STL includes
+#include <algorithm>
+#include <cstring>
+
+//----------------------------------------------------------------------------
+xSlicerTrace& xSlicerTrace::instance()
+{
+  static xSlicerTrace tracer;
+  return tracer;
+}
+
+//----------------------------------------------------------------------------
+xSlicerTrace::xSlicerTrace()
+  : m_originTime(clock::now())
+{
+}
+
+//----------------------------------------------------------------------------
+void xSlicerTrace::setEnabled(bool enabled)
+{
+  m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------
+void xSlicerTrace::setEventsPerThread(std::size_t count)
+{
+  m_eventsPerThread.store(std::max<std::size_t>(count, 1), std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------
+std::size_t xSlicerTrace::eventsPerThread() const
+{
+  return m_eventsPerThread.load(std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------
+struct xSlicerTrace::threadState
+{
+  threadBuffer* buffer = nullptr;
+  std::string name;
+  ~threadState()
+  {
+    if (this->buffer)
+    {
+      xSlicerTrace::instance().releaseBuffer(this->buffer);
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+xSlicerTrace::threadState& xSlicerTrace::currentThreadState()
+{
+  thread_local threadState state;
+  return state;
+}
+
+//----------------------------------------------------------------------------
+xSlicerTrace::threadBuffer* xSlicerTrace::currentThreadBuffer()
+{
+  threadState& state = currentThreadState();
+  if (state.buffer)
+  {
+    return state.buffer;
+  }
+  std::lock_guard<std::mutex> lock(m_buffersMutex);
+  threadBuffer* buffer = nullptr;
+  for (const std::shared_ptr<threadBuffer>& existingBuffer : m_buffers)
+  {
+    if (existingBuffer->available)
+    {
+      buffer = existingBuffer.get();
+      // Events of the exited thread would appear as events of this thread
+      buffer->clearedCount.store(buffer->writeCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      buffer->available = false;
+      break;
+    }
+  }
+  if (!buffer)
+  {
+    std::shared_ptr<threadBuffer> newBuffer = std::make_shared<threadBuffer>();
+    newBuffer->events.resize(this->eventsPerThread());
+    newBuffer->threadId = static_cast<int>(m_buffers.size()) + 1;
+    m_buffers.push_back(newBuffer);
+    buffer = newBuffer.get();
+  }
+  buffer->threadName = state.name.empty() ? "Thread " + std::to_string(buffer->threadId) : state.name;
+  state.buffer = buffer;
+  return buffer;
+}
+
+//----------------------------------------------------------------------------
+void xSlicerTrace::releaseBuffer(threadBuffer* buffer)
+{
+  std::lock_guard<std::mutex> lock(m_buffersMutex);
+  buffer->available = true;
+}
+
+//----------------------------------------------------------------------------
+void xSlicerTrace::setCurrentThreadName(const std::string& name)
+{
+  threadState& state = currentThreadState();
+  state.name = name;
+  if (state.buffer)
+  {
+    std::lock_guard<std::mutex> lock(m_buffersMutex);
+    state.buffer->threadName = name;
+  }
+}
+
+//----------------------------------------------------------------------------
+void xSlicerTrace::addEvent(const char* category, const std::string& name,
+  clock::time_point startTime, clock::time_point endTime)
+{
+  threadBuffer* buffer = this->currentThreadBuffer();
+  std::uint64_t index = buffer->writeCount.load(std::memory_order_relaxed);
+  event& slot = buffer->events[index % buffer->events.size()];
+  slot.category = category;
+  std::size_t nameLength = std::min<std::size_t>(name.size(), MaxNameLength - 1);
+  memcpy(slot.name, name.data(), nameLength);
+  slot.name[nameLength] = 0;
+  slot.startUsec = std::chrono::duration_cast<std::chrono::microseconds>(startTime - m_originTime).count();
+  slot.durationUsec = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
+  buffer->writeCount.store(index + 1, std::memory_order_release);
+}
+
+//----------------------------------------------------------------------------
+void xSlicerTrace::clear()
+{
+  std::lock_guard<std::mutex> lock(m_buffersMutex);
+  for (const std::shared_ptr<threadBuffer>& buffer : m_buffers)
+  {
+    buffer->clearedCount.store(buffer->writeCount.load(std::memory_order_acquire), std::memory_order_relaxed);
+  }
+}
+
+//----------------------------------------------------------------------------
+nl::json xSlicerTrace::toChromeTrace() const
+{
+  nl::json traceEvents = nl::json::array();
+  std::lock_guard<std::mutex> lock(m_buffersMutex);
+  for (const std::shared_ptr<threadBuffer>& buffer : m_buffers)
+  {
+    traceEvents.push_back({ { "ph", "M" }, { "name", "thread_name" }, { "pid", 1 }, { "tid", buffer->threadId },
+      { "args", { { "name", buffer->threadName } } } });
+
+    std::size_t capacity = buffer->events.size();
+    std::uint64_t endIndex = buffer->writeCount.load(std::memory_order_acquire);
+    std::uint64_t startIndex = std::max(buffer->clearedCount.load(std::memory_order_relaxed),
+      endIndex > capacity ? endIndex - capacity : 0);
+    if (startIndex >= endIndex)
+    {
+      continue;
+    }
+    std::vector<event> events(static_cast<std::size_t>(endIndex - startIndex));
+    for (std::uint64_t index = startIndex; index < endIndex; ++index)
+    {
+      events[static_cast<std::size_t>(index - startIndex)] = buffer->events[index % capacity];
+    }
+    // The owner thread keeps recording while events are copied, which may have overwritten
+    // the oldest copied events. Skip those, as they may be inconsistent. The slot of event
+    // currentWriteCount (the oldest event index minus one) may be being written right now.
+    std::uint64_t currentWriteCount = buffer->writeCount.load(std::memory_order_acquire);
+    std::uint64_t validStartIndex = currentWriteCount + 1 > capacity
+      ? std::max(startIndex, currentWriteCount + 1 - capacity) : startIndex;
+    for (std::uint64_t index = validStartIndex; index < endIndex; ++index)
+    {
+      const event& slot = events[static_cast<std::size_t>(index - startIndex)];
+      if (!slot.category)
+      {
+        continue;
+      }
+      traceEvents.push_back({ { "ph", "X" }, { "cat", slot.category }, { "name", std::string(slot.name) },
+        { "pid", 1 }, { "tid", buffer->threadId }, { "ts", slot.startUsec }, { "dur", slot.durationUsec } });
+    }
+  }
+  nl::json trace;
+  trace["traceEvents"] = std::move(traceEvents);
+  trace["displayTimeUnit"] = "ms";
+  return trace;
+}
+
+//----------------------------------------------------------------------------
+xSlicerTrace::scope::scope(const char* category, const char* name)
+  : m_category(category)
+  , m_staticName(name)
+  , m_active(xSlicerTrace::instance().isEnabled())
+{
+  if (m_active)
+  {
+    m_startTime = clock::now();
+  }
+}
+
+//----------------------------------------------------------------------------
+xSlicerTrace::scope::scope(const char* category, const std::string& name)
+  : m_category(category)
+  , m_staticName(nullptr)
+  , m_active(xSlicerTrace::instance().isEnabled())
+{
+  if (m_active)
+  {
+    m_name = name;
+    m_startTime = clock::now();
+  }
+}
+
+//----------------------------------------------------------------------------
+xSlicerTrace::scope::~scope()
+{
+  if (m_active)
+  {
+    xSlicerTrace::instance().addEvent(m_category, m_staticName ? std::string(m_staticName) : m_name,
+      m_startTime, clock::now());
+  }
+}
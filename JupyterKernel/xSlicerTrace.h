@@ -0,0 +1,132 @@
+#ifndef xSlicerTrace_h
+#define xSlicerTrace_h
+
+// xeus includes
+#include <xeus/xmessage.hpp>
+
+// STL includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Records a timeline of kernel activity that can be viewed in Chrome (chrome://tracing)
+/// or Perfetto (https://ui.perfetto.dev).
+///
+/// Each thread writes events into its own fixed-size ring buffer, without locking,
+/// therefore recording an event takes less than a microsecond. When a buffer is full,
+/// the oldest events of that thread are overwritten. Tracing is disabled by default;
+/// when disabled, trace scopes only check an atomic flag.
+///
+/// Categories recorded by the kernel:
+/// - server: polling sockets and dispatching messages (event name is the message type)
+/// - interpreter: executing code, completion, inspection
+/// - iopub: handing over messages to the publisher thread
+/// - render: rendering and reading views
+/// - interaction: mouse and keyboard events received from interactive view widgets
+/// - encode: image encoding (in the main thread or in frame encoder threads)
+/// - publish: sending images to the notebook
+class xSlicerTrace
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  /// Global tracer instance.
+  static xSlicerTrace& instance();
+
+  void setEnabled(bool enabled);
+  bool isEnabled() const
+  {
+    return m_enabled.load(std::memory_order_relaxed);
+  }
+
+  /// Number of events kept for each thread. Applies to threads that start recording afterwards.
+  void setEventsPerThread(std::size_t count);
+  std::size_t eventsPerThread() const;
+
+  /// Name of the current thread as shown in the timeline.
+  /// Does not allocate a trace buffer, so it can be called when tracing is disabled.
+  void setCurrentThreadName(const std::string& name);
+
+  /// Record an event with a start time and duration.
+  /// Name is truncated to 47 characters. Category must be a string literal.
+  void addEvent(const char* category, const std::string& name, clock::time_point startTime, clock::time_point endTime);
+
+  /// Remove all recorded events.
+  void clear();
+
+  /// Get all recorded events in Chrome trace event format: {"traceEvents": [...]}
+  nl::json toChromeTrace() const;
+
+  /// Records an event for the lifetime of the object (if tracing is enabled when the object is created).
+  class scope
+  {
+  public:
+    scope(const char* category, const char* name);
+    scope(const char* category, const std::string& name);
+    ~scope();
+  private:
+    const char* m_category;
+    std::string m_name;
+    const char* m_staticName;
+    clock::time_point m_startTime;
+    bool m_active;
+  };
+
+protected:
+  static const int MaxNameLength = 48;
+
+  struct event
+  {
+    const char* category = nullptr;
+    char name[MaxNameLength] = {};
+    std::int64_t startUsec = 0;
+    std::int64_t durationUsec = 0;
+  };
+
+  struct threadBuffer
+  {
+    int threadId = 0;
+    // Set when the owner thread exits. The buffer is then reused by the next thread that starts recording.
+    bool available = false;
+    std::string threadName;
+    std::vector<event> events;
+    // Number of events written so far. Only the thread that owns the buffer writes it.
+    std::atomic<std::uint64_t> writeCount{ 0 };
+    // Events written before this count are discarded (set by clear())
+    std::atomic<std::uint64_t> clearedCount{ 0 };
+  };
+
+  xSlicerTrace();
+
+  /// Get the buffer of the current thread, create it (or reuse the buffer of an exited thread) if needed.
+  threadBuffer* currentThreadBuffer();
+
+  /// Called when a thread that has a buffer exits.
+  void releaseBuffer(threadBuffer* buffer);
+
+  struct threadState;
+  static threadState& currentThreadState();
+
+  std::atomic<bool> m_enabled{ false };
+  std::atomic<std::size_t> m_eventsPerThread{ 65536 };
+  clock::time_point m_originTime;
+
+  // Buffers are not deleted, as the exporting thread may read them at any time.
+  // Buffers of exited threads are reused, therefore the number of buffers
+  // is limited by the maximum number of threads that record at the same time.
+  mutable std::mutex m_buffersMutex;
+  std::vector<std::shared_ptr<threadBuffer>> m_buffers;
+};
+
+#define XSLICER_TRACE_CONCAT_(a, b) a##b
+#define XSLICER_TRACE_CONCAT(a, b) XSLICER_TRACE_CONCAT_(a, b)
+
+/// Record an event from this point until the end of the enclosing block.
+#define XSLICER_TRACE_SCOPE(category, name) \
+  xSlicerTrace::scope XSLICER_TRACE_CONCAT(xSlicerTraceScope, __LINE__)(category, name)
+
+#endif
@@ -0,0 +1,422 @@
+#include "xSlicerViewInteraction.h"
+
+#include "qSlicerJupyterKernelModule.h"
+#include "qSlicerJupyterViewCapture.h"
+#include "xSlicerTrace.h"
+
+#include <vtkSlicerJupyterKernelLogic.h>
+
+#include <ctkVTKAbstractView.h>
+#include <qMRMLSliceView.h>
+#include <qMRMLThreeDView.h>
+
+#include <vtkMRMLSliceNode.h>
+#include <vtkMRMLViewNode.h>
+#include <vtkRenderWindow.h>
+#include <vtkRenderWindowInteractor.h>
+
+#include <QObject>
+#include <QVariantMap>
+
+#include <unordered_map>
+
+xSlicerViewInteractionTarget::xSlicerViewInteractionTarget(xeus::xcomm_manager& comm_manager,
+  qSlicerJupyterKernelModule* module)
+  : m_jupyter_kernel_module(module)
+{
+  comm_manager.register_comm_target(target_name(),
+    [this](xeus::xcomm&& comm, const xeus::xmessage& request) { this->open_comm(std::move(comm), request); });
+  if (m_jupyter_kernel_module)
+  {
+    m_frame_connection = QObject::connect(m_jupyter_kernel_module, &qSlicerJupyterKernelModule::viewFrameTilesEncoded,
+      [this](const QString& stream_id, const QVariantList& tiles, int width, int height, bool keyframe)
+      {
+        this->send_frame(stream_id, tiles, width, height, keyframe);
+      });
+    m_logic = vtkSlicerJupyterKernelLogic::SafeDownCast(m_jupyter_kernel_module->logic());
+  }
+
+  // Views that are modified by other means than the interaction events of the comm
+  // (for example, by executing a notebook cell) are sent again when the application is idle.
+  // Multiple modifications are reported with a single update.
+  m_refresh_timer.setSingleShot(true);
+  m_refresh_timer.setInterval(0);
+  QObject::connect(&m_refresh_timer, &QTimer::timeout, [this]() { this->refresh_modified_views(); });
+  if (m_logic)
+  {
+    m_view_modified_observation = m_logic->AddObserver(vtkSlicerJupyterKernelLogic::ViewModifiedEvent,
+      this, &xSlicerViewInteractionTarget::on_view_modified);
+  }
+}
+
+xSlicerViewInteractionTarget::~xSlicerViewInteractionTarget()
+{
+  if (m_logic)
+  {
+    m_logic->RemoveObserver(m_view_modified_observation);
+  }
+  m_refresh_timer.stop();
+  QObject::disconnect(m_frame_connection);
+  if (m_jupyter_kernel_module)
+  {
+    for (const auto& comm_item : m_comms)
+    {
+      if (!comm_item.second->stream_id.empty())
+      {
+        m_jupyter_kernel_module->clearFrameStream(QString::fromStdString(comm_item.second->stream_id));
+      }
+    }
+  }
+}
+
+const char* xSlicerViewInteractionTarget::target_name()
+{
+  return "slicer_view_interaction";
+}
+
+void xSlicerViewInteractionTarget::open_comm(xeus::xcomm&& comm, const xeus::xmessage& request)
+{
+  std::string comm_id = comm.id();
+  std::unique_ptr<view_comm> vc(new view_comm(std::move(comm)));
+
+  const nl::json& content = request.content();
+  nl::json data = (content.contains("data") && content["data"].is_object()) ? content["data"] : nl::json::object();
+  std::string layout_label = data.value("view", std::string());
+  vc->format = data.value("format", vc->format);
+  vc->quality = data.value("quality", vc->quality);
+  bool delta = data.value("delta", true);
+  vc->auto_update = data.value("autoUpdate", vc->auto_update);
+
+  vc->view = qSlicerJupyterViewCapture::viewByLayoutLabel(QString::fromStdString(layout_label));
+  if (!vc->view || !m_jupyter_kernel_module)
+  {
+    nl::json error_data;
+    error_data["type"] = "error";
+    error_data["message"] = vc->view ? "kernel module is not available" : "view not found: " + layout_label;
+    vc->comm.send(nl::json::object(), std::move(error_data), xeus::buffer_sequence());
+    vc->comm.close(nl::json::object(), nl::json::object(), xeus::buffer_sequence());
+    return;
+  }
+
+  vc->view_node_id = view_node_id(vc->view);
+  vc->stream_id = std::string(target_name()) + "-" + comm_id;
+  // Frames are always reported as tiles. If delta encoding is disabled then each frame is a keyframe.
+  m_jupyter_kernel_module->setFrameStreamDeltaEncoding(QString::fromStdString(vc->stream_id), true, delta ? 30 : 0);
+
+  vc->comm.on_message([this, comm_id](const xeus::xmessage& message) { this->handle_message(comm_id, message); });
+  vc->comm.on_close([this, comm_id](const xeus::xmessage&) { this->close_comm(comm_id); });
+
+  // Send initial image, so that the frontend knows the view size
+  this->request_frame(*vc, true);
+  m_comms[comm_id] = std::move(vc);
+}
+
+void xSlicerViewInteractionTarget::handle_message(const std::string& comm_id, const xeus::xmessage& message)
+{
+  auto comm_it = m_comms.find(comm_id);
+  if (comm_it == m_comms.end() || !comm_it->second->view)
+  {
+    return;
+  }
+  view_comm& vc = *comm_it->second;
+  const nl::json& content = message.content();
+  if (!content.contains("data") || !content["data"].is_object())
+  {
+    return;
+  }
+  const nl::json& data = content["data"];
+  vc.quality = data.value("quality", vc.quality);
+  vc.auto_update = data.value("autoUpdate", vc.auto_update);
+
+  auto events_it = data.find("events");
+  if (events_it != data.end() && events_it->is_array())
+  {
+    const nl::json& events = *events_it;
+    for (std::size_t event_index = 0; event_index < events.size(); ++event_index)
+    {
+      const nl::json& event = events[event_index];
+      if (!event.is_object())
+      {
+        continue;
+      }
+      // Skip mouse move if it is immediately followed by another mouse move,
+      // as only the last position matters.
+      if (event.value("event", std::string()) == "mousemove" && event_index + 1 < events.size()
+        && events[event_index + 1].is_object()
+        && events[event_index + 1].value("event", std::string()) == "mousemove")
+      {
+        continue;
+      }
+      this->process_event(vc, event);
+      if (!vc.view)
+      {
+        // view was deleted while processing the event
+        return;
+      }
+    }
+  }
+
+  std::string render = data.value("render", std::string("quick"));
+  if (render == "quick")
+  {
+    this->request_frame(vc, false);
+  }
+  else if (render == "full")
+  {
+    this->request_frame(vc, true);
+  }
+}
+
+void xSlicerViewInteractionTarget::process_event(view_comm& vc, const nl::json& event)
+{
+  vtkRenderWindowInteractor* interactor = vc.view->interactor();
+  if (!interactor)
+  {
+    return;
+  }
+  std::string event_type = event.value("event", std::string());
+  XSLICER_TRACE_SCOPE("interaction", event_type);
+
+  if (event_type == "keydown" || event_type == "keyup")
+  {
+    std::string key = event.value("key", std::string());
+    interactor->SetKeySym(key_to_sym(key).c_str());
+    interactor->SetKeyCode(key.size() == 1 ? key[0] : 0);
+    interactor->SetRepeatCount(1);
+  }
+  else
+  {
+    int height = vc.view->renderWindow() ? vc.view->renderWindow()->GetSize()[1] : 0;
+    interactor->SetEventPosition(event.value("x", 0), height - event.value("y", 0));
+  }
+  interactor->SetShiftKey(event.value("shiftKey", false));
+  interactor->SetControlKey(event.value("ctrlKey", false));
+  interactor->SetAltKey(event.value("altKey", false));
+
+  int button = event.value("button", 0);
+  if (event_type == "mousemove")
+  {
+    interactor->MouseMoveEvent();
+  }
+  else if (event_type == "mousedown")
+  {
+    vc.dragging = true;
+    if (button == 0)
+    {
+      interactor->LeftButtonPressEvent();
+    }
+    else if (button == 1)
+    {
+      interactor->MiddleButtonPressEvent();
+    }
+    else if (button == 2)
+    {
+      interactor->RightButtonPressEvent();
+    }
+  }
+  else if (event_type == "mouseup")
+  {
+    vc.dragging = false;
+    if (button == 0)
+    {
+      interactor->LeftButtonReleaseEvent();
+    }
+    else if (button == 1)
+    {
+      interactor->MiddleButtonReleaseEvent();
+    }
+    else if (button == 2)
+    {
+      interactor->RightButtonReleaseEvent();
+    }
+  }
+  else if (event_type == "wheel")
+  {
+    if (event.value("deltaY", 0.0) < 0)
+    {
+      interactor->MouseWheelForwardEvent();
+    }
+    else
+    {
+      interactor->MouseWheelBackwardEvent();
+    }
+  }
+  else if (event_type == "mouseenter")
+  {
+    interactor->EnterEvent();
+  }
+  else if (event_type == "mouseleave")
+  {
+    interactor->LeaveEvent();
+  }
+  else if (event_type == "keydown")
+  {
+    interactor->KeyPressEvent();
+    interactor->CharEvent();
+  }
+  else if (event_type == "keyup")
+  {
+    interactor->KeyReleaseEvent();
+  }
+}
+
+void xSlicerViewInteractionTarget::request_frame(view_comm& vc, bool full_quality)
+{
+  if (!vc.view || !m_jupyter_kernel_module)
+  {
+    return;
+  }
+  QString format = full_quality ? QString("PNG") : QString::fromStdString(vc.format);
+  int quality = full_quality ? -1 : vc.quality;
+  if (!m_jupyter_kernel_module->captureRenderViewAsync(vc.view, QString::fromStdString(vc.stream_id),
+    format, quality, 0, true))
+  {
+    // The frontend waits for a reply before it sends the next batch of events
+    nl::json data;
+    data["type"] = "skipped";
+    vc.comm.send(nl::json::object(), std::move(data), xeus::buffer_sequence());
+    return;
+  }
+  vc.captured_change_counter = this->view_change_counter(vc);
+}
+
+void xSlicerViewInteractionTarget::on_view_modified(vtkObject* vtkNotUsed(caller),
+  unsigned long vtkNotUsed(event), void* vtkNotUsed(call_data))
+{
+  if (!m_comms.empty())
+  {
+    m_refresh_timer.start();
+  }
+}
+
+void xSlicerViewInteractionTarget::refresh_modified_views()
+{
+  for (auto& comm_item : m_comms)
+  {
+    view_comm& vc = *comm_item.second;
+    // While a mouse button is pressed, frames are sent in response to the interaction events
+    if (!vc.view || !vc.auto_update || vc.dragging || vc.view_node_id.empty())
+    {
+      continue;
+    }
+    if (this->view_change_counter(vc) != vc.captured_change_counter)
+    {
+      this->request_frame(vc, true);
+    }
+  }
+}
+
+unsigned long xSlicerViewInteractionTarget::view_change_counter(const view_comm& vc) const
+{
+  if (!m_logic || vc.view_node_id.empty())
+  {
+    return 0;
+  }
+  return m_logic->GetViewChangeCounter(vc.view_node_id.c_str());
+}
+
+std::string xSlicerViewInteractionTarget::view_node_id(ctkVTKAbstractView* view)
+{
+  vtkMRMLNode* view_node = nullptr;
+  if (qMRMLThreeDView* three_d_view = qobject_cast<qMRMLThreeDView*>(view))
+  {
+    view_node = three_d_view->mrmlViewNode();
+  }
+  else if (qMRMLSliceView* slice_view = qobject_cast<qMRMLSliceView*>(view))
+  {
+    view_node = slice_view->mrmlSliceNode();
+  }
+  return (view_node && view_node->GetID()) ? view_node->GetID() : std::string();
+}
+
+void xSlicerViewInteractionTarget::send_frame(const QString& stream_id, const QVariantList& tiles,
+  int width, int height, bool keyframe)
+{
+  XSLICER_TRACE_SCOPE("publish", "frame");
+  std::string stream_id_str = stream_id.toStdString();
+  auto comm_it = m_comms.begin();
+  for (; comm_it != m_comms.end(); ++comm_it)
+  {
+    if (comm_it->second->stream_id == stream_id_str)
+    {
+      break;
+    }
+  }
+  if (comm_it == m_comms.end())
+  {
+    // not a stream of this comm target or the comm has been closed
+    return;
+  }
+
+  nl::json data;
+  data["type"] = "frame";
+  data["width"] = width;
+  data["height"] = height;
+  data["keyframe"] = keyframe;
+  data["tiles"] = nl::json::array();
+  xeus::buffer_sequence buffers;
+  for (const QVariant& tile_variant : tiles)
+  {
+    QVariantMap tile = tile_variant.toMap();
+    QByteArray tile_data = tile["data"].toByteArray();
+    nl::json tile_info;
+    tile_info["x"] = tile["x"].toInt();
+    tile_info["y"] = tile["y"].toInt();
+    tile_info["width"] = tile["width"].toInt();
+    tile_info["height"] = tile["height"].toInt();
+    tile_info["mimeType"] = tile["mimeType"].toString().toStdString();
+    data["tiles"].push_back(tile_info);
+    buffers.push_back(xeus::binary_buffer(tile_data.constData(), tile_data.constData() + tile_data.size()));
+  }
+  comm_it->second->comm.send(nl::json::object(), std::move(data), std::move(buffers));
+}
+
+void xSlicerViewInteractionTarget::close_comm(const std::string& comm_id)
+{
+  auto comm_it = m_comms.find(comm_id);
+  if (comm_it == m_comms.end())
+  {
+    return;
+  }
+  if (m_jupyter_kernel_module)
+  {
+    m_jupyter_kernel_module->clearFrameStream(QString::fromStdString(comm_it->second->stream_id));
+  }
+  // This method is called from the comm's close handler, therefore the comm
+  // cannot be deleted here. Stop using the view and release the comm object later.
+  comm_it->second->view = nullptr;
+  comm_it->second->stream_id.clear();
+  QMetaObject::invokeMethod(m_jupyter_kernel_module, [this, comm_id]() { m_comms.erase(comm_id); }, Qt::QueuedConnection);
+}
+
+std::string xSlicerViewInteractionTarget::key_to_sym(const std::string& key)
+{
+  static const std::unordered_map<std::string, std::string> key_to_sym_map =
+  {
+    { "ArrowLeft", "Left" },
+    { "ArrowRight", "Right" },
+    { "ArrowUp", "Up" },
+    { "ArrowDown", "Down" },
+    { "BackSpace", "BackSpace" },
+    { "Tab", "Tab" },
+    { "Enter", "Return" },
+    { "CapsLock", "Caps_Lock" },
+    { "Escape", "Escape" },
+    { " ", "space" },
+    { "PageUp", "Prior" },
+    { "PageDown", "Next" },
+    { "Home", "Home" },
+    { "End", "End" },
+    { "Delete", "Delete" },
+    { "Insert", "Insert" },
+    { "*", "asterisk" },
+    { "+", "plus" },
+    { "|", "bar" },
+    { "-", "minus" },
+    { ".", "period" },
+    { "/", "slash" }
+    // F1...F12 keys have the same name in browsers and VTK
+  };
+  auto sym_it = key_to_sym_map.find(key);
+  return sym_it != key_to_sym_map.end() ? sym_it->second : key;
+}
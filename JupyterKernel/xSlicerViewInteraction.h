@@ -0,0 +1,114 @@
+#ifndef xSlicerViewInteraction_h
+#define xSlicerViewInteraction_h
+
+#include <xeus/xcomm.hpp>
+
+#include <vtkWeakPointer.h>
+
+#include <QMetaObject>
+#include <QPointer>
+#include <QTimer>
+#include <QVariantList>
+
+#include <map>
+#include <memory>
+#include <string>
+
+class ctkVTKAbstractView;
+class qSlicerJupyterKernelModule;
+class vtkObject;
+class vtkSlicerJupyterKernelLogic;
+
+/// Comm target that forwards user interaction events of a notebook
+/// directly to a view's vtkRenderWindowInteractor, without running any Python code.
+///
+/// Target name: "slicer_view_interaction"
+///
+/// Comm open data (all items are optional):
+///   {"view": "1", "format": "JPG", "quality": 50, "delta": true, "autoUpdate": true}
+///   - view: layout label or name of the view (default: first 3D view)
+///   - format, quality: encoding of frames sent during interaction
+///   - delta: send only the changed tiles of frames (default: true)
+///   - autoUpdate: send a frame when the view is modified by other means than the events of the comm
+///     (for example, by executing a notebook cell). Default is true.
+///
+/// Messages from the frontend:
+///   {"events": [{"event": "mousemove", "x": 10, "y": 20, "shiftKey": false, "ctrlKey": false, "altKey": false}, ...],
+///    "render": "quick"}
+///   - events: supported event types are mousemove, mousedown, mouseup (with "button": 0=left, 1=middle, 2=right),
+///     wheel (with "deltaY"), mouseenter, mouseleave, keydown, keyup (with "key", using browser key names).
+///     Position is measured in pixels from the top-left corner of the view.
+///     Consecutive mouse move events are reduced to the last one.
+///   - render: "quick" (render and send a frame in the interaction format), "full" (send a lossless PNG frame),
+///     or "none". Default is "quick".
+///   - quality, autoUpdate: optional, change the value that was set when the comm was opened.
+///
+/// Messages to the frontend:
+///   {"type": "frame", "width": 600, "height": 400, "keyframe": true,
+///    "tiles": [{"x": 0, "y": 0, "width": 600, "height": 400, "mimeType": "image/jpeg"}, ...]}
+///   The encoded image of the i-th tile is in the i-th binary buffer of the message.
+///   Tiles must be drawn at the specified position, over the previously received frame.
+///   {"type": "skipped"}
+///   Sent instead of a frame if the view could not be captured.
+///   {"type": "error", "message": "..."}
+///   Sent when the comm cannot be opened (the comm is closed afterwards).
+///
+/// Frames are encoded in background threads (see qSlicerJupyterKernelModule::captureRenderViewAsync).
+/// If autoUpdate is enabled, a lossless frame is also sent when the view is modified by other means
+/// than the events of the comm, while no mouse button is pressed.
+///
+/// The frontend is ViewInteractiveWidget (JupyterNotebooksLib/interactive_view_widget.py).
+class xSlicerViewInteractionTarget
+{
+
+public:
+
+    xSlicerViewInteractionTarget(xeus::xcomm_manager& comm_manager, qSlicerJupyterKernelModule* module);
+    virtual ~xSlicerViewInteractionTarget();
+
+    static const char* target_name();
+
+private:
+
+    struct view_comm
+    {
+        view_comm(xeus::xcomm&& c) : comm(std::move(c)) {}
+        xeus::xcomm comm;
+        QPointer<ctkVTKAbstractView> view;
+        std::string view_node_id;
+        std::string stream_id;
+        bool auto_update = true;
+        // A mouse button is pressed
+        bool dragging = false;
+        // View change counter when the view was last captured
+        unsigned long captured_change_counter = 0;
+        std::string format = "JPG";
+        int quality = 50;
+    };
+
+    void open_comm(xeus::xcomm&& comm, const xeus::xmessage& request);
+    void handle_message(const std::string& comm_id, const xeus::xmessage& message);
+    void close_comm(const std::string& comm_id);
+
+    void process_event(view_comm& vc, const nl::json& event);
+    void request_frame(view_comm& vc, bool full_quality);
+    void send_frame(const QString& stream_id, const QVariantList& tiles, int width, int height, bool keyframe);
+
+    void on_view_modified(vtkObject* caller, unsigned long event, void* call_data);
+    /// Send a frame of views that changed since they were last captured.
+    void refresh_modified_views();
+    unsigned long view_change_counter(const view_comm& vc) const;
+    static std::string view_node_id(ctkVTKAbstractView* view);
+
+    /// Convert browser key name (KeyboardEvent.key) to VTK key symbol
+    static std::string key_to_sym(const std::string& key);
+
+    qSlicerJupyterKernelModule* m_jupyter_kernel_module;
+    std::map<std::string, std::unique_ptr<view_comm>> m_comms;
+    QMetaObject::Connection m_frame_connection;
+    vtkWeakPointer<vtkSlicerJupyterKernelLogic> m_logic;
+    unsigned long m_view_modified_observation = 0;
+    QTimer m_refresh_timer;
+};
+
+#endif
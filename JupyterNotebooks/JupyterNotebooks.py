@@ -38,6 +38,7 @@ class SlicerJupyterServerHelper:
         import pandas
         import ipyevents
         import ipycanvas
+        import anywidget
       except:
         needToInstall = True
 
@@ -55,7 +56,7 @@ class SlicerJupyterServerHelper:
       # when IPython is pulled in transitively by jupyter / ipykernel.
       # Pin explicitly so fresh installs land on IPython 8.x, which
       # xeus-python-shell actually works with.
-      slicer.util.pip_install("jupyter jupyterlab ipywidgets pandas ipyevents ipycanvas 'ipython<9' --no-warn-script-location")
+      slicer.util.pip_install("jupyter jupyterlab ipywidgets pandas ipyevents ipycanvas anywidget 'ipython<9' --no-warn-script-location")
 
     # Install Slicer Jupyter kernel
     # Create Slicer kernel
@@ -81,6 +82,8 @@ class JupyterNotebooksTest(ScriptedLoadableModuleTest):
     """
     self.setUp()
     self.test_JupyterNotebooks1()
+    self.setUp()
+    self.test_DisplayBenchmark()
 
   def test_JupyterNotebooks1(self):
     """ Ideally you should have several levels of tests.  At the lowest level
@@ -99,3 +102,35 @@ class JupyterNotebooksTest(ScriptedLoadableModuleTest):
     # TODO: implement test
 
     self.delayDisplay('Test passed!')
+
+  def test_DisplayBenchmark(self):
+    """Measure view capture and display times using small synthetic data sets.
+    The report is written to the application's temporary folder (JupyterNotebooksDisplayBenchmark.json/csv).
+    Results that are slower than in the previous report in that folder are logged as warnings.
+    Run JupyterNotebooksLib.DisplayBenchmark with default parameters to get a complete report.
+    """
+    self.delayDisplay("Starting display benchmark")
+
+    import JupyterNotebooksLib as slicernb
+    slicer.mrmlScene.Clear()
+    benchmark = slicernb.DisplayBenchmark(viewSizes=[[300, 300], [600, 600]], formats=[["PNG", -1], ["JPG", 50]],
+      volumeSizes=[64], meshResolutions=[32], repeat=2)
+    results = benchmark.run()
+    reportFilePath = os.path.join(slicer.app.temporaryPath, "JupyterNotebooksDisplayBenchmark")
+
+    # Timing depends on the computer and its load, therefore slowdowns compared to the previous run
+    # on this computer are only logged, they do not make the test fail.
+    if os.path.exists(reportFilePath + ".json"):
+      for key, baselineSeconds, seconds in slicernb.compareReports(reportFilePath + ".json", results):
+        logging.warning("Display benchmark {0}: {1:.4f}s (previous run: {2:.4f}s)".format(key, seconds, baselineSeconds))
+
+    benchmark.writeReport(reportFilePath + ".json")
+    benchmark.writeReport(reportFilePath + ".csv")
+    logging.info("Display benchmark report: " + reportFilePath + ".json")
+
+    self.assertTrue(len(results) > 0)
+    for result in results:
+      if result["stage"] == "base64" or result["stage"] == "total":
+        self.assertTrue(result["payloadBytes"] > 0, "Empty image: {0}".format(result))
+
+    self.delayDisplay('Test passed!')
@@ -8,7 +8,13 @@ from .display import setViewLayout, showSliceViewAnnotations, showVolumeRenderin
 
 # Convert MRML nodes and other common data types to objects that can be
 # nicely displayed in notebooks
-from .display import displayable, ModelDisplay, TransformDisplay, MatplotlibDisplay
+from .display import displayable, ImageDisplay, ModelDisplay, ModelMeshDisplay, TransformDisplay, MatplotlibDisplay
+
+# Memory limit of outputs held by display objects
+from .output_cache import outputCache, setOutputCacheLimit
+
+# Performance measurement of view capture and display
+from .benchmark import DisplayBenchmark, compareReports
 
 # cli
 from .cli import cliRunSync
@@ -20,7 +26,11 @@ from .files import downloadFromURL, localPath, notebookPath, notebookSaveCheckpo
 try:
     import ipywidgets
 except ImportError:
-    print("ipywidgets is not installed in 3D Slicer's Python environment. These classes will not be available: ViewSliceWidget, ViewSliceBaseWidget, View3DWidget, FileUploadWidget, AppWindow, ViewInteractiveWidget")
+    print("ipywidgets is not installed in 3D Slicer's Python environment. These classes will not be available: ViewSliceWidget, ViewSliceBaseWidget, View3DWidget, FileUploadWidget, AppWindow, ViewInteractiveWidget, ViewSliceStreamWidget")
 else:
     from .widgets import ViewSliceWidget, ViewSliceBaseWidget, View3DWidget, FileUploadWidget, AppWindow
-    from .interactive_view_widget import ViewInteractiveWidget
+    try:
+        from .interactive_view_widget import ViewInteractiveWidget
+        from .slice_stream_widget import ViewSliceStreamWidget
+    except ImportError:
+        print("anywidget is not installed in 3D Slicer's Python environment. These classes will not be available: ViewInteractiveWidget, ViewSliceStreamWidget")
@@ -0,0 +1,255 @@
+import base64
+import csv
+import json
+import time
+
+import slicer, vtk
+
+from .display import _qImageToBytes
+
+# Maximum widget size in Qt (QWIDGETSIZE_MAX)
+_maxWidgetSize = 16777215
+
+class DisplayBenchmark(object):
+  """Measure how long it takes to capture views and create displayable objects.
+
+  Synthetic volumes and meshes of increasing size are loaded into the scene and
+  views of different sizes are captured in different image formats. Each stage
+  of the capture (processEvents, render, grab, encode, base64) is timed separately,
+  and the size of the payload that is sent to the notebook is recorded.
+  End-to-end time of display classes (ViewDisplay, ViewSliceDisplay, View3DDisplay,
+  ModelDisplay, ViewLightboxDisplay, ViewInteractiveWidget.getImage) is measured as well.
+
+  Example::
+
+    import JupyterNotebooksLib as slicernb
+    benchmark = slicernb.DisplayBenchmark()
+    benchmark.run()
+    benchmark.writeReport(slicer.app.temporaryPath + "/display-benchmark.json")
+    benchmark.writeReport(slicer.app.temporaryPath + "/display-benchmark.csv")
+
+  :param viewSizes: list of [width, height] of captured views, in pixels.
+  :param formats: list of [format, quality] image encodings (quality=-1 means default quality).
+  :param volumeSizes: number of voxels along each axis of synthetic volumes.
+  :param meshResolutions: theta and phi resolution of synthetic sphere meshes
+    (number of triangles is about 2*resolution^2).
+  :param repeat: number of times each measurement is repeated. Median, minimum and maximum are reported.
+  """
+
+  def __init__(self, viewSizes=None, formats=None, volumeSizes=None, meshResolutions=None, repeat=3):
+    self.viewSizes = viewSizes if viewSizes is not None else [[300, 300], [600, 600], [1200, 1200]]
+    self.formats = formats if formats is not None else [["PNG", -1], ["JPG", 50], ["JPG", 90]]
+    self.volumeSizes = volumeSizes if volumeSizes is not None else [64, 128, 256]
+    self.meshResolutions = meshResolutions if meshResolutions is not None else [32, 128, 512]
+    self.repeat = repeat
+    self.results = []
+
+  def run(self):
+    """Run all measurements. Results are stored in `results` (list of dictionaries)."""
+    self.results = []
+    layoutManager = slicer.app.layoutManager()
+    originalLayout = layoutManager.layout
+    try:
+      for volumeSize in self.volumeSizes:
+        volumeNode = self._addSyntheticVolume(volumeSize)
+        slicer.util.setSliceViewerLayers(background=volumeNode, fit=True)
+        dataSize = "volume{0}".format(volumeSize)
+        layoutManager.setLayout(slicer.vtkMRMLLayoutNode.SlicerLayoutOneUpRedSliceView)
+        self._measureViewStages("sliceView", layoutManager.sliceWidget("Red").sliceView(), dataSize)
+        self._measureDisplayClasses(dataSize)
+        slicer.mrmlScene.RemoveNode(volumeNode)
+      for meshResolution in self.meshResolutions:
+        modelNode = self._addSyntheticMesh(meshResolution)
+        dataSize = "mesh{0}".format(meshResolution)
+        layoutManager.setLayout(slicer.vtkMRMLLayoutNode.SlicerLayoutOneUp3DView)
+        self._resetCamera()
+        self._measureViewStages("threeDView", layoutManager.threeDWidget(0).threeDView(), dataSize)
+        self._measureModelDisplay(modelNode, dataSize)
+        slicer.mrmlScene.RemoveNode(modelNode)
+    finally:
+      layoutManager.setLayout(originalLayout)
+    return self.results
+
+  def writeReport(self, filePath):
+    """Write results to a CSV (if filename ends with .csv) or JSON file."""
+    if filePath.lower().endswith(".csv"):
+      fieldNames = ["benchmark", "target", "dataSize", "viewWidth", "viewHeight", "format", "quality",
+        "stage", "seconds", "minSeconds", "maxSeconds", "payloadBytes"]
+      with open(filePath, "w", newline="") as file:
+        writer = csv.DictWriter(file, fieldnames=fieldNames, extrasaction="ignore")
+        writer.writeheader()
+        for result in self.results:
+          writer.writerow(result)
+    else:
+      report = {
+        "slicerVersion": slicer.app.applicationVersion,
+        "vtkVersion": vtk.vtkVersion.GetVTKVersion(),
+        "results": self.results
+        }
+      with open(filePath, "w") as file:
+        json.dump(report, file, indent=2)
+
+  def _addResult(self, benchmark, target, dataSize, viewSize, format, quality, stage, times, payloadBytes=None):
+    sortedTimes = sorted(times)
+    self.results.append({
+      "benchmark": benchmark,
+      "target": target,
+      "dataSize": dataSize,
+      "viewWidth": viewSize[0] if viewSize else None,
+      "viewHeight": viewSize[1] if viewSize else None,
+      "format": format,
+      "quality": quality,
+      "stage": stage,
+      "seconds": sortedTimes[len(sortedTimes) // 2],
+      "minSeconds": sortedTimes[0],
+      "maxSeconds": sortedTimes[-1],
+      "payloadBytes": payloadBytes
+      })
+
+  def _measureViewStages(self, target, view, dataSize):
+    """Time each stage of capturing a view."""
+    jupyterKernel = getattr(slicer.modules, "jupyterkernel", None)
+    for viewSize in self.viewSizes:
+      view.setFixedSize(viewSize[0], viewSize[1])
+      try:
+        for format, quality in self.formats:
+          stageTimes = {"processEvents": [], "render": [], "grab": [], "encode": [], "base64": [], "kernelCapture": []}
+          payloadBytes = 0
+          for repeatIndex in range(self.repeat):
+            startTime = time.perf_counter()
+            slicer.app.processEvents()
+            stageTimes["processEvents"].append(time.perf_counter() - startTime)
+
+            startTime = time.perf_counter()
+            view.forceRender()
+            stageTimes["render"].append(time.perf_counter() - startTime)
+
+            startTime = time.perf_counter()
+            image = view.grab()
+            stageTimes["grab"].append(time.perf_counter() - startTime)
+
+            startTime = time.perf_counter()
+            data = _qImageToBytes(image, format, quality)
+            stageTimes["encode"].append(time.perf_counter() - startTime)
+
+            startTime = time.perf_counter()
+            payload = base64.b64encode(data)
+            stageTimes["base64"].append(time.perf_counter() - startTime)
+            payloadBytes = len(payload)
+
+            if jupyterKernel:
+              # Render, read, and encode in C++ (used by display classes when available)
+              startTime = time.perf_counter()
+              jupyterKernel.captureRenderView(view, format, quality, 0, True)
+              stageTimes["kernelCapture"].append(time.perf_counter() - startTime)
+
+          for stage, times in stageTimes.items():
+            if times:
+              self._addResult("viewCapture", target, dataSize, viewSize, format, quality, stage, times,
+                payloadBytes if stage == "base64" else None)
+      finally:
+        view.setMinimumSize(0, 0)
+        view.setMaximumSize(_maxWidgetSize, _maxWidgetSize)
+
+  def _measureDisplayClasses(self, dataSize):
+    """Time creation of displayable objects (end-to-end, including capture and encoding)."""
+    import JupyterNotebooksLib as slicernb
+    displayFactories = [
+      ["ViewDisplay", "image/png", lambda: slicernb.ViewDisplay("FourUp")],
+      ["ViewSliceDisplay", "image/jpeg", lambda: slicernb.ViewSliceDisplay("Red")],
+      ["View3DDisplay", "image/jpeg", lambda: slicernb.View3DDisplay()],
+      ["ViewLightboxDisplay", "image/png", lambda: slicernb.ViewLightboxDisplay("Red", rows=2, columns=3)],
+      ]
+    try:
+      interactiveViewWidget = slicernb.ViewInteractiveWidget()
+      displayFactories.append(["ViewInteractiveWidget.getImage", "image/jpeg", lambda: interactiveViewWidget.getImage()])
+    except (AttributeError, ImportError, ValueError):
+      # ipywidgets or anywidget is not installed
+      interactiveViewWidget = None
+
+    for name, dataType, factory in displayFactories:
+      times = []
+      payloadBytes = 0
+      for repeatIndex in range(self.repeat):
+        startTime = time.perf_counter()
+        displayObject = factory()
+        times.append(time.perf_counter() - startTime)
+        data = getattr(displayObject, "data", None) or getattr(displayObject, "value", None)
+        payloadBytes = len(base64.b64encode(data)) if data else 0
+        del displayObject
+      self._addResult("display", name, dataSize, None, dataType, None, "total", times, payloadBytes)
+
+    if interactiveViewWidget:
+      interactiveViewWidget.close()
+
+  def _measureModelDisplay(self, modelNode, dataSize):
+    import JupyterNotebooksLib as slicernb
+    for viewSize in self.viewSizes:
+      times = []
+      payloadBytes = 0
+      for repeatIndex in range(self.repeat):
+        startTime = time.perf_counter()
+        displayObject = slicernb.ModelDisplay(modelNode, imageSize=viewSize)
+        times.append(time.perf_counter() - startTime)
+        payloadBytes = len(base64.b64encode(displayObject.data))
+        del displayObject
+      self._addResult("display", "ModelDisplay", dataSize, viewSize, "image/png", None, "total", times, payloadBytes)
+
+  def _addSyntheticVolume(self, size):
+    """Create a volume with smooth gradients and sharp edges (to get realistic compression ratios)."""
+    import numpy as np
+    coordinates = np.linspace(-1.0, 1.0, size, dtype=np.float32)
+    k, j, i = np.meshgrid(coordinates, coordinates, coordinates, indexing="ij")
+    radius = np.sqrt(i*i + j*j + k*k)
+    voxels = (200 * np.cos(6 * radius) + 300 * (radius < 0.6) + 100 * i).astype(np.int16)
+    volumeNode = slicer.util.addVolumeFromArray(voxels, name="BenchmarkVolume{0}".format(size))
+    volumeNode.SetSpacing(200.0 / size, 200.0 / size, 200.0 / size)
+    volumeNode.CreateDefaultDisplayNodes()
+    volumeNode.GetDisplayNode().AutoWindowLevelOn()
+    return volumeNode
+
+  def _addSyntheticMesh(self, resolution):
+    sphere = vtk.vtkSphereSource()
+    sphere.SetRadius(50.0)
+    sphere.SetThetaResolution(resolution)
+    sphere.SetPhiResolution(resolution)
+    # Make the surface bumpy, so that shading is not uniform
+    warp = vtk.vtkWarpScalar()
+    elevation = vtk.vtkElevationFilter()
+    elevation.SetInputConnection(sphere.GetOutputPort())
+    warp.SetInputConnection(elevation.GetOutputPort())
+    warp.SetScaleFactor(10.0)
+    warp.Update()
+    modelNode = slicer.modules.models.logic().AddModel(warp.GetOutput())
+    modelNode.SetName("BenchmarkMesh{0}".format(resolution))
+    return modelNode
+
+  def _resetCamera(self):
+    threeDView = slicer.app.layoutManager().threeDWidget(0).threeDView()
+    threeDView.resetFocalPoint()
+    threeDView.resetCamera()
+
+def compareReports(baselineFilePath, results, tolerance=1.5, minSeconds=0.001):
+  """Compare benchmark results to a baseline JSON report (written by DisplayBenchmark.writeReport).
+
+  :param results: list of results (DisplayBenchmark.results) or path of a JSON report.
+  :param tolerance: a result is reported as regression if it is slower than baseline * tolerance.
+  :param minSeconds: measurements shorter than this in the baseline are ignored (too noisy).
+  :return: list of regressions: (key, baseline seconds, current seconds).
+  """
+  def resultsByKey(items):
+    return {(r["benchmark"], r["target"], r["dataSize"], r["viewWidth"], r["viewHeight"],
+      r["format"], r["quality"], r["stage"]): r["seconds"] for r in items}
+  with open(baselineFilePath) as file:
+    baseline = resultsByKey(json.load(file)["results"])
+  if isinstance(results, str):
+    with open(results) as file:
+      results = json.load(file)["results"]
+  regressions = []
+  for key, seconds in resultsByKey(results).items():
+    baselineSeconds = baseline.get(key)
+    if baselineSeconds is None or baselineSeconds < minSeconds:
+      continue
+    if seconds > baselineSeconds * tolerance:
+      regressions.append((key, baselineSeconds, seconds))
+  return regressions
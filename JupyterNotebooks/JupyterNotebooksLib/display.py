@@ -1,4 +1,6 @@
+import collections
 import ctk, qt, slicer, vtk
+from .output_cache import outputCache
 
 def displayable(obj):
   """Convert Slicer-specific objects to displayable objects.
@@ -28,96 +30,619 @@ def displayable(obj):
   # Unknown object
   return obj
 
-class ModelDisplay(object):
-  """This class displays a model node in a Jupyter notebook cell by rendering it as an image.
-    :param modelNode: model node to display.
-    :param imageSize: list containing width and height of the generated image, in pixels (default is `[300, 300]`).
-    :param zoom: allows zooming in on the rendered model (default: 1.0).
-    :param orientation: roll, pitch, yaw rotation angles of the camera, in degrees.
-    :param showFeatureEdges: outline sharp edges with lines to improve visibility.
-  """
+def _qImageToBytes(image, format="PNG", quality=-1):
+  """Encode a QImage (or QPixmap) in the specified file format and return the result as bytes."""
+  bArray = qt.QByteArray()
+  buffer = qt.QBuffer(bArray)
+  buffer.open(qt.QIODevice.WriteOnly)
+  image.save(buffer, format, quality)
+  return bArray.data()
 
-  def __init__(self, modelNode, imageSize=None, orientation=None, zoom=None, showFeatureEdges=False):
-    # rollPitchYawDeg
-    orientation = [0,0,0] if orientation is None else orientation
-    zoom = 1.0 if zoom is None else zoom
-    imageSize = [300,300] if imageSize is None else imageSize
-    showFeatureEdges = showFeatureEdges
+def _byteArrayToBytes(data):
+  return data.data() if isinstance(data, qt.QByteArray) else data
 
-    modelPolyData = modelNode.GetPolyData()
+def _captureRenderView(view, format="PNG", quality=-1, forceRender=True):
+  """Render a view (qMRMLSliceView, qMRMLThreeDView) and return its content as an encoded image (bytes).
+  The image is read and encoded by the JupyterKernel module, if available.
+  """
+  jupyterKernel = getattr(slicer.modules, "jupyterkernel", None)
+  if jupyterKernel:
+    data = _byteArrayToBytes(jupyterKernel.captureRenderView(view, format, quality, 0, forceRender))
+    if data:
+      return data
+  if forceRender:
+    view.forceRender()
+  return _qImageToBytes(view.grab(), format, quality)
+
+def _captureLayout(format="PNG", quality=-1):
+  """Capture all views of the current layout and return it as an encoded image (bytes)."""
+  jupyterKernel = getattr(slicer.modules, "jupyterkernel", None)
+  if jupyterKernel:
+    data = _byteArrayToBytes(jupyterKernel.captureLayout(format, quality, 0))
+    if data:
+      return data
+  return _qImageToBytes(slicer.app.layoutManager().viewport().grab(), format, quality)
+
+class _ViewChangeTracker(object):
+  """Determine if the content of a view may have changed since it was last captured.
+  It uses the scene change tracking of the JupyterKernel module logic. If it is not available
+  then views are always considered to be modified.
+  :param callback: if specified, it is called (when the application is idle) after any view
+    may have been modified. Call close() to stop calling it.
+  """
 
-    renderer = vtk.vtkRenderer()
-    renderer.SetBackground(1,1,1)
-    renderer.SetUseDepthPeeling(1)
-    renderer.SetMaximumNumberOfPeels(100)
-    renderer.SetOcclusionRatio(0.1)
-    renWin = vtk.vtkRenderWindow()
-    renWin.OffScreenRenderingOn()
-    renWin.SetSize(imageSize[0], imageSize[1])
-    renWin.SetAlphaBitPlanes(1)  # for depth peeling
-    renWin.SetMultiSamples(0)  # for depth peeling
-    renWin.AddRenderer(renderer)
+  def __init__(self, callback=None):
+    jupyterKernel = getattr(slicer.modules, "jupyterkernel", None)
+    logic = jupyterKernel.logic() if jupyterKernel else None
+    self._logic = logic if hasattr(logic, "GetViewChangeCounter") else None
+    self._capturedState = None
+    self._observation = None
+    self._notifyTimer = None
+    if self._logic and callback:
+      # Multiple modifications are reported with a single callback
+      self._notifyTimer = qt.QTimer()
+      self._notifyTimer.setSingleShot(True)
+      self._notifyTimer.setInterval(0)
+      self._notifyTimer.connect('timeout()', callback)
+      self._observation = self._logic.AddObserver(self._logic.ViewModifiedEvent, self._onViewModified)
+
+  def _onViewModified(self, caller, event):
+    self._notifyTimer.start()
+
+  @staticmethod
+  def _viewNode(view):
+    if hasattr(view, "mrmlSliceNode"):
+      return view.mrmlSliceNode()
+    elif hasattr(view, "mrmlViewNode"):
+      return view.mrmlViewNode()
+    return None
+
+  def _state(self, view):
+    viewNode = _ViewChangeTracker._viewNode(view)
+    if not viewNode:
+      return None
+    return (viewNode.GetID(), tuple(view.renderWindow().GetSize()), self._logic.GetViewChangeCounter(viewNode.GetID()))
+
+  def contentChangeCounter(self, view):
+    """Returns a value that changes when any node that may change the view content is modified,
+    except the view node itself (such as slice offset change). Returns None if change tracking is not available."""
+    if not self._logic or not hasattr(self._logic, "GetViewContentChangeCounter"):
+      return None
+    viewNode = _ViewChangeTracker._viewNode(view)
+    if not viewNode:
+      return None
+    return self._logic.GetViewContentChangeCounter(viewNode.GetID())
+
+  def isModified(self, view):
+    """Returns True if the view (qMRMLSliceView or qMRMLThreeDView) may have changed since setCaptured was called."""
+    if not self._logic:
+      return True
+    state = self._state(view)
+    return state is None or state != self._capturedState
+
+  def setCaptured(self, view):
+    """Store the current state of the view. Call it right after the view is captured."""
+    if self._logic:
+      self._capturedState = self._state(view)
+
+  def close(self):
+    if self._observation is not None:
+      self._logic.RemoveObserver(self._observation)
+      self._observation = None
+    if self._notifyTimer:
+      self._notifyTimer.stop()
+
+class ImageDisplay(object):
+  """Base class for objects that display an encoded image in a Jupyter notebook cell.
+  Image data is stored as raw bytes. When the object is displayed, the image is sent
+  to the notebook directly by the kernel, without creating a base64-encoded Python string.
+
+  Image data is kept in the output cache (see :py:func:`setOutputCacheLimit`), therefore
+  display objects kept in the notebook's output history do not increase memory usage
+  above the cache limit.
+  :param data: encoded image (bytes).
+  :param dataType: MIME type of the image, such as `image/png` or `image/jpeg`.
+  """
+
+  def __init__(self, data=None, dataType="image/png"):
+    self._dataKey = None
+    self.data = data
+    self.dataType = dataType
+
+  def __del__(self):
+    self._releaseData()
+
+  @property
+  def data(self):
+    """Encoded image (bytes). None if the data has been released from the output cache."""
+    if self._dataKey is None:
+      return None
+    return outputCache().get(self._dataKey)
+
+  @data.setter
+  def data(self, value):
+    self._releaseData()
+    if value is not None:
+      self._dataKey = outputCache().put(value)
+
+  def _releaseData(self):
+    if getattr(self, "_dataKey", None) is not None:
+      outputCache().release(self._dataKey)
+      self._dataKey = None
+
+  @property
+  def dataValue(self):
+    """Base64-encoded image data."""
+    import base64
+    data = self.data
+    return base64.b64encode(data).decode() if data is not None else None
+
+  def _ipython_display_(self):
+    data = self.data
+    if data is None:
+      from IPython.display import display
+      display({ "text/plain": "Image data has been released from the output cache." }, raw=True)
+      return
+    try:
+      if slicer.modules.jupyterkernel.displayImage(data, self.dataType):
+        return
+    except AttributeError:
+      # JupyterKernel module is not available
+      pass
+    from IPython.display import display
+    display(self._repr_mimebundle_(), raw=True)
 
-    renderer.GetActiveCamera()  # create active camera
+  def _repr_mimebundle_(self, include=None, exclude=None):
+    dataValue = self.dataValue
+    if dataValue is None:
+      return { "text/plain": "Image data has been released from the output cache." }
+    return { self.dataType: dataValue }
+
+class _OffscreenRenderer(object):
+  """Offscreen render window with a renderer and actors for displaying a model."""
+
+  def __init__(self, imageSize):
+    self.imageSize = imageSize
+
+    self.renderer = vtk.vtkRenderer()
+    self.renderer.SetBackground(1,1,1)
+    self.renderer.SetUseDepthPeeling(1)
+    self.renderer.SetMaximumNumberOfPeels(100)
+    self.renderer.SetOcclusionRatio(0.1)
+    self.renderWindow = vtk.vtkRenderWindow()
+    self.renderWindow.OffScreenRenderingOn()
+    self.renderWindow.SetSize(imageSize[0], imageSize[1])
+    self.renderWindow.SetAlphaBitPlanes(1)  # for depth peeling
+    self.renderWindow.SetMultiSamples(0)  # for depth peeling
+    self.renderWindow.AddRenderer(self.renderer)
+
+    self.renderer.GetActiveCamera()  # create active camera
 
     # Must be called after iren and renderer are linked and camera is created or there will be problems
-    renderer.Render()
+    self.renderer.Render()
+
+    self.modelMapper = vtk.vtkPolyDataMapper()
+    self.modelActor = vtk.vtkActor()
+    self.modelActor.SetMapper(self.modelMapper)
+    self.modelActor.GetProperty().SetColor(0.9, 0.9, 0.9)
+    self.modelActor.GetProperty().SetOpacity(0.8)
+    self.renderer.AddActor(self.modelActor)
+
+    self.edgesMapper = vtk.vtkPolyDataMapper()
+    self.edgesMapper.SetResolveCoincidentTopologyToPolygonOffset()
+    self.edgesActor = vtk.vtkActor()
+    self.edgesActor.SetMapper(self.edgesMapper)
+    self.edgesActor.GetProperty().SetColor(0.0, 0.0, 0.0)
+    self.renderer.AddActor(self.edgesActor)
+
+    self.windowToImageFilter = vtk.vtkWindowToImageFilter()
+    self.windowToImageFilter.SetInput(self.renderWindow)
+
+  def capture(self, surface, edges, orientation, zoom):
+    """Render the surface (and edges, if not None) and return the image as QImage."""
+    self.modelMapper.SetInputData(surface)
+    self.edgesMapper.SetInputData(edges if edges is not None else vtk.vtkPolyData())
+    self.edgesActor.SetVisibility(edges is not None)
+
+    # Start from default camera position at each capture
+    camera = vtk.vtkCamera()
+    self.renderer.SetActiveCamera(camera)
+    # Set projection to parallel to enable estimate distances
+    camera.ParallelProjectionOn()
+    camera.Roll(orientation[0])
+    camera.Pitch(orientation[1])
+    camera.Yaw(orientation[2])
+    self.renderer.ResetCamera()
+    camera.Zoom(zoom)
+
+    self.renderWindow.Render()
+    self.windowToImageFilter.Modified()
+    self.windowToImageFilter.Update()
+    image = ctk.ctkVTKWidgetsUtils.vtkImageDataToQImage(self.windowToImageFilter.GetOutput())
+
+    # Do not keep a reference to the displayed data in the pool
+    self.modelMapper.SetInputData(vtk.vtkPolyData())
+    self.edgesMapper.SetInputData(vtk.vtkPolyData())
+    return image
+
+class _OffscreenRendererPool(object):
+  """Reusable offscreen renderers, keyed by image size.
+  Creating a render window and OpenGL context is expensive, therefore they are kept for later use.
+  """
 
-    modelNormals = vtk.vtkPolyDataNormals()
-    modelNormals.SetInputData(modelPolyData)
+  def __init__(self, maxRenderersPerSize=2, maxImageSizes=4):
+    self.maxRenderersPerSize = maxRenderersPerSize
+    self.maxImageSizes = maxImageSizes
+    self._idleRenderers = collections.OrderedDict()  # (width, height) -> [renderers]
+
+  def acquire(self, imageSize):
+    key = (int(imageSize[0]), int(imageSize[1]))
+    renderers = self._idleRenderers.get(key)
+    if renderers:
+      self._idleRenderers.move_to_end(key)
+      return renderers.pop()
+    return _OffscreenRenderer(key)
+
+  def release(self, renderer):
+    key = renderer.imageSize
+    renderers = self._idleRenderers.setdefault(key, [])
+    self._idleRenderers.move_to_end(key)
+    if len(renderers) < self.maxRenderersPerSize:
+      renderers.append(renderer)
+    # Release renderers of least recently used image sizes
+    while len(self._idleRenderers) > self.maxImageSizes:
+      self._idleRenderers.popitem(last=False)
+
+  def clear(self):
+    self._idleRenderers.clear()
+
+class _ModelSurfaceCache(object):
+  """Stores processed (triangulated, decimated, normals, feature edges) surfaces of models.
+  Entries are keyed by the input polydata and its modification time, therefore
+  the surface is only processed again if the model is changed.
+  """
 
-    modelMapper = vtk.vtkPolyDataMapper()
-    modelMapper.SetInputConnection(modelNormals.GetOutputPort())
+  def __init__(self, maxEntries=8):
+    self.maxEntries = maxEntries
+    self._entries = collections.OrderedDict()
 
-    modelActor = vtk.vtkActor()
-    modelActor.SetMapper(modelMapper)
-    modelActor.GetProperty().SetColor(0.9, 0.9, 0.9)
-    modelActor.GetProperty().SetOpacity(0.8)
-    renderer.AddActor(modelActor)
+  def _entry(self, polyData, maxTriangles):
+    key = (polyData.GetAddressAsString("vtkPolyData"), polyData.GetMTime(), maxTriangles)
+    entry = self._entries.get(key)
+    if entry is not None:
+      self._entries.move_to_end(key)
+      return entry
 
     triangleFilter = vtk.vtkTriangleFilter()
-    triangleFilter.SetInputConnection(modelNormals.GetOutputPort())
-
-    if showFeatureEdges:
-
+    triangleFilter.SetInputData(polyData)
+    triangleFilter.Update()
+    triangles = triangleFilter.GetOutput()
+    if maxTriangles and triangles.GetNumberOfPolys() > maxTriangles:
+      # Rendering more triangles than pixels does not improve the image quality
+      decimation = vtk.vtkQuadricDecimation()
+      decimation.SetInputData(triangles)
+      decimation.SetTargetReduction(1.0 - float(maxTriangles) / triangles.GetNumberOfPolys())
+      decimation.Update()
+      triangles = decimation.GetOutput()
+
+    normals = vtk.vtkPolyDataNormals()
+    normals.SetInputData(triangles)
+    normals.Update()
+
+    entry = { "triangles": triangles, "surface": normals.GetOutput(), "edges": None }
+    self._entries[key] = entry
+    while len(self._entries) > self.maxEntries:
+      self._entries.popitem(last=False)
+    return entry
+
+  def surface(self, polyData, maxTriangles):
+    return self._entry(polyData, maxTriangles)["surface"]
+
+  def featureEdges(self, polyData, maxTriangles):
+    entry = self._entry(polyData, maxTriangles)
+    if entry["edges"] is None:
       edgeExtractor = vtk.vtkFeatureEdges()
-      edgeExtractor.SetInputConnection(triangleFilter.GetOutputPort())
+      edgeExtractor.SetInputData(entry["triangles"])
       edgeExtractor.ColoringOff()
       edgeExtractor.BoundaryEdgesOn()
       edgeExtractor.ManifoldEdgesOn()
       edgeExtractor.NonManifoldEdgesOn()
+      edgeExtractor.Update()
+      entry["edges"] = edgeExtractor.GetOutput()
+    return entry["edges"]
 
-      modelEdgesMapper = vtk.vtkPolyDataMapper()
-      modelEdgesMapper.SetInputConnection(edgeExtractor.GetOutputPort())
-      modelEdgesMapper.SetResolveCoincidentTopologyToPolygonOffset()
-      modelEdgesActor = vtk.vtkActor()
-      modelEdgesActor.SetMapper(modelEdgesMapper)
-      modelEdgesActor.GetProperty().SetColor(0.0, 0.0, 0.0)
-      renderer.AddActor(modelEdgesActor)
+  def clear(self):
+    self._entries.clear()
 
-    # Set projection to parallel to enable estimate distances
-    renderer.GetActiveCamera().ParallelProjectionOn()
-    renderer.GetActiveCamera().Roll(orientation[0])
-    renderer.GetActiveCamera().Pitch(orientation[1])
-    renderer.GetActiveCamera().Yaw(orientation[2])
-    renderer.ResetCamera()
-    renderer.GetActiveCamera().Zoom(zoom)
-
-    windowToImageFilter = vtk.vtkWindowToImageFilter()
-    windowToImageFilter.SetInput(renWin)
-    windowToImageFilter.Update()
-
-    screenshot = ctk.ctkVTKWidgetsUtils.vtkImageDataToQImage(windowToImageFilter.GetOutput())
-
-    bArray = qt.QByteArray()
-    buffer = qt.QBuffer(bArray)
-    buffer.open(qt.QIODevice.WriteOnly)
-    screenshot.save(buffer, "PNG")
-    self.dataValue = bArray.toBase64().data().decode()
-    self.dataType = "image/png"
+_offscreenRendererPool = _OffscreenRendererPool()
+_modelSurfaceCache = _ModelSurfaceCache()
+
+class ModelDisplay(ImageDisplay):
+  """This class displays a model node in a Jupyter notebook cell by rendering it as an image.
+    :param modelNode: model node to display.
+    :param imageSize: list containing width and height of the generated image, in pixels (default is `[300, 300]`).
+    :param zoom: allows zooming in on the rendered model (default: 1.0).
+    :param orientation: roll, pitch, yaw rotation angles of the camera, in degrees.
+    :param showFeatureEdges: outline sharp edges with lines to improve visibility.
+    :param maxTriangles: if the model has more triangles than this then it is decimated before rendering.
+      By default, the limit is `trianglesPerPixel` times the number of pixels in the image. Set to 0 to disable decimation.
+
+  Render windows are reused and processed surfaces are cached (until the model is modified),
+  therefore displaying many models or the same model many times is fast.
+  """
+
+  trianglesPerPixel = 2.0
+
+  def __init__(self, modelNode, imageSize=None, orientation=None, zoom=None, showFeatureEdges=False, maxTriangles=None):
+    # rollPitchYawDeg
+    orientation = [0,0,0] if orientation is None else orientation
+    zoom = 1.0 if zoom is None else zoom
+    imageSize = [300,300] if imageSize is None else imageSize
+    if maxTriangles is None:
+      maxTriangles = int(ModelDisplay.trianglesPerPixel * imageSize[0] * imageSize[1])
+
+    modelPolyData = modelNode.GetPolyData()
+    surface = _modelSurfaceCache.surface(modelPolyData, maxTriangles)
+    edges = _modelSurfaceCache.featureEdges(modelPolyData, maxTriangles) if showFeatureEdges else None
+
+    renderer = _offscreenRendererPool.acquire(imageSize)
+    try:
+      screenshot = renderer.capture(surface, edges, orientation, zoom)
+    finally:
+      _offscreenRendererPool.release(renderer)
+    super().__init__(_qImageToBytes(screenshot, "PNG"), "image/png")
+
+_meshViewerTemplate = """
+%(staticImage)s<canvas id="%(canvasId)s" width="%(width)d" height="%(height)d" style="display:none;width:%(width)dpx;height:%(height)dpx;touch-action:none;cursor:grab" title="Drag to rotate, scroll to zoom, double-click to reset"></canvas>
+<script>
+(function() {
+  var canvas = document.getElementById("%(canvasId)s");
+  // The static image remains visible if the script cannot display the mesh
+  // (scripts do not run in untrusted notebooks, nbviewer, and many exported documents)
+  function showMessage(message) {
+    if (!document.getElementById("%(canvasId)s-image")) { canvas.outerHTML = "<p>" + message + "</p>"; }
+  }
+  var gl = canvas.getContext("webgl2") || canvas.getContext("webgl");
+  if (!gl) { showMessage("WebGL is not available in this browser."); return; }
+  var isWebGL2 = (typeof WebGL2RenderingContext !== "undefined") && (gl instanceof WebGL2RenderingContext);
+
+  // Decode mesh (format is described in JupyterNotebooksLib.display.ModelMeshDisplay)
+  var binary = atob("%(meshData)s");
+  var bytes = new Uint8Array(binary.length);
+  for (var i = 0; i < binary.length; i++) { bytes[i] = binary.charCodeAt(i); }
+  var header = new DataView(bytes.buffer);
+  var indexSize = header.getUint16(6, true);
+  var vertexCount = header.getUint32(8, true);
+  var triangleCount = header.getUint32(12, true);
+  var boundsMin = [header.getFloat32(16, true), header.getFloat32(20, true), header.getFloat32(24, true)];
+  var boundsMax = [header.getFloat32(28, true), header.getFloat32(32, true), header.getFloat32(36, true)];
+  var offset = 40;
+  var positions = new Uint16Array(bytes.buffer, offset, vertexCount * 3);
+  offset += vertexCount * 6;
+  var normals = new Int8Array(bytes.buffer, offset, vertexCount * 3);
+  offset = (offset + vertexCount * 3 + 3) & ~3;
+  var indexType = gl.UNSIGNED_SHORT;
+  var indices = null;
+  if (indexSize === 4) {
+    if (!isWebGL2 && !gl.getExtension("OES_element_index_uint")) { showMessage("Mesh is too large for this browser."); return; }
+    indexType = gl.UNSIGNED_INT;
+    indices = new Uint32Array(bytes.buffer, offset, triangleCount * 3);
+  } else {
+    indices = new Uint16Array(bytes.buffer, offset, triangleCount * 3);
+  }
+
+  function compileShader(type, source) {
+    var shader = gl.createShader(type);
+    gl.shaderSource(shader, source);
+    gl.compileShader(shader);
+    return shader;
+  }
+  var program = gl.createProgram();
+  gl.attachShader(program, compileShader(gl.VERTEX_SHADER,
+    "attribute vec3 position; attribute vec3 normal;" +
+    "uniform mat4 modelView; uniform mat4 projection; uniform vec3 boundsMin; uniform vec3 boundsSize;" +
+    "varying vec3 viewNormal;" +
+    "void main() {" +
+    "  viewNormal = (modelView * vec4(normal, 0.0)).xyz;" +
+    "  gl_Position = projection * modelView * vec4(boundsMin + position * boundsSize, 1.0);" +
+    "}"));
+  gl.attachShader(program, compileShader(gl.FRAGMENT_SHADER,
+    "precision mediump float; uniform vec4 color; varying vec3 viewNormal;" +
+    "void main() {" +
+    "  float diffuse = abs(normalize(viewNormal).z);" +
+    "  gl_FragColor = vec4(color.rgb * (0.3 + 0.7 * diffuse), color.a);" +
+    "}"));
+  gl.linkProgram(program);
+  gl.useProgram(program);
+
+  function createBuffer(target, data) {
+    var buffer = gl.createBuffer();
+    gl.bindBuffer(target, buffer);
+    gl.bufferData(target, data, gl.STATIC_DRAW);
+    return buffer;
+  }
+  createBuffer(gl.ARRAY_BUFFER, positions);
+  var positionLocation = gl.getAttribLocation(program, "position");
+  gl.enableVertexAttribArray(positionLocation);
+  gl.vertexAttribPointer(positionLocation, 3, gl.UNSIGNED_SHORT, true, 0, 0);
+  createBuffer(gl.ARRAY_BUFFER, normals);
+  var normalLocation = gl.getAttribLocation(program, "normal");
+  gl.enableVertexAttribArray(normalLocation);
+  gl.vertexAttribPointer(normalLocation, 3, gl.BYTE, true, 0, 0);
+  createBuffer(gl.ELEMENT_ARRAY_BUFFER, indices);
+
+  var boundsSize = [0, 1, 2].map(function(i) { return boundsMax[i] - boundsMin[i]; });
+  var center = [0, 1, 2].map(function(i) { return (boundsMin[i] + boundsMax[i]) / 2; });
+  var radius = Math.max(1e-6, Math.sqrt(boundsSize[0] * boundsSize[0] + boundsSize[1] * boundsSize[1] + boundsSize[2] * boundsSize[2]) / 2);
+  gl.uniform3fv(gl.getUniformLocation(program, "boundsMin"), boundsMin);
+  gl.uniform3fv(gl.getUniformLocation(program, "boundsSize"), boundsSize);
+  gl.uniform4fv(gl.getUniformLocation(program, "color"), [%(color)s]);
+  gl.enable(gl.DEPTH_TEST);
+  if (%(opacity)f < 1.0) {
+    gl.enable(gl.BLEND);
+    gl.blendFunc(gl.SRC_ALPHA, gl.ONE_MINUS_SRC_ALPHA);
+  }
+
+  // Column-major 4x4 matrices
+  function multiply(a, b) {
+    var result = new Float32Array(16);
+    for (var column = 0; column < 4; column++) {
+      for (var row = 0; row < 4; row++) {
+        var sum = 0;
+        for (var k = 0; k < 4; k++) { sum += a[k * 4 + row] * b[column * 4 + k]; }
+        result[column * 4 + row] = sum;
+      }
+    }
+    return result;
+  }
+  function rotation(axis, angle) {
+    var c = Math.cos(angle), s = Math.sin(angle);
+    if (axis === 0) { return new Float32Array([1,0,0,0, 0,c,s,0, 0,-s,c,0, 0,0,0,1]); }
+    return new Float32Array([c,0,-s,0, 0,1,0,0, s,0,c,0, 0,0,0,1]);
+  }
+  function translation(x, y, z) {
+    return new Float32Array([1,0,0,0, 0,1,0,0, 0,0,1,0, x,y,z,1]);
+  }
+  function perspective(fieldOfView, aspect, near, far) {
+    var f = 1.0 / Math.tan(fieldOfView / 2);
+    return new Float32Array([f / aspect,0,0,0, 0,f,0,0, 0,0,(far + near) / (near - far),-1, 0,0,2 * far * near / (near - far),0]);
+  }
+
+  // Initial view: anterior, superior direction pointing up
+  var initialRotation = multiply(rotation(1, Math.PI), rotation(0, -Math.PI / 2));
+  var modelRotation = initialRotation;
+  var zoom = 1.0;
+  var fieldOfView = 30 * Math.PI / 180;
+  function render() {
+    var distance = radius / Math.sin(fieldOfView / 2) / zoom;
+    var modelView = multiply(translation(0, 0, -distance), multiply(modelRotation, translation(-center[0], -center[1], -center[2])));
+    var projection = perspective(fieldOfView, canvas.width / canvas.height, Math.max(distance - radius * 1.5, distance * 0.01), distance + radius * 1.5);
+    gl.uniformMatrix4fv(gl.getUniformLocation(program, "modelView"), false, modelView);
+    gl.uniformMatrix4fv(gl.getUniformLocation(program, "projection"), false, projection);
+    gl.viewport(0, 0, canvas.width, canvas.height);
+    gl.clearColor(1, 1, 1, 1);
+    gl.clear(gl.COLOR_BUFFER_BIT | gl.DEPTH_BUFFER_BIT);
+    gl.drawElements(gl.TRIANGLES, triangleCount * 3, indexType, 0);
+  }
+
+  var lastPosition = null;
+  canvas.addEventListener("pointerdown", function(event) {
+    lastPosition = [event.clientX, event.clientY];
+    canvas.setPointerCapture(event.pointerId);
+  });
+  canvas.addEventListener("pointermove", function(event) {
+    if (!lastPosition) { return; }
+    var dx = event.clientX - lastPosition[0], dy = event.clientY - lastPosition[1];
+    lastPosition = [event.clientX, event.clientY];
+    // Rotate around the screen axes
+    modelRotation = multiply(rotation(1, dx * 0.01), multiply(rotation(0, dy * 0.01), modelRotation));
+    requestAnimationFrame(render);
+  });
+  canvas.addEventListener("pointerup", function(event) { lastPosition = null; });
+  canvas.addEventListener("wheel", function(event) {
+    event.preventDefault();
+    zoom = Math.min(100, Math.max(0.01, zoom * Math.exp(-event.deltaY * 0.001)));
+    requestAnimationFrame(render);
+  });
+  canvas.addEventListener("dblclick", function(event) {
+    modelRotation = initialRotation;
+    zoom = 1.0;
+    requestAnimationFrame(render);
+  });
+  var staticImage = document.getElementById("%(canvasId)s-image");
+  if (staticImage) { staticImage.remove(); }
+  canvas.style.display = "";
+  render();
+})();
+</script>
+"""
+
+class ModelMeshDisplay(ImageDisplay):
+  """This class displays a model node in a Jupyter notebook cell in an interactive 3D viewer.
+  The mesh is sent to the notebook once, then rotation (drag) and zoom (mouse wheel)
+  are performed in the web browser (using WebGL), without running any code in Slicer.
+    :param modelNode: model node to display.
+    :param imageSize: list containing width and height of the viewer, in pixels (default is `[400, 400]`).
+    :param maxTriangles: if the model has more triangles than this then it is decimated
+      before it is sent to the notebook (default: 100000). Set to 0 to disable decimation.
+    :param staticImage: also render the model as an image (using :py:class:`ModelDisplay`), which is displayed
+      where the viewer script cannot run, such as untrusted notebooks, nbviewer, or exported HTML (default: True).
+
+  Mesh data format (little endian): 40-byte header (magic "SMSH", uint16 version, uint16 index size in bytes,
+  uint32 vertex count, uint32 triangle count, float32 bounds minimum[3], float32 bounds maximum[3]),
+  uint16 positions[vertex count * 3] (quantized within the bounds), int8 normals[vertex count * 3],
+  padding to 4 bytes, uint16 or uint32 triangle vertex indices[triangle count * 3].
+  """
+
+  def __init__(self, modelNode, imageSize=None, maxTriangles=None, staticImage=True):
+    self.imageSize = [400,400] if imageSize is None else imageSize
+    maxTriangles = 100000 if maxTriangles is None else maxTriangles
+    displayNode = modelNode.GetDisplayNode()
+    self.color = displayNode.GetColor() if displayNode else (0.9, 0.9, 0.9)
+    self.opacity = displayNode.GetOpacity() if displayNode else 1.0
+    surface = _modelSurfaceCache.surface(modelNode.GetPolyData(), maxTriangles)
+    super().__init__(ModelMeshDisplay.encodeMesh(surface), "application/vnd.slicer.mesh")
+    # Rendered once, the processed surface and the renderer are reused from the ModelDisplay caches
+    self.staticImage = ModelDisplay(modelNode, imageSize=self.imageSize) if staticImage else None
+
+  @staticmethod
+  def encodeMesh(surface):
+    """Encode a triangulated vtkPolyData that has point normals in the compact binary mesh format."""
+    import struct
+    import numpy as np
+    from vtk.util.numpy_support import vtk_to_numpy
+
+    if surface.GetNumberOfPoints() > 0:
+      points = vtk_to_numpy(surface.GetPoints().GetData()).astype(np.float64)
+    else:
+      points = np.zeros([0, 3])
+    normalsArray = surface.GetPointData().GetNormals()
+    normals = vtk_to_numpy(normalsArray) if normalsArray else np.zeros(points.shape)
+    triangles = vtk_to_numpy(surface.GetPolys().GetConnectivityArray()).reshape(-1, 3)
+
+    boundsMin = points.min(axis=0) if len(points) else np.zeros(3)
+    boundsMax = points.max(axis=0) if len(points) else np.zeros(3)
+    boundsSize = np.maximum(boundsMax - boundsMin, 1e-12)
+    quantizedPositions = np.round((points - boundsMin) / boundsSize * 65535).astype("<u2")
+    quantizedNormals = np.clip(np.round(normals * 127), -127, 127).astype(np.int8)
+    indexType = "<u2" if len(points) <= 65536 else "<u4"
+    indices = triangles.astype(indexType)
+
+    header = struct.pack("<4sHHII3f3f", b"SMSH", 1, indices.itemsize, len(points), len(triangles),
+      *boundsMin.tolist(), *boundsMax.tolist())
+    positionsAndNormals = quantizedPositions.tobytes() + quantizedNormals.tobytes()
+    padding = b"\0" * ((4 - len(positionsAndNormals) % 4) % 4)
+    return header + positionsAndNormals + padding + indices.tobytes()
+
+  def _ipython_display_(self):
+    from IPython.display import display
+    display(self._repr_mimebundle_(), raw=True)
 
   def _repr_mimebundle_(self, include=None, exclude=None):
-    return { self.dataType: self.dataValue }
+    import base64, uuid
+    data = self.data
+    if data is None:
+      return { "text/plain": "Mesh data has been released from the output cache." }
+    canvasId = "slicer-mesh-" + uuid.uuid4().hex
+    staticImageValue = self.staticImage.dataValue if self.staticImage else None
+    staticImageHtml = ""
+    if staticImageValue is not None:
+      staticImageHtml = '<img id="%s-image" src="data:image/png;base64,%s" width="%d" height="%d" alt="Model">' % (
+        canvasId, staticImageValue, self.imageSize[0], self.imageSize[1])
+    html = _meshViewerTemplate % {
+      "canvasId": canvasId,
+      "staticImage": staticImageHtml,
+      "width": self.imageSize[0],
+      "height": self.imageSize[1],
+      "meshData": base64.b64encode(data).decode(),
+      "color": ", ".join(str(c) for c in self.color) + ", " + str(self.opacity),
+      "opacity": self.opacity
+      }
+    bundle = { "text/html": html, "text/plain": "Model mesh viewer" }
+    if staticImageValue is not None:
+      # Frontends that do not render HTML display the image
+      bundle["image/png"] = staticImageValue
+    return bundle
 
 class TransformDisplay(object):
   """This class displays information about a transform in a Jupyter notebook cell.
@@ -140,7 +665,7 @@ class TransformDisplay(object):
     return { "text/html": self.dataValue }
 
 
-class ViewDisplay(object):
+class ViewDisplay(ImageDisplay):
   """This class captures current views and makes it available
   for display in the output of a Jupyter notebook cell.
   :param viewLayout: view layout name, most common ones are
@@ -160,18 +685,11 @@ class ViewDisplay(object):
     slicer.util.setViewControllersVisible(False)
     slicer.app.processEvents()
     slicer.util.forceRenderAllViews()
-    screenshot = layoutManager.viewport().grab()
+    data = _captureLayout("PNG")
     slicer.util.setViewControllersVisible(True)
-    bArray = qt.QByteArray()
-    buffer = qt.QBuffer(bArray)
-    buffer.open(qt.QIODevice.WriteOnly)
-    screenshot.save(buffer, "PNG")
-    self.dataValue = bArray.toBase64().data().decode()
-    self.dataType = "image/png"
-  def _repr_mimebundle_(self, include=None, exclude=None):
-    return { self.dataType: self.dataValue }
+    super().__init__(data, "image/png")
 
-class ViewSliceDisplay(object):
+class ViewSliceDisplay(ImageDisplay):
   """This class captures a slice view and makes it available
   for display in the output of a Jupyter notebook cell.
   :param viewName: name of the slice view, such as `Red`, `Green`, `Yellow`.
@@ -191,20 +709,9 @@ class ViewSliceDisplay(object):
       position = positionMin + positionPercent / 100.0 * (positionMax - positionMin)
       sliceWidget.sliceController().sliceOffsetSlider().setValue(position)
     sliceView = sliceWidget.sliceView()
-    sliceView.forceRender()
-    screenshot = sliceView.grab()
-    bArray = qt.QByteArray()
-    buffer = qt.QBuffer(bArray)
-    buffer.open(qt.QIODevice.WriteOnly)
-    #screenshot.save(buffer, "PNG")
-    screenshot.save(buffer, "JPG")
-    self.dataValue = bArray.toBase64().data().decode()
-    #self.dataType = "image/png"
-    self.dataType = "image/jpeg"
-  def _repr_mimebundle_(self, include=None, exclude=None):
-    return { self.dataType: self.dataValue }
+    super().__init__(_captureRenderView(sliceView, "JPG"), "image/jpeg")
 
-class View3DDisplay(object):
+class View3DDisplay(ImageDisplay):
   """This class captures a 3D view and makes it available
   for display in the output of a Jupyter notebook cell.
   :param viewID: integer index of the 3D view node. Valid values are between 0 and `slicer.app.layoutManager().threeDViewCount-1`.
@@ -230,21 +737,10 @@ class View3DDisplay(object):
       camera.SetPosition(focalPoint[0]+position[0], focalPoint[1]+position[1], focalPoint[2]+position[2])
       camera.SetViewUp(viewUp[0:3])
       camera.OrthogonalizeViewUp()
-    view.forceRender()
-    screenshot = view.grab()
-    bArray = qt.QByteArray()
-    buffer = qt.QBuffer(bArray)
-    buffer.open(qt.QIODevice.WriteOnly)
-    #screenshot.save(buffer, "PNG")
-    screenshot.save(buffer, "JPG")
-    self.dataValue = bArray.toBase64().data().decode()
-    #dataType = "image/png"
-    self.dataType = "image/jpeg"
-  def _repr_mimebundle_(self, include=None, exclude=None):
-    return { self.dataType: self.dataValue }
+    super().__init__(_captureRenderView(view, "JPG"), "image/jpeg")
 
 
-class ViewLightboxDisplay(object):
+class ViewLightboxDisplay(ImageDisplay):
   """This class returns an image containing content of a slice view as it is sweeped over the displayed volume
   as an object to be displayed in a Jupyter notebook cell.
   :param viewName: :param viewName: name of the slice view, such as `Red`, `Green`, `Yellow`.
@@ -255,6 +751,7 @@ class ViewLightboxDisplay(object):
     along the slice normal.
   :param rangeShrink: list of two float values, which modify the position range (positive value shrinks the range, on both sides).
     Useful for cropping irrelevant regions near the image boundaries.
+  :param filename: if specified then the lightbox image is also saved to this file (PNG format).
   """
 
   def __init__(self, viewName=None, rows=None, columns=None, filename=None, positionRange=None, rangeShrink=None):
@@ -275,39 +772,49 @@ class ViewLightboxDisplay(object):
       slicePositionRange[0] += rangeShrink[0]
       slicePositionRange[1] -= rangeShrink[1]
 
-    # Capture red slice view, 30 images, from position -125.0 to 75.0
-    # into current folder, with name image_00001.png, image_00002.png, ...
-    import ScreenCapture
-    screenCaptureLogic = ScreenCapture.ScreenCaptureLogic()
-    destinationFolder = 'outputs/Capture-SliceSweep'
+    # Render the slices and tile them into a single image, in memory
+    jupyterKernel = getattr(slicer.modules, "jupyterkernel", None)
+    data = None
+    if jupyterKernel:
+      data = _byteArrayToBytes(jupyterKernel.captureLightbox(sliceWidget, rows, columns,
+        slicePositionRange[0], slicePositionRange[1], "PNG", -1, 0))
+    if not data:
+      data = _qImageToBytes(ViewLightboxDisplay._captureLightboxImage(sliceWidget, rows, columns, slicePositionRange), "PNG")
+    super().__init__(data, "image/png")
+
+    if filename:
+      with open(filename, "wb") as file:
+        file.write(data)
+
+  @staticmethod
+  def _captureLightboxImage(sliceWidget, rows, columns, slicePositionRange):
+    """Fallback for when the JupyterKernel module is not available: grab each slice and paint it into the mosaic."""
+    sliceLogic = sliceWidget.sliceLogic()
+    sliceView = sliceWidget.sliceView()
+    originalOffset = sliceLogic.GetSliceOffset()
     numberOfFrames = rows*columns
-    filenamePattern = "_lightbox_tmp_image_%05d.png"
-    viewNode = sliceWidget.mrmlSliceNode()
-    # Suppress log messages
-    def noLog(msg):
-        pass
-    screenCaptureLogic.addLog=noLog
-    # Capture images
-    screenCaptureLogic.captureSliceSweep(viewNode, slicePositionRange[0], slicePositionRange[1],
-                                         numberOfFrames, destinationFolder, filenamePattern)
-    # Create lightbox image
-    resultImageFilename = filename if filename else filenamePattern % numberOfFrames
-    screenCaptureLogic.createLightboxImage(columns, destinationFolder, filenamePattern, numberOfFrames, resultImageFilename)
-
-    # Save result
-    with open(destinationFolder+"/"+resultImageFilename, "rb") as file:
-      self.dataValue = file.read()
-      self.dataType = "image/png"
-      # This could be used to create an image widget: img = Image(value=image, format='png')
-
-    # Clean up
-    screenCaptureLogic.deleteTemporaryFiles(destinationFolder, filenamePattern, numberOfFrames if filename else numberOfFrames+1)
-
-  def _repr_mimebundle_(self, include=None, exclude=None):
-    import base64
-    return { self.dataType: base64.b64encode(self.dataValue).decode() }
-
-class MatplotlibDisplay(object):
+    lightboxImage = None
+    painter = None
+    try:
+      for frameIndex in range(numberOfFrames):
+        offset = slicePositionRange[0]
+        if numberOfFrames > 1:
+          offset += (slicePositionRange[1] - slicePositionRange[0]) * frameIndex / (numberOfFrames - 1)
+        sliceLogic.SetSliceOffset(offset)
+        sliceView.forceRender()
+        frame = sliceView.grab().toImage()
+        if lightboxImage is None:
+          lightboxImage = qt.QImage(frame.width()*columns, frame.height()*rows, qt.QImage.Format_RGB32)
+          lightboxImage.fill(qt.Qt.black)
+          painter = qt.QPainter(lightboxImage)
+        painter.drawImage((frameIndex % columns) * frame.width(), (frameIndex // columns) * frame.height(), frame)
+    finally:
+      if painter:
+        painter.end()
+      sliceLogic.SetSliceOffset(originalOffset)
+    return lightboxImage
+
+class MatplotlibDisplay(ImageDisplay):
   """Display matplotlib plot in a notebook cell.
 
   This helper function will probably not needed after this issue is fixed:
@@ -339,17 +846,10 @@ class MatplotlibDisplay(object):
 
   """
   def __init__(self, fig):
-    filename = "__matplotlib_temp.png"
-    fig.savefig(filename)
-    with open(filename, "rb") as file:
-      self.dataValue = file.read()
-      self.dataType = "image/png"
-    import os
-    os.remove(filename)
-
-  def _repr_mimebundle_(self, include=None, exclude=None):
-    import base64
-    return { self.dataType: base64.b64encode(self.dataValue).decode() }
+    import io
+    buffer = io.BytesIO()
+    fig.savefig(buffer, format="png")
+    super().__init__(buffer.getvalue(), "image/png")
 
 # Utility functions for customizing what is shown in views
 
@@ -1,16 +1,311 @@
 import qt, slicer
-from ipycanvas import Canvas
+import anywidget
+from traitlets import Bool, CFloat, CInt, Unicode
+from .display import _byteArrayToBytes, _captureRenderView, _ViewChangeTracker
 
-class ViewInteractiveWidget(Canvas):
+# Browser-side part of the widget: sends batches of mouse and keyboard events to the kernel
+# and draws the received frames (complete images or changed tiles) on a canvas.
+#
+# Events are sent to the "slicer_view_interaction" comm target of the kernel, which feeds them
+# directly into the view's interactor, without running Python code. If that comm cannot be opened
+# (the kernel does not provide it or the frontend cannot open comms) then events are sent to
+# ViewInteractiveWidget in Python. Both use the same message format (see xSlicerViewInteraction.h).
+_interactiveViewWidgetModule = """
+const renderPriority = { none: 0, quick: 1, full: 2 };
+
+// VTK does not process these keys on their own, no need to render after them
+const modifierKeys = ["Shift", "Control", "Alt", "Meta"];
+
+function render({ model, el }) {
+  const canvas = document.createElement("canvas");
+  // Allow the canvas to receive keyboard events and prevent notebook shortcuts while it has the focus
+  canvas.tabIndex = 0;
+  canvas.dataset.lmSuppressShortcuts = "true";
+  canvas.style.outline = "none";
+  canvas.style.maxWidth = "100%";
+  el.appendChild(canvas);
+
+  let channel = null;
+  let closed = false;
+
+  // Events that are not sent yet and the highest render quality they need
+  let pendingEvents = [];
+  let pendingRender = "none";
+  let pendingSettings = false;
+  // Last mouse move while no button is pressed, sent before the next event
+  let hoverEvent = null;
+  let dragging = false;
+
+  // Only one batch is sent at a time: the next batch is sent when the frame of the previous batch is received.
+  // This adapts the frame rate to the speed of the kernel and the network.
+  let waitingForFrame = false;
+  let waitingTimer = null;
+  let sendTimer = null;
+  let fullRenderTimer = null;
+  let lastSendTime = 0;
+
+  // Frames are drawn in the order they are received
+  let drawing = Promise.resolve();
+
+  function drawFrame(content, buffers) {
+    const tiles = content.tiles || [];
+    drawing = drawing.then(async () => {
+      const bitmaps = await Promise.all(tiles.map(
+        (tile, index) => createImageBitmap(new Blob([buffers[index]], { type: tile.mimeType }))));
+      if (canvas.width !== content.width || canvas.height !== content.height) {
+        // Resizing clears the canvas, the kernel sends a complete image when the view size changes
+        canvas.width = content.width;
+        canvas.height = content.height;
+      }
+      const context = canvas.getContext("2d");
+      tiles.forEach((tile, index) => {
+        context.drawImage(bitmaps[index], tile.x, tile.y, tile.width, tile.height);
+        bitmaps[index].close();
+      });
+    }).catch((error) => console.warn("ViewInteractiveWidget: cannot draw frame", error));
+  }
+
+  function settings() {
+    return { quality: model.get("compressionQuality"), autoUpdate: model.get("autoUpdate") };
+  }
+
+  function send() {
+    sendTimer = null;
+    if (!channel || (pendingEvents.length === 0 && pendingRender === "none" && !pendingSettings)) {
+      return;
+    }
+    const content = Object.assign({ events: pendingEvents, render: pendingRender }, settings());
+    pendingEvents = [];
+    pendingRender = "none";
+    pendingSettings = false;
+    channel.send(content);
+    lastSendTime = performance.now();
+    if (content.render !== "none") {
+      waitingForFrame = true;
+      // Do not wait forever if a frame is lost
+      waitingTimer = setTimeout(frameReceived, 2000);
+    }
+    clearTimeout(fullRenderTimer);
+    fullRenderTimer = null;
+    if (content.render === "quick") {
+      // Send a lossless image when interaction is paused
+      fullRenderTimer = setTimeout(() => requestRender("full"), model.get("fullRenderDelaySec") * 1000);
+    }
+  }
+
+  function scheduleSend() {
+    if (!channel || waitingForFrame || sendTimer !== null) {
+      return;
+    }
+    const delayMsec = Math.max(0, lastSendTime + model.get("quickRenderDelaySec") * 1000 - performance.now());
+    sendTimer = setTimeout(send, delayMsec);
+  }
+
+  function frameReceived() {
+    waitingForFrame = false;
+    clearTimeout(waitingTimer);
+    waitingTimer = null;
+    scheduleSend();
+  }
+
+  function requestRender(render) {
+    if (renderPriority[render] > renderPriority[pendingRender]) {
+      pendingRender = render;
+    }
+    scheduleSend();
+  }
+
+  function queueEvent(event, render) {
+    if (hoverEvent && event.event !== "mousemove") {
+      // The interactor needs the last mouse position before button and key events
+      pendingEvents.push(hoverEvent);
+    }
+    hoverEvent = null;
+    const lastEvent = pendingEvents[pendingEvents.length - 1];
+    if (event.event === "mousemove" && lastEvent && lastEvent.event === "mousemove") {
+      // Only the last position matters
+      pendingEvents[pendingEvents.length - 1] = event;
+    } else {
+      pendingEvents.push(event);
+    }
+    requestRender(render);
+  }
+
+  function modifiers(event) {
+    return { shiftKey: event.shiftKey, ctrlKey: event.ctrlKey, altKey: event.altKey };
+  }
+
+  function pointerEvent(type, event) {
+    // Position in image pixels, from the top-left corner (the canvas may be displayed scaled)
+    const rect = canvas.getBoundingClientRect();
+    const x = Math.round((event.clientX - rect.left) * canvas.width / Math.max(rect.width, 1));
+    const y = Math.round((event.clientY - rect.top) * canvas.height / Math.max(rect.height, 1));
+    return Object.assign({ event: type, x: x, y: y, button: event.button }, modifiers(event));
+  }
+
+  function onMessage(source, content, buffers) {
+    if (content.type === "render") {
+      // Render request from Python (e.g., ViewInteractiveWidget.fullRender())
+      requestRender(content.render || "full");
+      return;
+    }
+    if (source !== channel) {
+      return;
+    }
+    if (content.type === "frame") {
+      drawFrame(content, buffers);
+    }
+    if (content.type === "frame" || content.type === "skipped") {
+      frameReceived();
+    }
+  }
+
+  const pythonChannel = { send: (content) => model.send(content), close: () => {} };
+  const onCustomMessage = (content, buffers) => onMessage(pythonChannel, content, buffers);
+  model.on("msg:custom", onCustomMessage);
+
+  function usePythonChannel() {
+    if (closed || channel === pythonChannel) {
+      return;
+    }
+    channel = pythonChannel;
+    waitingForFrame = false;
+    clearTimeout(waitingTimer);
+    waitingTimer = null;
+    requestRender("full");
+  }
+
+  async function openChannel() {
+    const manager = model.widget_manager;
+    if (!model.get("nativeInteraction") || !manager || typeof manager._create_comm !== "function") {
+      usePythonChannel();
+      return;
+    }
+    try {
+      const openData = Object.assign({ view: model.get("viewLabel"), format: "JPG", delta: model.get("deltaEncoding") }, settings());
+      const comm = await manager._create_comm("slicer_view_interaction", undefined, openData);
+      if (closed) {
+        comm.close();
+        return;
+      }
+      const nativeChannel = { send: (content) => comm.send(content), close: () => comm.close() };
+      let nativeChannelConfirmed = false;
+      // The comm is closed by the kernel if the comm target is not available or the view is not found
+      comm.on_close(() => {
+        if (channel === nativeChannel) {
+          usePythonChannel();
+        }
+      });
+      comm.on_msg((message) => {
+        nativeChannelConfirmed = true;
+        onMessage(nativeChannel, message.content.data, message.buffers || []);
+      });
+      channel = nativeChannel;
+      // The kernel sends the first frame when the comm is opened. If nothing is received
+      // then the kernel does not handle this comm target.
+      waitingForFrame = true;
+      waitingTimer = setTimeout(() => {
+        if (channel === nativeChannel && !nativeChannelConfirmed) {
+          usePythonChannel();
+        } else {
+          frameReceived();
+        }
+      }, 5000);
+    } catch (error) {
+      console.warn("ViewInteractiveWidget: cannot open view interaction comm, events are processed in Python", error);
+      usePythonChannel();
+    }
+  }
+
+  canvas.addEventListener("pointerdown", (event) => {
+    event.preventDefault();
+    canvas.focus();
+    canvas.setPointerCapture(event.pointerId);
+    dragging = true;
+    queueEvent(pointerEvent("mousedown", event), "quick");
+  });
+  canvas.addEventListener("pointermove", (event) => {
+    const moveEvent = pointerEvent("mousemove", event);
+    if (dragging || model.get("trackMouseMove")) {
+      queueEvent(moveEvent, "quick");
+    } else {
+      hoverEvent = moveEvent;
+    }
+  });
+  canvas.addEventListener("pointerup", (event) => {
+    if (!dragging) {
+      return;
+    }
+    dragging = false;
+    canvas.releasePointerCapture(event.pointerId);
+    queueEvent(pointerEvent("mouseup", event), "full");
+  });
+  canvas.addEventListener("pointerenter", (event) => queueEvent(pointerEvent("mouseenter", event), "quick"));
+  canvas.addEventListener("pointerleave", (event) => {
+    if (!dragging) {
+      queueEvent(pointerEvent("mouseleave", event), "quick");
+    }
+  });
+  for (const type of ["keydown", "keyup"]) {
+    canvas.addEventListener(type, (event) => {
+      event.preventDefault();
+      event.stopPropagation();
+      const render = modifierKeys.includes(event.key) ? "none" : "full";
+      queueEvent(Object.assign({ event: type, key: event.key }, modifiers(event)), render);
+    });
+  }
+  // Right button is used for zooming
+  canvas.addEventListener("contextmenu", (event) => event.preventDefault());
+
+  const onSettingsChanged = () => {
+    pendingSettings = true;
+    scheduleSend();
+  };
+  model.on("change:compressionQuality", onSettingsChanged);
+  model.on("change:autoUpdate", onSettingsChanged);
+
+  openChannel();
+
+  return () => {
+    closed = true;
+    clearTimeout(sendTimer);
+    clearTimeout(waitingTimer);
+    clearTimeout(fullRenderTimer);
+    model.off("msg:custom", onCustomMessage);
+    model.off("change:compressionQuality", onSettingsChanged);
+    model.off("change:autoUpdate", onSettingsChanged);
+    if (channel) {
+      channel.close();
+    }
+  };
+}
+
+export default { render };
+"""
+
+class ViewInteractiveWidget(anywidget.AnyWidget):
   """Remote controller for Slicer viewers.
+
+  Mouse and keyboard events are collected in the web browser and sent to Slicer in batches.
+  Events are passed directly to the view's interactor by the kernel (without running Python code)
+  and only the changed parts of the view image are sent back to the notebook.
+
   :param layoutLabel: specify view by label (displayed in the view's header in the layout, such as R, Y, G, 1)
   :param renderView: specify view by renderView object (ctkVTKRenderView).
   """
 
-  def __init__(self, layoutLabel=None, renderView=None, **kwargs):
-    from ipyevents import Event
-    #import time
+  _esm = _interactiveViewWidgetModule
 
+  viewLabel = Unicode("", help="Layout label of the view").tag(sync=True)
+  compressionQuality = CInt(50, help="Quality of JPEG images sent during interaction (0-100)").tag(sync=True)
+  trackMouseMove = Bool(False, help="Refresh if mouse is just moving (not dragging)").tag(sync=True)
+  autoUpdate = Bool(True, help="Update the image when the view is changed by other means than this widget").tag(sync=True)
+  deltaEncoding = Bool(True, help="Only send the changed parts of the view image").tag(sync=True)
+  quickRenderDelaySec = CFloat(0.02, help="Minimum time between sending batches of events").tag(sync=True)
+  fullRenderDelaySec = CFloat(0.5, help="Time after the last interaction when a lossless image is requested").tag(sync=True)
+  nativeInteraction = Bool(True, help="Send events to the kernel's view interaction comm target").tag(sync=True)
+
+  def __init__(self, layoutLabel=None, renderView=None, **kwargs):
     super().__init__(**kwargs)
 
     # Find renderView from layoutLabel
@@ -38,54 +333,31 @@ class ViewInteractiveWidget(Canvas):
         raise ValueError("renderView is not specified")
 
     self.renderView = renderView
-
-    # Frame rate (1/renderDelay)
-    self.lastRenderTime = 0
-    self.quickRenderDelaySec = 0.1
-    self.quickRenderDelaySecRange = [0.02, 2.0]
-    self.adaptiveRenderDelay = True
-    self.lastMouseMoveEvent = None
-
-    # Quality vs performance
-    self.compressionQuality = 50
-    self.trackMouseMove = False  # refresh if mouse is just moving (not dragging)
-
-    self.messageTimestampOffset = None
-
-    # If not receiving new rendering request for 10ms then a render is requested
-    self.fullRenderRequestTimer = qt.QTimer()
-    self.fullRenderRequestTimer.setSingleShot(True)
-    self.fullRenderRequestTimer.setInterval(500)
-    self.fullRenderRequestTimer.connect('timeout()', self.fullRender)
-
-    # If not receiving new rendering request for 10ms then a render is requested
-    self.quickRenderRequestTimer = qt.QTimer()
-    self.quickRenderRequestTimer.setSingleShot(True)
-    self.quickRenderRequestTimer.setInterval(self.quickRenderDelaySec*1000)
-    self.quickRenderRequestTimer.connect('timeout()', self.quickRender)
-
-    # Get image size
-    image = self.getImage()
-    self.width=image.width
-    self.height=image.height
-    self.draw_image(image)
+    viewNode = _ViewChangeTracker._viewNode(renderView)
+    self.viewLabel = viewNode.GetLayoutLabel() if viewNode else ""
+    self.quickRenderDelaySecRange = [0.0, 2.0]
 
     self.interactor = self.renderView.interactorStyle().GetInteractor()
+    self.dragging = False
+
+    # Events are processed in Python only if the frontend cannot send them to the kernel's comm target
+    self._pythonInteraction = False
+
+    # Encode images in background threads, so that the next frame can be rendered
+    # while the previous one is encoded. Frames that are not sent by the time
+    # a newer frame is available are dropped.
+    self._jupyterKernel = getattr(slicer.modules, "jupyterkernel", None)
+    self.asyncEncoding = hasattr(self._jupyterKernel, "captureRenderViewAsync")
+    self._frameStreamId = "ViewInteractiveWidget-{0}".format(id(self))
+    self._keyframeInterval = 30
+    if self.asyncEncoding:
+      self._jupyterKernel.connect('viewFrameTilesEncoded(QString,QVariantList,int,int,bool)', self._onFrameTilesEncoded)
+      self._updateFrameStream()
 
-    self.dragging=False
-
-    self.interactionEvents = Event()
-    self.interactionEvents.source = self
-    self.interactionEvents.watched_events = [
-        'dragstart', 'mouseenter', 'mouseleave',
-        'mousedown', 'mouseup', 'mousemove',
-        #'wheel',  # commented out so that user can scroll through the notebook using mousewheel
-        'keyup', 'keydown',
-        'contextmenu' # prevent context menu from appearing on right-click
-        ]
-    #self.interactionEvents.msg_throttle = 1  # does not seem to have effect
-    self.interactionEvents.prevent_default_action = True
-    self.interactionEvents.on_dom_event(self.handleInteractionEvent)
+    # Update the image when the view is changed by other means than interacting with this widget
+    # (for example, by executing a notebook cell). If events are sent to the comm target then
+    # the kernel updates the image.
+    self._viewChangeTracker = _ViewChangeTracker(self._onViewModified)
 
     self.keyToSym = {
       'ArrowLeft': 'Left',
@@ -131,158 +403,174 @@ class ViewInteractiveWidget(Canvas):
     # this variable can be used to retrieve error messages
     self.error = None
 
-    # Enable logging of UI events
+    # Enable logging of UI events (only events that are processed in Python are logged)
     self.logEvents = False
     self.loggedEvents = []
-    self.elapsedTimes = []
-    self.ageOfProcessedMessages = []
+
+    self.on_msg(self._onFrontendMessage)
 
   def setQuickRenderDelay(self, delaySec):
-    """Delay this much after a view update before sending a low-resolution update."""
+    """Minimum time between sending events (and receiving images) during interaction."""
     if delaySec<self.quickRenderDelaySecRange[0]:
         delaySec = self.quickRenderDelaySecRange[0]
     elif delaySec>self.quickRenderDelaySecRange[1]:
         delaySec = self.quickRenderDelaySecRange[1]
     self.quickRenderDelaySec = delaySec
-    self.quickRenderRequestTimer.setInterval(self.quickRenderDelaySec*1000)
 
   def setFullRenderDelay(self, delaySec):
-    """Delay this much after a view update before sending a full-resolution update."""
-    self.fullRenderRequestTimer.setInterval(delaySec)
+    """Delay this much after the last interaction before sending a full-quality update."""
+    self.fullRenderDelaySec = delaySec
 
   def getImage(self, compress=True, forceRender=True):
     """Retrieve an image from the view."""
     from ipywidgets import Image
+    imageData, width, height = self._captureImage(compress, forceRender)
+    return Image(value=imageData, width=width, height=height)
+
+  def _captureImage(self, compress=True, forceRender=True):
+    """Returns encoded image of the view, width, height."""
     slicer.app.processEvents()
-    if forceRender:
-      self.renderView.forceRender()
-    screenshot = self.renderView.grab()
-    bArray = qt.QByteArray()
-    buffer = qt.QBuffer(bArray)
-    buffer.open(qt.QIODevice.WriteOnly)
     if compress:
-      screenshot.save(buffer, "JPG", self.compressionQuality)
+      imageData = _captureRenderView(self.renderView, "JPG", self.compressionQuality, forceRender=forceRender)
     else:
-      screenshot.save(buffer, "PNG")
-    return Image(value=bArray.data(), width=screenshot.width(), height=screenshot.height())
+      imageData = _captureRenderView(self.renderView, "PNG", forceRender=forceRender)
+    self._viewChangeTracker.setCaptured(self.renderView)
+    # Image is read from the render window, therefore its size is the render window size (in physical pixels)
+    width, height = self.renderView.renderWindow().GetSize()
+    return imageData, width, height
+
+  def close(self):
+    self._viewChangeTracker.close()
+    if self.asyncEncoding:
+      self._jupyterKernel.clearFrameStream(self._frameStreamId)
+      self._jupyterKernel.disconnect('viewFrameTilesEncoded(QString,QVariantList,int,int,bool)', self._onFrameTilesEncoded)
+      self.asyncEncoding = False
+    super().close()
+
+  def setDeltaEncoding(self, enabled, keyframeInterval=30):
+    """Only send changed regions of the view image (in 64x64 pixel tiles).
+    The complete image is sent after keyframeInterval partial updates.
+    Takes effect for views of the widget that are displayed after this call.
+    """
+    self.deltaEncoding = enabled
+    self._keyframeInterval = keyframeInterval
+    if self.asyncEncoding:
+      self._updateFrameStream()
+
+  def _updateFrameStream(self):
+    # Frames are always reported as tiles. If delta encoding is disabled then each frame is a keyframe.
+    self._jupyterKernel.setFrameStreamDeltaEncoding(self._frameStreamId, True,
+      self._keyframeInterval if self.deltaEncoding else 0)
 
   def fullRender(self):
-    """Perform a full render now."""
+    """Request a full-quality image of the view."""
+    self.send({"type": "render", "render": "full"})
+
+  def quickRender(self):
+    """Request a compressed image of the view."""
+    self.send({"type": "render", "render": "quick"})
+
+  def _onViewModified(self):
     try:
-      import time
-      self.fullRenderRequestTimer.stop()
-      self.quickRenderRequestTimer.stop()
-      self.draw_image(self.getImage(compress=False, forceRender=True))
-      self.lastRenderTime = time.time()
+      if (not self._pythonInteraction or not self.autoUpdate or self.dragging
+        or not self._viewChangeTracker.isModified(self.renderView)):
+        return
+      self.requestImage(compress=False, forceRender=True)
     except Exception as e:
       self.error = str(e)
 
-  def sendPendingMouseMoveEvent(self):
-    if self.lastMouseMoveEvent is not None:
-      self.updateInteractorEventData(self.lastMouseMoveEvent)
-      self.interactor.MouseMoveEvent()
-      self.lastMouseMoveEvent = None
-
-  def quickRender(self):
-    """Perform a quick render now."""
+  def _onFrontendMessage(self, widget, content, buffers):
+    """Process events that the frontend could not send to the kernel's view interaction comm target."""
     try:
-      import time
-      self.fullRenderRequestTimer.stop()
-      self.quickRenderRequestTimer.stop()
-      self.sendPendingMouseMoveEvent()
-      self.draw_image(self.getImage(compress=True, forceRender=False))
-      self.fullRenderRequestTimer.start()
-      if self.logEvents: self.elapsedTimes.append(time.time()-self.lastRenderTime)
-      self.lastRenderTime = time.time()
+      self._pythonInteraction = True
+      if "quality" in content:
+        self.compressionQuality = content["quality"]
+      if "autoUpdate" in content:
+        self.autoUpdate = content["autoUpdate"]
+      for event in content.get("events", []):
+        if self.logEvents:
+          self.loggedEvents.append(event)
+        self.handleInteractionEvent(event)
+      render = content.get("render", "quick")
+      if render != "none":
+        self.requestImage(compress=(render == "quick"), forceRender=True)
     except Exception as e:
       self.error = str(e)
 
-  def updateInteractorEventData(self, event):
-    try:
-      if event['event']=='keydown' or event['event']=='keyup':
-        key = event['key']
-        sym = self.keyToSym[key] if key in self.keyToSym.keys() else key
-        self.interactor.SetKeySym(sym)
-        if len(key) == 1:
-          self.interactor.SetKeyCode(key)
-        self.interactor.SetRepeatCount(1)
+  def requestImage(self, compress=True, forceRender=True):
+    """Render the view and send its image to the frontend when encoding is completed in the background.
+    The image is sent immediately if background encoding is not available.
+    """
+    if self.asyncEncoding:
+      if compress:
+        submitted = self._jupyterKernel.captureRenderViewAsync(self.renderView, self._frameStreamId,
+          "JPG", self.compressionQuality, 0, forceRender)
       else:
-        self.interactor.SetEventPosition(event['offsetX'], self.height-event['offsetY'])
-      self.interactor.SetShiftKey(event['shiftKey'])
-      self.interactor.SetControlKey(event['ctrlKey'])
-      self.interactor.SetAltKey(event['altKey'])
+        submitted = self._jupyterKernel.captureRenderViewAsync(self.renderView, self._frameStreamId,
+          "PNG", -1, 0, forceRender)
+      if submitted:
+        self._viewChangeTracker.setCaptured(self.renderView)
+        return
+    imageData, width, height = self._captureImage(compress=compress, forceRender=forceRender)
+    tile = {"x": 0, "y": 0, "width": width, "height": height, "mimeType": "image/jpeg" if compress else "image/png"}
+    self.send({"type": "frame", "width": width, "height": height, "keyframe": True, "tiles": [tile]}, [imageData])
+
+  def _onFrameTilesEncoded(self, streamId, tiles, width, height, keyframe):
+    if streamId != self._frameStreamId:
+      return
+    try:
+      tileInfos = []
+      tileData = []
+      for tile in tiles:
+        tileInfos.append({"x": tile["x"], "y": tile["y"], "width": tile["width"], "height": tile["height"],
+          "mimeType": tile["mimeType"]})
+        tileData.append(_byteArrayToBytes(tile["data"]))
+      self.send({"type": "frame", "width": width, "height": height, "keyframe": keyframe, "tiles": tileInfos}, tileData)
     except Exception as e:
       self.error = str(e)
 
+  def updateInteractorEventData(self, event):
+    if event['event']=='keydown' or event['event']=='keyup':
+      key = event['key']
+      sym = self.keyToSym[key] if key in self.keyToSym.keys() else key
+      self.interactor.SetKeySym(sym)
+      if len(key) == 1:
+        self.interactor.SetKeyCode(key)
+      self.interactor.SetRepeatCount(1)
+    else:
+      height = self.renderView.renderWindow().GetSize()[1]
+      self.interactor.SetEventPosition(event['x'], height-event['y'])
+    self.interactor.SetShiftKey(event['shiftKey'])
+    self.interactor.SetControlKey(event['ctrlKey'])
+    self.interactor.SetAltKey(event['altKey'])
+
   def handleInteractionEvent(self, event):
-    try:
-      if self.logEvents:
-        self.loggedEvents.append(event)
-      if event['event']=='mousemove':
-        import time
-        if self.messageTimestampOffset is None:
-            self.messageTimestampOffset = time.time()-event['timeStamp']*0.001
-        self.lastMouseMoveEvent = event
-        if not self.dragging and not self.trackMouseMove:
-            return
-        if self.adaptiveRenderDelay:
-            ageOfProcessedMessage = time.time()-(event['timeStamp']*0.001+self.messageTimestampOffset)
-            if ageOfProcessedMessage > 1.5 * self.quickRenderDelaySec:
-                # we are falling behind, try to render less frequently
-                self.setQuickRenderDelay(self.quickRenderDelaySec * 1.05)
-            elif ageOfProcessedMessage < 0.5 * self.quickRenderDelaySec:
-                # we can keep up with events, try to render more frequently
-                self.setQuickRenderDelay(self.quickRenderDelaySec / 1.05)
-            if self.logEvents: self.ageOfProcessedMessages.append([ageOfProcessedMessage, self.quickRenderDelaySec])
-        # We need to render something now it no rendering since self.quickRenderDelaySec
-        if time.time()-self.lastRenderTime > self.quickRenderDelaySec:
-            self.quickRender()
-        else:
-            self.quickRenderRequestTimer.start()
-      elif event['event']=='mouseenter':
-        self.updateInteractorEventData(event)
-        self.interactor.EnterEvent()
-        self.lastMouseMoveEvent = None
-        self.quickRenderRequestTimer.start()
-      elif event['event']=='mouseleave':
-        self.updateInteractorEventData(event)
-        self.interactor.LeaveEvent()
-        self.lastMouseMoveEvent = None
-        self.quickRenderRequestTimer.start()
-      elif event['event']=='mousedown':
-        self.dragging=True
-        self.sendPendingMouseMoveEvent()
-        self.updateInteractorEventData(event)
-        if event['button'] == 0:
-          self.interactor.LeftButtonPressEvent()
-        elif event['button'] == 2:
-          self.interactor.RightButtonPressEvent()
-        elif event['button'] == 1:
-          self.interactor.MiddleButtonPressEvent()
-        self.fullRender()
-      elif event['event']=='mouseup':
-        self.sendPendingMouseMoveEvent()
-        self.updateInteractorEventData(event)
-        if event['button'] == 0:
-          self.interactor.LeftButtonReleaseEvent()
-        elif event['button'] == 2:
-          self.interactor.RightButtonReleaseEvent()
-        elif event['button'] == 1:
-          self.interactor.MiddleButtonReleaseEvent()
-        self.dragging=False
-        self.fullRender()
-      elif event['event']=='keydown':
-        self.sendPendingMouseMoveEvent()
-        self.updateInteractorEventData(event)
-        self.interactor.KeyPressEvent()
-        self.interactor.CharEvent()
-        if event['key'] != 'Shift' and event['key'] != 'Control' and event['key'] != 'Alt':
-          self.fullRender()
-      elif event['event']=='keyup':
-        self.sendPendingMouseMoveEvent()
-        self.updateInteractorEventData(event)
-        self.interactor.KeyReleaseEvent()
-        if event['key'] != 'Shift' and event['key'] != 'Control' and event['key'] != 'Alt':
-          self.fullRender()
-    except Exception as e:
-        self.error = str(e)
+    """Pass an event received from the frontend to the view's interactor."""
+    self.updateInteractorEventData(event)
+    if event['event']=='mousemove':
+      self.interactor.MouseMoveEvent()
+    elif event['event']=='mouseenter':
+      self.interactor.EnterEvent()
+    elif event['event']=='mouseleave':
+      self.interactor.LeaveEvent()
+    elif event['event']=='mousedown':
+      self.dragging=True
+      if event['button'] == 0:
+        self.interactor.LeftButtonPressEvent()
+      elif event['button'] == 2:
+        self.interactor.RightButtonPressEvent()
+      elif event['button'] == 1:
+        self.interactor.MiddleButtonPressEvent()
+    elif event['event']=='mouseup':
+      if event['button'] == 0:
+        self.interactor.LeftButtonReleaseEvent()
+      elif event['button'] == 2:
+        self.interactor.RightButtonReleaseEvent()
+      elif event['button'] == 1:
+        self.interactor.MiddleButtonReleaseEvent()
+      self.dragging=False
+    elif event['event']=='keydown':
+      self.interactor.KeyPressEvent()
+      self.interactor.CharEvent()
+    elif event['event']=='keyup':
+      self.interactor.KeyReleaseEvent()
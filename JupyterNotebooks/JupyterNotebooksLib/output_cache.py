@@ -0,0 +1,153 @@
+import atexit
+import collections
+import itertools
+import os
+import shutil
+import tempfile
+import threading
+
+class OutputCache(object):
+  """Size-limited storage for large output payloads (such as encoded images) of display objects.
+
+  Display objects that are kept alive by the notebook's output history (`Out`, `_`, ...)
+  only hold a key to their payload. The most recently used payloads are kept in memory,
+  up to the specified byte budget. When the budget is exceeded, least recently used payloads
+  are written to a temporary folder (if `spillToDisk` is enabled) or released.
+
+  :param maxBytes: maximum total size of payloads kept in memory.
+  :param spillToDisk: write evicted payloads to disk, so that they can be retrieved later.
+    If disabled, evicted payloads are discarded.
+  """
+
+  def __init__(self, maxBytes=256*1024*1024, spillToDisk=True):
+    self.maxBytes = maxBytes
+    self.spillToDisk = spillToDisk
+    self._memoryItems = collections.OrderedDict()
+    self._spilledItems = {}
+    self._memoryBytes = 0
+    self._spillDirectory = None
+    self._nextKey = itertools.count(1)
+    self._lock = threading.Lock()
+    self.evictedCount = 0
+
+  def put(self, data):
+    """Store data (bytes) and return a key that can be used to retrieve it."""
+    with self._lock:
+      key = next(self._nextKey)
+      self._memoryItems[key] = data
+      self._memoryBytes += len(data)
+      self._evict()
+      return key
+
+  def get(self, key):
+    """Retrieve data by key. Returns None if the data has been released."""
+    with self._lock:
+      data = self._memoryItems.get(key)
+      if data is not None:
+        self._memoryItems.move_to_end(key)
+        return data
+      filePath = self._spilledItems.get(key)
+      if filePath is None:
+        return None
+      try:
+        with open(filePath, "rb") as file:
+          data = file.read()
+      except OSError:
+        return None
+      # Load it back into memory, as it is likely to be used again soon
+      os.remove(filePath)
+      del self._spilledItems[key]
+      self._memoryItems[key] = data
+      self._memoryBytes += len(data)
+      self._evict(keep=key)
+      return data
+
+  def release(self, key):
+    """Remove data from the cache (when the display object that uses it is deleted)."""
+    with self._lock:
+      data = self._memoryItems.pop(key, None)
+      if data is not None:
+        self._memoryBytes -= len(data)
+      filePath = self._spilledItems.pop(key, None)
+      if filePath is not None:
+        try:
+          os.remove(filePath)
+        except OSError:
+          pass
+
+  def setLimit(self, maxBytes, spillToDisk=None):
+    """Change the maximum memory usage of the cache. Excess items are evicted immediately."""
+    with self._lock:
+      self.maxBytes = maxBytes
+      if spillToDisk is not None:
+        self.spillToDisk = spillToDisk
+      self._evict()
+
+  def clear(self):
+    """Release all stored data."""
+    with self._lock:
+      self._memoryItems.clear()
+      self._spilledItems.clear()
+      self._memoryBytes = 0
+      self._removeSpillDirectory()
+
+  @property
+  def memoryBytes(self):
+    """Total size of payloads that are currently kept in memory."""
+    return self._memoryBytes
+
+  @property
+  def spilledCount(self):
+    """Number of payloads that are currently stored on disk."""
+    return len(self._spilledItems)
+
+  def _evict(self, keep=None):
+    while self._memoryBytes > self.maxBytes and len(self._memoryItems) > 0:
+      key, data = next(iter(self._memoryItems.items()))
+      if key == keep:
+        # the only item that is left is the one that is being accessed
+        if len(self._memoryItems) == 1:
+          break
+        self._memoryItems.move_to_end(key)
+        continue
+      del self._memoryItems[key]
+      self._memoryBytes -= len(data)
+      self.evictedCount += 1
+      if self.spillToDisk:
+        self._spill(key, data)
+
+  def _spill(self, key, data):
+    try:
+      if self._spillDirectory is None:
+        self._spillDirectory = tempfile.mkdtemp(prefix="SlicerJupyterOutputCache-")
+        atexit.register(self._removeSpillDirectory)
+      filePath = os.path.join(self._spillDirectory, "{0}.bin".format(key))
+      with open(filePath, "wb") as file:
+        file.write(data)
+      self._spilledItems[key] = filePath
+    except OSError:
+      # Disk is not available, the data is released
+      pass
+
+  def _removeSpillDirectory(self):
+    if self._spillDirectory is not None:
+      shutil.rmtree(self._spillDirectory, ignore_errors=True)
+      self._spillDirectory = None
+
+_outputCache = None
+
+def outputCache():
+  """Get the output cache that stores payloads of display objects."""
+  global _outputCache
+  if _outputCache is None:
+    _outputCache = OutputCache()
+  return _outputCache
+
+def setOutputCacheLimit(maxBytes, spillToDisk=True):
+  """Set maximum memory usage of display object payloads (such as screenshots).
+
+  Least recently used payloads above this limit are written to a temporary folder
+  (if spillToDisk is True) or released (if spillToDisk is False; in this case
+  old outputs cannot be displayed again).
+  """
+  outputCache().setLimit(maxBytes, spillToDisk)
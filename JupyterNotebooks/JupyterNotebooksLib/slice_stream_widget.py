@@ -0,0 +1,278 @@
+import struct
+import slicer
+import anywidget
+from traitlets import Bytes, CFloat, Unicode, observe
+
+# Browser-side part of the widget: maps raw slice values to colors and draws them on a canvas.
+_sliceStreamWidgetModule = """
+function toBytes(value) {
+  // Binary traits are received as DataView or ArrayBuffer
+  if (value instanceof DataView) {
+    return new Uint8Array(value.buffer, value.byteOffset, value.byteLength);
+  }
+  return new Uint8Array(value);
+}
+
+function decodeSlice(buffer) {
+  // Format is described in ViewSliceStreamWidget.encodeSlice
+  const header = new DataView(buffer.buffer, buffer.byteOffset, 24);
+  const width = header.getUint32(8, true);
+  const height = header.getUint32(12, true);
+  const scale = header.getFloat32(16, true);
+  const offset = header.getFloat32(20, true);
+  const values = new Uint16Array(buffer.buffer.slice(buffer.byteOffset + 24, buffer.byteOffset + 24 + width * height * 2));
+  return { width, height, scale, offset, values };
+}
+
+function render({ model, el }) {
+  const container = document.createElement("div");
+  const slider = document.createElement("input");
+  slider.type = "range";
+  slider.style.width = "100%";
+  const canvas = document.createElement("canvas");
+  canvas.style.imageRendering = "pixelated";
+  canvas.style.cursor = "crosshair";
+  canvas.title = "Drag: adjust window/level, Ctrl+wheel: zoom, double-click: reset";
+  container.appendChild(slider);
+  container.appendChild(canvas);
+  el.appendChild(container);
+
+  let slice = null;
+  let colors = null;
+
+  function updateSlider() {
+    slider.min = model.get("offsetMin");
+    slider.max = model.get("offsetMax");
+    slider.step = model.get("offsetStep") > 0 ? model.get("offsetStep") : "any";
+    slider.value = model.get("offset");
+  }
+
+  // Color of each possible stored value, recomputed only when window/level or lookup table changes
+  function updateColors() {
+    if (!slice) {
+      return;
+    }
+    const windowWidth = Math.max(model.get("window"), 1e-6);
+    const lowerValue = model.get("level") - windowWidth / 2;
+    const lookupTable = toBytes(model.get("lookupTable"));
+    const tableSize = lookupTable.length / 4;
+    colors = new Uint32Array(65536);
+    const colorBytes = new Uint8Array(colors.buffer);
+    for (let storedValue = 0; storedValue < 65536; storedValue++) {
+      const value = storedValue * slice.scale + slice.offset;
+      const ratio = Math.min(1, Math.max(0, (value - lowerValue) / windowWidth));
+      const tableIndex = Math.round(ratio * (tableSize - 1)) * 4;
+      colorBytes[storedValue * 4] = lookupTable[tableIndex];
+      colorBytes[storedValue * 4 + 1] = lookupTable[tableIndex + 1];
+      colorBytes[storedValue * 4 + 2] = lookupTable[tableIndex + 2];
+      colorBytes[storedValue * 4 + 3] = 255;
+    }
+  }
+
+  function draw() {
+    if (!slice || !colors) {
+      return;
+    }
+    if (canvas.width !== slice.width || canvas.height !== slice.height) {
+      canvas.width = slice.width;
+      canvas.height = slice.height;
+    }
+    const zoom = model.get("zoom");
+    canvas.style.width = (slice.width * zoom) + "px";
+    canvas.style.height = (slice.height * zoom) + "px";
+    const image = new ImageData(slice.width, slice.height);
+    const pixels = new Uint32Array(image.data.buffer);
+    // Slice rows are stored bottom to top
+    for (let y = 0; y < slice.height; y++) {
+      const sourceRow = (slice.height - 1 - y) * slice.width;
+      const targetRow = y * slice.width;
+      for (let x = 0; x < slice.width; x++) {
+        pixels[targetRow + x] = colors[slice.values[sourceRow + x]];
+      }
+    }
+    canvas.getContext("2d").putImageData(image, 0, 0);
+  }
+
+  function updateSlice() {
+    const data = model.get("sliceData");
+    slice = (data && data.byteLength >= 24) ? decodeSlice(toBytes(data)) : null;
+    updateColors();
+    draw();
+  }
+
+  slider.addEventListener("input", () => {
+    model.set("offset", parseFloat(slider.value));
+    model.save_changes();
+  });
+
+  let dragStart = null;
+  canvas.addEventListener("pointerdown", (event) => {
+    dragStart = { x: event.clientX, y: event.clientY, window: model.get("window"), level: model.get("level") };
+    canvas.setPointerCapture(event.pointerId);
+  });
+  canvas.addEventListener("pointermove", (event) => {
+    if (!dragStart || !slice) {
+      return;
+    }
+    // Same as in Slicer: horizontal drag changes window, vertical drag changes level
+    const valueRange = 65535 * slice.scale;
+    const sensitivity = valueRange / 500;
+    model.set("window", Math.max(1e-6, dragStart.window + (event.clientX - dragStart.x) * sensitivity));
+    model.set("level", dragStart.level - (event.clientY - dragStart.y) * sensitivity);
+    model.save_changes();
+  });
+  canvas.addEventListener("pointerup", () => { dragStart = null; });
+  canvas.addEventListener("wheel", (event) => {
+    // Plain mouse wheel is used for scrolling the notebook
+    if (!event.ctrlKey) {
+      return;
+    }
+    event.preventDefault();
+    model.set("zoom", Math.min(16, Math.max(0.125, model.get("zoom") * Math.exp(-event.deltaY * 0.002))));
+    model.save_changes();
+  });
+  canvas.addEventListener("dblclick", () => {
+    model.set("window", model.get("defaultWindow"));
+    model.set("level", model.get("defaultLevel"));
+    model.set("zoom", 1.0);
+    model.save_changes();
+  });
+
+  model.on("change:sliceData", updateSlice);
+  model.on("change:window", () => { updateColors(); draw(); });
+  model.on("change:level", () => { updateColors(); draw(); });
+  model.on("change:lookupTable", () => { updateColors(); draw(); });
+  model.on("change:zoom", draw);
+  model.on("change:offset", updateSlider);
+  model.on("change:offsetMin", updateSlider);
+  model.on("change:offsetMax", updateSlider);
+  updateSlider();
+  updateSlice();
+}
+
+export default { render };
+"""
+
+class ViewSliceStreamWidget(anywidget.AnyWidget):
+  """Slice viewer widget that applies window/level, color lookup table, and zoom in the web browser.
+
+  Instead of rendered images, raw voxel values of the current slice of the background volume
+  are sent to the notebook (as 16-bit integers). Changing window/level (by dragging in the image)
+  or zoom (Ctrl + mouse wheel) does not require any communication with Slicer.
+  Slicer only reslices the volume when the slice offset is changed.
+
+  :param viewName: name of the slice view, such as `Red`, `Green`, `Yellow`.
+    The slice orientation, field of view, and background volume of this view are used.
+  """
+
+  _esm = _sliceStreamWidgetModule
+
+  viewName = Unicode(default_value="Red", help="Slice view name.").tag(sync=True)
+  sliceData = Bytes(default_value=b"", help="Encoded slice values.").tag(sync=True)
+  lookupTable = Bytes(default_value=b"", help="Color lookup table (RGBA, 8 bits per component).").tag(sync=True)
+  window = CFloat(1.0, help="Window width").tag(sync=True)
+  level = CFloat(0.0, help="Window center").tag(sync=True)
+  defaultWindow = CFloat(1.0, help="Window width of the volume's display node").tag(sync=True)
+  defaultLevel = CFloat(0.0, help="Window center of the volume's display node").tag(sync=True)
+  zoom = CFloat(1.0, help="Display scaling factor").tag(sync=True)
+  offset = CFloat(0.0, help="Slice offset").tag(sync=True)
+  offsetMin = CFloat(0.0, help="Min value").tag(sync=True)
+  offsetMax = CFloat(100.0, help="Max value").tag(sync=True)
+  offsetStep = CFloat(1.0, help="Slice spacing").tag(sync=True)
+
+  def __init__(self, viewName=None, **kwargs):
+    super().__init__(**kwargs)
+    if viewName:
+      self.viewName = viewName
+    self._updateOffsetRange()
+    self.offset = self._sliceLogic().GetSliceOffset()
+    self.updateWindowLevel()
+    self.updateImage()
+
+  def _sliceLogic(self):
+    return slicer.app.layoutManager().sliceWidget(self.viewName).sliceLogic()
+
+  def _updateOffsetRange(self):
+    sliceLogic = self._sliceLogic()
+    sliceBounds = [0,0,0,0,0,0]
+    sliceLogic.GetLowestVolumeSliceBounds(sliceBounds)
+    self.offsetMin = sliceBounds[4]
+    self.offsetMax = sliceBounds[5]
+    self.offsetStep = sliceLogic.GetLowestVolumeSliceSpacing()[2]
+
+  @observe("offset")
+  def _propagate_offset(self, change):
+    sliceLogic = self._sliceLogic()
+    if sliceLogic.GetSliceOffset() != change["new"]:
+      sliceLogic.SetSliceOffset(change["new"])
+    self.updateImage()
+
+  @observe("viewName")
+  def _propagate_viewName(self, change):
+    self._updateOffsetRange()
+    self.offset = self._sliceLogic().GetSliceOffset()
+    self.updateWindowLevel()
+    self.updateImage()
+
+  def updateWindowLevel(self):
+    """Get window/level and color lookup table from the display node of the background volume."""
+    volumeNode = self._sliceLogic().GetBackgroundLayer().GetVolumeNode()
+    displayNode = volumeNode.GetDisplayNode() if volumeNode else None
+    if not displayNode or not hasattr(displayNode, "GetWindow"):
+      self.lookupTable = ViewSliceStreamWidget.encodeLookupTable(None)
+      return
+    self.defaultWindow = displayNode.GetWindow()
+    self.defaultLevel = displayNode.GetLevel()
+    self.window = self.defaultWindow
+    self.level = self.defaultLevel
+    self.lookupTable = ViewSliceStreamWidget.encodeLookupTable(displayNode.GetColorNode())
+
+  def updateImage(self):
+    """Reslice the background volume at the current slice position and send the values to the notebook."""
+    layerLogic = self._sliceLogic().GetBackgroundLayer()
+    volumeNode = layerLogic.GetVolumeNode()
+    if not volumeNode or not volumeNode.GetImageData():
+      self.sliceData = b""
+      return
+    reslice = layerLogic.GetReslice()
+    reslice.Update()
+    self.sliceData = ViewSliceStreamWidget.encodeSlice(reslice.GetOutput(), volumeNode.GetImageData().GetScalarRange())
+
+  @staticmethod
+  def encodeSlice(imageData, scalarRange):
+    """Encode the first component of a 2D image as 16-bit values.
+
+    Format (little endian): magic "SSLC", uint16 version, uint16 reserved, uint32 width, uint32 height,
+    float32 scale, float32 offset, uint16 values[width * height] (rows from bottom to top).
+    Voxel value = stored value * scale + offset.
+    """
+    import numpy as np
+    from vtk.util.numpy_support import vtk_to_numpy
+    dimensions = imageData.GetDimensions()
+    scalars = vtk_to_numpy(imageData.GetPointData().GetScalars())
+    if scalars.ndim > 1:
+      scalars = scalars[:, 0]
+    valueOffset = scalarRange[0]
+    valueSpan = scalarRange[1] - scalarRange[0]
+    integerValues = np.issubdtype(scalars.dtype, np.integer)
+    # Integer values are sent without loss if they fit in 16 bits
+    scale = 1.0 if (integerValues and valueSpan <= 65535) else max(valueSpan, 1e-12) / 65535.0
+    storedValues = np.clip(np.round((scalars.astype(np.float64) - valueOffset) / scale), 0, 65535).astype("<u2")
+    header = struct.pack("<4sHHIIff", b"SSLC", 1, 0, dimensions[0], dimensions[1], scale, valueOffset)
+    return header + storedValues.tobytes()
+
+  @staticmethod
+  def encodeLookupTable(colorNode, numberOfColors=256):
+    """Sample a color node into an RGBA table (8 bits per component). Grayscale is used if colorNode is None."""
+    import numpy as np
+    if colorNode is None or colorNode.GetScalarsToColors() is None:
+      ramp = np.linspace(0, 255, numberOfColors).round().astype(np.uint8)
+      return np.stack([ramp, ramp, ramp, np.full(numberOfColors, 255, np.uint8)], axis=1).tobytes()
+    scalarsToColors = colorNode.GetScalarsToColors()
+    valueRange = scalarsToColors.GetRange()
+    table = np.zeros([numberOfColors, 4], np.uint8)
+    color = [0.0, 0.0, 0.0]
+    for index, value in enumerate(np.linspace(valueRange[0], valueRange[1], numberOfColors)):
+      scalarsToColors.GetColor(value, color)
+      table[index] = [round(color[0] * 255), round(color[1] * 255), round(color[2] * 255), 255]
+    return table.tobytes()
@@ -1,11 +1,82 @@
+import collections
 import qt, slicer
 from traitlets import CFloat, Unicode, Int, validate, observe
 from ipywidgets import Image, FloatSlider, VBox, FileUpload, link
 from IPython.display import IFrame
+from .display import _byteArrayToBytes, _captureRenderView, _ViewChangeTracker
+
+class _SliceFrameCache(object):
+    """Least recently used cache of encoded slice view images.
+    Keys contain the view name, slice offset, view size and a stamp that changes when
+    the view content may have changed (see _sliceViewStamp). When the stamp of a view changes,
+    all frames of that view are removed.
+    """
+
+    def __init__(self, maxBytes=64*1024*1024):
+        self.maxBytes = maxBytes
+        self._frames = collections.OrderedDict()
+        self._bytes = 0
+        self._stamps = {}
+
+    def get(self, key):
+        data = self._frames.get(key)
+        if data is not None:
+            self._frames.move_to_end(key)
+        return data
+
+    def put(self, key, data):
+        if key[0] in self._stamps and self._stamps[key[0]] != key[3]:
+            # The frame was captured before the view content changed
+            return
+        if key in self._frames:
+            self._bytes -= len(self._frames.pop(key))
+        self._frames[key] = data
+        self._bytes += len(data)
+        while self._bytes > self.maxBytes and len(self._frames) > 1:
+            oldKey, oldData = self._frames.popitem(last=False)
+            self._bytes -= len(oldData)
+
+    def invalidate(self, viewName, stamp):
+        """Remove all frames of the view if the stamp is different from the previous one."""
+        if self._stamps.get(viewName) == stamp:
+            return
+        self._stamps[viewName] = stamp
+        for key in [key for key in self._frames if key[0] == viewName]:
+            self._bytes -= len(self._frames.pop(key))
+
+    def clear(self):
+        self._frames.clear()
+        self._stamps.clear()
+        self._bytes = 0
+
+_sliceFrameCache = _SliceFrameCache()
+
+def _sliceViewStamp(sliceWidget, contentChangeCounter):
+    """Get a value that changes when anything that is displayed in the slice view changes, except the slice offset.
+    :param contentChangeCounter: changes when any displayed node is modified, except the slice node
+      (see _ViewChangeTracker.contentChangeCounter).
+    """
+    import numpy as np
+    sliceNode = sliceWidget.mrmlSliceNode()
+    sliceToRAS = sliceNode.GetSliceToRAS()
+    orientation = np.array([[sliceToRAS.GetElement(row, column) for column in range(3)] for row in range(3)])
+    # Translation along the slice normal is the slice offset, only the in-plane component is kept
+    translation = np.array([sliceToRAS.GetElement(row, 3) for row in range(3)])
+    normal = orientation[:, 2]
+    inPlaneTranslation = translation - np.dot(translation, normal) * normal
+    return (contentChangeCounter,
+        tuple(np.round(orientation.flatten(), 6)), tuple(np.round(inPlaneTranslation, 4)),
+        tuple(sliceNode.GetFieldOfView()), tuple(sliceNode.GetDimensions()), tuple(sliceNode.GetXYZOrigin()),
+        sliceNode.GetLayoutGridRows(), sliceNode.GetLayoutGridColumns(),
+        sliceNode.GetOrientationMarkerType(), sliceNode.GetRulerType())
 
 class ViewSliceBaseWidget(Image):
     """This class captures a slice view and makes it available
     for display in the output of a Jupyter notebook cell.
+    Captured images are cached, so that going back to a previously displayed slice is fast.
+    While the user is browsing slices, the next `prefetchCount` slices in the direction of motion
+    are rendered and encoded in the background (the slice view in the application is not moved).
+    The image is updated automatically when the view content changes (if `autoUpdate` is True).
     :param viewName: name of the slice view, such as `Red`, `Green`, `Yellow`.
         Get list of all current slice view names by calling `slicer.app.layoutManager().sliceViewNames()`.
     """
@@ -16,11 +87,27 @@ class ViewSliceBaseWidget(Image):
     viewName = Unicode(default_value='Red', help="Slice view name.").tag(sync=True)
 
     def __init__(self, viewName=None, **kwargs):
-        if viewName:
-            self.viewName=viewName
+        self.autoUpdate = True
+        self._viewChangeTracker = _ViewChangeTracker(self._onViewModified)
 
+        self.prefetchCount = 5
+        self._prefetchDirection = 0
+        self._prefetchFrameKey = None
+        self._prefetchStreamId = "slice-prefetch-{0}".format(id(self))
+        self._prefetchTimer = qt.QTimer()
+        self._prefetchTimer.setSingleShot(True)
+        self._prefetchTimer.setInterval(0)
+        self._prefetchTimer.connect('timeout()', self._prefetchNextSlice)
+        self._jupyterKernel = getattr(slicer.modules, "jupyterkernel", None)
+        if self._jupyterKernel:
+            self._jupyterKernel.connect('viewFrameEncoded(QString,QByteArray,int,int)', self._onPrefetchedSliceEncoded)
+
+        # Slider must exist before viewName is set, as changing the view updates the offset range
         self.offsetSlider = FloatSlider(description='Offset')
 
+        if viewName:
+            self.viewName=viewName
+
         self.updateImage()
 
         self._updateOffsetRange()
@@ -32,14 +119,18 @@ class ViewSliceBaseWidget(Image):
 
     @observe('offset')
     def _propagate_offset(self, change):
-        offset = change['new']
         sliceWidget = slicer.app.layoutManager().sliceWidget(self.viewName)
-        sliceBounds = [0,0,0,0,0,0]
-        sliceWidget.sliceController().sliceOffsetSlider().setValue(offset)
+        # Set the offset directly (not through the slider, which would round the value),
+        # so that it matches the offsets of prefetched slices
+        sliceWidget.sliceController().setSliceOffsetValue(change['new'])
         self.updateImage()
+        if change['new'] != change['old']:
+            self._prefetchDirection = 1 if change['new'] > change['old'] else -1
+            self._prefetchTimer.start()
 
     @observe('viewName')
     def _propagate_viewName(self, change):
+        self._prefetchDirection = 0
         self._updateOffsetRange()
         self.updateImage()
 
@@ -53,24 +144,102 @@ class ViewSliceBaseWidget(Image):
             self.offsetMin = positionMin
         if self.offsetMax != positionMax:
             self.offsetMax = positionMax
+        # Move by one slice, so that cached frames can be reused
+        self.offsetSlider.step = sliceWidget.sliceLogic().GetLowestVolumeSliceSpacing()[2]
         if self.offset < self.offsetMin:
             self.offset = self.offsetMin
         elif self.offset > self.offsetMax:
             self.offset = self.offsetMax
 
+    def close(self):
+        self._prefetchTimer.stop()
+        if self._jupyterKernel:
+            self._jupyterKernel.disconnect('viewFrameEncoded(QString,QByteArray,int,int)', self._onPrefetchedSliceEncoded)
+            self._jupyterKernel.clearFrameStream(self._prefetchStreamId)
+        self._viewChangeTracker.close()
+        super().close()
+
+    def _onViewModified(self):
+        if not self.autoUpdate:
+            return
+        self.updateImage()
+
     def updateImage(self):
         if not self.viewName:
             return
-        slicer.app.processEvents()
         sliceWidget = slicer.app.layoutManager().sliceWidget(self.viewName)
-        sliceView = sliceWidget.sliceView()
-        sliceView.forceRender()
-        screenshot = sliceView.grab()
-        bArray = qt.QByteArray()
-        buffer = qt.QBuffer(bArray)
-        buffer.open(qt.QIODevice.WriteOnly)
-        screenshot.save(buffer, "PNG")
-        self.value = bArray.data()
+        if self.value and not self._viewChangeTracker.isModified(sliceWidget.sliceView()):
+            return
+        frameKey = self._frameKey(sliceWidget)
+        data = _sliceFrameCache.get(frameKey) if frameKey else None
+        if data is None:
+            slicer.app.processEvents()
+            data = _captureRenderView(sliceWidget.sliceView(), "PNG")
+            frameKey = self._frameKey(sliceWidget)
+            if frameKey:
+                _sliceFrameCache.put(frameKey, data)
+        self.value = data
+        self._viewChangeTracker.setCaptured(sliceWidget.sliceView())
+
+    def _frameKey(self, sliceWidget, offset=None):
+        """Returns None if frames cannot be cached (view change tracking is not available).
+        :param offset: slice offset of the frame, current slice offset is used if not specified.
+        """
+        contentChangeCounter = self._viewChangeTracker.contentChangeCounter(sliceWidget.sliceView())
+        if contentChangeCounter is None:
+            return None
+        stamp = _sliceViewStamp(sliceWidget, contentChangeCounter)
+        _sliceFrameCache.invalidate(self.viewName, stamp)
+        viewSize = sliceWidget.sliceView().renderWindow().GetSize()
+        if offset is None:
+            offset = sliceWidget.sliceLogic().GetSliceOffset()
+        return (self.viewName, round(offset, 4), tuple(viewSize), stamp)
+
+    def _prefetchOffsets(self):
+        """Get offsets of the next slices in the direction of motion (on the grid of the offset slider)."""
+        step = self.offsetSlider.step
+        if not self._prefetchDirection or step <= 0:
+            return []
+        currentIndex = round((self.offset - self.offsetMin) / step)
+        offsets = []
+        for sliceIndex in range(1, self.prefetchCount + 1):
+            offset = self.offsetMin + (currentIndex + sliceIndex * self._prefetchDirection) * step
+            if offset < self.offsetMin or offset > self.offsetMax:
+                break
+            offsets.append(offset)
+        return offsets
+
+    def _prefetchNextSlice(self):
+        """Render and encode the next slice that is not in the cache yet.
+        Only one slice is encoded at a time, the next one is requested when encoding is completed,
+        so that requests from the notebook are processed between prefetched slices.
+        """
+        if not self._jupyterKernel or self._prefetchFrameKey or not self.viewName:
+            return
+        sliceWidget = slicer.app.layoutManager().sliceWidget(self.viewName)
+        if not sliceWidget:
+            return
+        for offset in self._prefetchOffsets():
+            frameKey = self._frameKey(sliceWidget, offset)
+            if not frameKey:
+                return
+            if _sliceFrameCache.get(frameKey) is not None:
+                continue
+            if self._jupyterKernel.captureSliceAtOffsetAsync(sliceWidget, offset, self._prefetchStreamId, "PNG"):
+                self._prefetchFrameKey = frameKey
+            return
+
+    def _onPrefetchedSliceEncoded(self, streamId, imageData, width, height):
+        if streamId != self._prefetchStreamId or not self._prefetchFrameKey:
+            return
+        frameKey = self._prefetchFrameKey
+        self._prefetchFrameKey = None
+        data = _byteArrayToBytes(imageData)
+        if not data:
+            # Encoding failed, stop prefetching
+            return
+        _sliceFrameCache.put(frameKey, data)
+        self._prefetchTimer.start()
 
 
 class ViewSliceWidget(VBox):
@@ -90,12 +259,16 @@ class ViewSliceWidget(VBox):
 class View3DWidget(Image):
     """This class captures a 3D view and makes it available
     for display in the output of a Jupyter notebook cell.
+    The image is updated automatically when the view content changes (if `autoUpdate` is True).
     :param viewID: integer index of the 3D view node. Valid values are between 0 and `slicer.app.layoutManager().threeDViewCount-1`.
     """
 
     viewIndex = Int(default_value=0, help="3D view index.").tag(sync=True)
 
     def __init__(self, viewID=None, **kwargs):
+        self.autoUpdate = True
+        self._viewChangeTracker = _ViewChangeTracker(self._onViewModified)
+
         if viewID:
             self.viewIndex=viewID
 
@@ -107,19 +280,24 @@ class View3DWidget(Image):
     def _propagate_viewIndex(self, change):
         self.updateImage()
 
+    def close(self):
+        self._viewChangeTracker.close()
+        super().close()
+
+    def _onViewModified(self):
+        if self.autoUpdate:
+            self.updateImage()
+
     def updateImage(self):
         if self.viewIndex == None:
             return
         slicer.app.processEvents()
         widget = slicer.app.layoutManager().threeDWidget(self.viewIndex)
         view = widget.threeDView()
-        view.forceRender()
-        screenshot = view.grab()
-        bArray = qt.QByteArray()
-        buffer = qt.QBuffer(bArray)
-        buffer.open(qt.QIODevice.WriteOnly)
-        screenshot.save(buffer, "PNG")
-        self.value = bArray.data()
+        if self.value and not self._viewChangeTracker.isModified(view):
+            return
+        self.value = _captureRenderView(view, "PNG")
+        self._viewChangeTracker.setCaptured(view)
 
 class FileUploadWidget(FileUpload):
     """Experimental file upload widget."""